@@ -0,0 +1,48 @@
+#include "../src/scanner.h"
+
+#include <chrono>
+#include <iostream>
+#include <string>
+
+// Generates a large slice program in the shape of our generated sources:
+// many small functions, comments, and plenty of numeric literals.
+std::string generateSource(size_t functions) {
+  std::string source;
+  for (size_t i = 0; i < functions; i++) {
+    std::string n = std::to_string(i);
+    source += "# generated function number " + n + "\n";
+    source += "def function" + n + "(alpha, beta, gamma) {\n";
+    source += "    intermediate = alpha * 2.5 + beta / 3 - " + n + "\n";
+    source += "    if (intermediate <= gamma) {\n";
+    source += "        return intermediate * 1000.125\n";
+    source += "    } else {\n";
+    source += "        return function" + n + "(alpha - 1, beta, gamma)\n";
+    source += "    }\n";
+    source += "}\n\n";
+  }
+  return source;
+}
+
+int main(int argc, char **argv) {
+  size_t functions = argc > 1 ? std::stoul(argv[1]) : 100000;
+  int iterations = argc > 2 ? std::stoi(argv[2]) : 10;
+  std::string source = generateSource(functions);
+
+  size_t tokens = 0;
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < iterations; i++) {
+    Scanner scanner(source);
+    scanner.scanTokens();
+    tokens += scanner.tokens().size();
+  }
+  std::chrono::duration<double> elapsed =
+      std::chrono::steady_clock::now() - start;
+
+  double bytes = static_cast<double>(source.size()) * iterations;
+  std::cout << "scanned " << tokens / iterations << " tokens ("
+            << source.size() / (1024 * 1024) << " MB) " << iterations
+            << " times" << std::endl;
+  std::cout << tokens / elapsed.count() / 1e6 << " M tokens/s, "
+            << bytes / elapsed.count() / (1024 * 1024) << " MB/s" << std::endl;
+  return 0;
+}
@@ -0,0 +1,101 @@
+#include "../src/bytecode.h"
+#include "../src/codegen.h"
+#include "../src/interpreter.h"
+#include "../src/jit.h"
+#include "../src/vm.h"
+
+#include <chrono>
+#include <iostream>
+#include <string>
+
+const std::string fib_source = "def fib(x) {\n"
+                               "if (x < 3) {\n"
+                               "return 1\n"
+                               "}\n"
+                               "return fib(x - 1) + fib(x - 2)\n"
+                               "}\n";
+
+const std::string kernel_source = "def kernel(x, y) {\n"
+                                  "a = x * y\n"
+                                  "b = a + x / 3\n"
+                                  "c = b * b - y\n"
+                                  "return c / 2\n"
+                                  "}\n";
+
+template <typename F> double seconds(F work) {
+  auto start = std::chrono::steady_clock::now();
+  work();
+  std::chrono::duration<double> elapsed =
+      std::chrono::steady_clock::now() - start;
+  return elapsed.count();
+}
+
+// Time from source to the first result, which is what one-shot evaluations
+// pay: the VM only lowers to bytecode, the JIT sets up LLVM and runs O3.
+void oneShot(int iterations) {
+  double result = 0;
+  double vm_time = seconds([&] {
+    for (int i = 0; i < iterations; i++) {
+      Scanner scanner(kernel_source);
+      auto program = Parser(scanner).parse();
+      BytecodeProgram bytecode = BytecodeCompiler::compile(*program);
+      result += VM(bytecode).call("kernel", {3, 4});
+    }
+  });
+  double jit_time = seconds([&] {
+    for (int i = 0; i < iterations; i++) {
+      Scanner scanner(kernel_source);
+      auto program = Parser(scanner).parse();
+      CodegenVisitor visitor;
+      visitor.visitProgramNode(program.get());
+      visitor.optimize();
+      JIT jit;
+      jit.addModule(visitor.takeModule());
+      result += jit.call("kernel", {3, 4});
+    }
+  });
+  std::cout << "one-shot kernel: vm " << vm_time / iterations * 1e6
+            << " us, jit " << jit_time / iterations * 1e6 << " us ("
+            << result << ")" << std::endl;
+}
+
+void fib(double n) {
+  Scanner scanner(fib_source);
+  auto program = Parser(scanner).parse();
+  const FunctionNode *fib_node = program->getFunctions()[0];
+  BytecodeProgram bytecode = BytecodeCompiler::compile(*program);
+  VM vm(bytecode);
+  Interpreter interpreter(
+      [&](std::string_view, const std::vector<double> &args) {
+        return interpreter.run(fib_node, args);
+      });
+
+  double vm_result = 0;
+  double vm_time = seconds([&] { vm_result = vm.call("fib", {n}); });
+  double interpreter_result = 0;
+  double interpreter_time =
+      seconds([&] { interpreter_result = interpreter.run(fib_node, {n}); });
+  // compiling isn't timed, only the calls
+  CodegenVisitor visitor;
+  visitor.visitProgramNode(program.get());
+  visitor.optimize();
+  JIT jit;
+  jit.addModule(visitor.takeModule());
+  double jit_result = 0;
+  double jit_time = seconds([&] { jit_result = jit.call("fib", {n}); });
+  std::cout << "fib(" << n << ") = " << vm_result << ": vm " << vm_time * 1e3
+            << " ms, ast interpreter " << interpreter_time * 1e3
+            << " ms, jit " << jit_time * 1e3 << " ms" << std::endl;
+  if (vm_result != interpreter_result || vm_result != jit_result) {
+    std::cout << "results differ" << std::endl;
+    exit(1);
+  }
+}
+
+int main(int argc, char **argv) {
+  double n = argc > 1 ? std::stod(argv[1]) : 30;
+  int iterations = argc > 2 ? std::stoi(argv[2]) : 20;
+  oneShot(iterations);
+  fib(n);
+  return 0;
+}
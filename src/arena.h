@@ -0,0 +1,98 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// A contiguous run of Ts that lives in an Arena.
+template <typename T> class ArenaArray {
+public:
+  ArenaArray() = default;
+  ArenaArray(T *data, size_t size) : data_(data), size_(size) {}
+
+  size_t size() const { return size_; }
+  bool empty() const { return size_ == 0; }
+  T *data() const { return data_; }
+  T &operator[](size_t idx) const { return data_[idx]; }
+  T *begin() const { return data_; }
+  T *end() const { return data_ + size_; }
+
+private:
+  T *data_ = nullptr;
+  size_t size_ = 0;
+};
+
+// Bump pointer allocator. Everything allocated from an arena is released at
+// once when the arena is destroyed and destructors are never run, so only
+// trivially destructible types can be allocated from it.
+class Arena {
+public:
+  Arena() = default;
+  Arena(const Arena &) = delete;
+  Arena &operator=(const Arena &) = delete;
+
+  void *allocate(size_t size, size_t align) {
+    size_t padding = -reinterpret_cast<uintptr_t>(current_) & (align - 1);
+    if (padding + size > static_cast<size_t>(end_ - current_)) {
+      newChunk(size + align);
+      padding = -reinterpret_cast<uintptr_t>(current_) & (align - 1);
+    }
+    char *result = current_ + padding;
+    current_ = result + size;
+    return result;
+  }
+
+  template <typename T, typename... Args> T *make(Args &&...args) {
+    static_assert(std::is_trivially_destructible<T>::value,
+                  "arena allocated types are never destroyed");
+    return new (allocate(sizeof(T), alignof(T)))
+        T(std::forward<Args>(args)...);
+  }
+
+  template <typename T> ArenaArray<T> copyArray(const T *values, size_t size) {
+    static_assert(std::is_trivially_copyable<T>::value,
+                  "arena arrays are copied bytewise");
+    if (size == 0) {
+      return ArenaArray<T>();
+    }
+    T *data = static_cast<T *>(allocate(sizeof(T) * size, alignof(T)));
+    std::memcpy(data, values, sizeof(T) * size);
+    return ArenaArray<T>(data, size);
+  }
+
+  // Makes sure the next `size` bytes of allocations fit in the current
+  // chunk, for callers that know up front how much they're going to need.
+  void reserve(size_t size) {
+    if (size > static_cast<size_t>(end_ - current_)) {
+      newChunk(size);
+    }
+  }
+
+  size_t bytesReserved() const { return bytes_reserved_; }
+
+private:
+  void newChunk(size_t min_size) {
+    size_t size = next_chunk_size_ > min_size ? next_chunk_size_ : min_size;
+    // not make_unique, which would zero the chunk
+    chunks_.emplace_back(new char[size]);
+    current_ = chunks_.back().get();
+    end_ = current_ + size;
+    bytes_reserved_ += size;
+    if (next_chunk_size_ < kMaxChunkSize) {
+      next_chunk_size_ *= 2;
+    }
+  }
+
+  static constexpr size_t kMaxChunkSize = 1 << 20;
+
+  std::vector<std::unique_ptr<char[]>> chunks_;
+  char *current_ = nullptr;
+  char *end_ = nullptr;
+  size_t next_chunk_size_ = 4096;
+  size_t bytes_reserved_ = 0;
+};
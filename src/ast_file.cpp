@@ -0,0 +1,513 @@
+#include "ast_file.h"
+#include "visitor.h"
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <vector>
+
+namespace {
+
+constexpr char kMagic[8] = {'l', 'a', 'n', 'g', '-', 'a', 's', 't'};
+
+enum AstRecord : uint32_t {
+  rec_number,
+  rec_identifier,
+  rec_binary,
+  rec_call,
+  rec_definition,
+  rec_return,
+  rec_conditional,
+  rec_body,
+  rec_function,
+  rec_while,
+  rec_for,
+  rec_index,
+  rec_store,
+  rec_extern,
+};
+
+struct AstFileHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t name_count;
+  uint32_t name_bytes;
+  uint32_t word_count;
+  uint32_t node_count;
+  uint32_t list_count;
+  uint32_t function_count;
+};
+
+// Writes the records in post order, so every node's children are already
+// on the loader's stacks by the time the node itself is read.
+//   number       kind, literal kind, low and high word of the value, low
+//                and high word of the integer value
+//   identifier   kind, name
+//   binary       kind, operator; pops rhs and lhs
+//   call         kind, name, arg count; pops the args
+//   definition   kind, name; pops the rhs
+//   return       kind; pops the expr
+//   conditional  kind, has else, branch hint; pops the else body, if body
+//                and condition
+//   body         kind, block count; pops the blocks
+//   function     kind, name, arg count, return type, float mode, arg names,
+//                arg types; pops the body
+//   extern       like function, without the float mode and body
+//   while        kind, loop hints; pops the body and condition
+//   for          kind, variable name, loop hints; pops the body, step, end
+//                and start
+//   index        kind, slice name; pops the index
+//   store        kind, slice name; pops the value and index
+class AstWriter : public Visitor {
+public:
+  void visitBinaryExprNode(const BinaryExprNode *node) override {
+    node->getLHS()->accept(this);
+    node->getRHS()->accept(this);
+    record(rec_binary, {static_cast<uint32_t>(node->getOperator())});
+  }
+
+  void visitNumberLiteralNode(const NumberLiteralNode *node) override {
+    const auto &literal = node->getLiteral();
+    uint32_t halves[4];
+    std::memcpy(halves, &literal.value, sizeof(literal.value));
+    std::memcpy(halves + 2, &literal.integer, sizeof(literal.integer));
+    record(rec_number, {static_cast<uint32_t>(literal.kind), halves[0],
+                        halves[1], halves[2], halves[3]});
+  }
+
+  void visitIdentifierExprNode(const IdentifierExprNode *node) override {
+    record(rec_identifier, {names_.intern(node->getName())});
+  }
+
+  void visitFunctionCallExprNode(const FunctionCallExprNode *node) override {
+    for (auto *arg : node->getArgs()) {
+      arg->accept(this);
+    }
+    lists_ += node->getArgs().size();
+    record(rec_call, {names_.intern(node->getName()),
+                      static_cast<uint32_t>(node->getArgs().size())});
+  }
+
+  void visitIndexExprNode(const IndexExprNode *node) override {
+    node->getIndex()->accept(this);
+    record(rec_index, {names_.intern(node->getSlice())});
+  }
+
+  void visitBodyNode(const BodyNode *node) override {
+    for (auto *block : node->getBlocks()) {
+      block->accept(this);
+    }
+    lists_ += node->getBlocks().size();
+    record(rec_body, {static_cast<uint32_t>(node->getBlocks().size())});
+  }
+
+  void visitConditionalNode(const ConditionalNode *node) override {
+    node->getIfExpr()->accept(this);
+    node->getIfBody()->accept(this);
+    if (node->getElseBody()) {
+      node->getElseBody()->accept(this);
+    }
+    record(rec_conditional, {node->getElseBody() ? 1u : 0u,
+                             static_cast<uint32_t>(node->getHint())});
+  }
+
+  void visitWhileNode(const WhileNode *node) override {
+    node->getCondition()->accept(this);
+    node->getBody()->accept(this);
+    record(rec_while, {node->getHints().pack()});
+  }
+
+  void visitForNode(const ForNode *node) override {
+    node->getStart()->accept(this);
+    node->getEnd()->accept(this);
+    node->getStep()->accept(this);
+    node->getBody()->accept(this);
+    record(rec_for,
+           {names_.intern(node->getVariable()), node->getHints().pack()});
+  }
+
+  void visitDefinitionNode(const DefinitionNode *node) override {
+    node->getRHS()->accept(this);
+    record(rec_definition, {names_.intern(node->getLValue())});
+  }
+
+  void visitStoreNode(const StoreNode *node) override {
+    node->getIndex()->accept(this);
+    node->getValue()->accept(this);
+    record(rec_store, {names_.intern(node->getSlice())});
+  }
+
+  void visitReturnNode(const ReturnNode *node) override {
+    node->getExpr()->accept(this);
+    record(rec_return, {});
+  }
+
+  void
+  visitFunctionDeclarationNode(const FunctionDeclarationNode *node) override {}
+
+  void visitFunctionNode(const FunctionNode *node) override {
+    if (!node->isExtern()) {
+      node->getBody()->accept(this);
+    }
+    const auto *declaration = node->getFunctionDeclaration();
+    uint32_t arg_count = declaration->getArgs().size();
+    record(node->isExtern() ? rec_extern : rec_function,
+           {names_.intern(declaration->getName()), arg_count,
+            static_cast<uint32_t>(declaration->getReturnType())});
+    if (!node->isExtern()) {
+      words_.push_back(node->getFloatMode());
+    }
+    for (auto arg : declaration->getArgs()) {
+      words_.push_back(names_.intern(arg));
+    }
+    for (uint32_t i = 0; i < arg_count; i++) {
+      words_.push_back(declaration->getArgType(i));
+    }
+    // the declaration is a node of its own once loaded
+    nodes_++;
+    lists_ += declaration->getArgs().size() +
+              declaration->getArgTypes().size();
+    functions_++;
+  }
+
+  void visitProgramNode(const Program *node) override {
+    for (auto *function : node->getFunctions()) {
+      function->accept(this);
+    }
+    lists_ += node->getFunctions().size();
+  }
+
+  std::string finish() const {
+    std::vector<uint32_t> name_table;
+    std::string name_bytes;
+    for (uint32_t id = 0; id < names_.size(); id++) {
+      auto name = names_.get(id);
+      name_table.push_back(name_bytes.size());
+      name_table.push_back(name.size());
+      name_bytes.append(name.data(), name.size());
+    }
+
+    AstFileHeader header;
+    std::memcpy(header.magic, kMagic, sizeof(kMagic));
+    header.version = kAstFileVersion;
+    header.name_count = names_.size();
+    header.name_bytes = name_bytes.size();
+    header.word_count = words_.size();
+    header.node_count = nodes_;
+    header.list_count = lists_;
+    header.function_count = functions_;
+
+    std::string out;
+    out.append(reinterpret_cast<const char *>(&header), sizeof(header));
+    out.append(reinterpret_cast<const char *>(name_table.data()),
+               name_table.size() * sizeof(uint32_t));
+    out.append(reinterpret_cast<const char *>(words_.data()),
+               words_.size() * sizeof(uint32_t));
+    out += name_bytes;
+    return out;
+  }
+
+private:
+  void record(AstRecord kind, std::initializer_list<uint32_t> operands) {
+    words_.push_back(kind);
+    words_.insert(words_.end(), operands.begin(), operands.end());
+    nodes_++;
+  }
+
+  IdentifierTable names_;
+  std::vector<uint32_t> words_;
+  uint32_t nodes_ = 0;
+  uint32_t lists_ = 0;
+  uint32_t functions_ = 0;
+};
+
+[[noreturn]] void malformed(const char *what) {
+  std::cout << "Malformed AST file: " << what << std::endl;
+  exit(1);
+}
+
+// Replays the records onto one stack per kind of node. Children are popped
+// straight off the top of their stack into the arena, so apart from the
+// stacks nothing is allocated per node.
+class AstLoader {
+public:
+  AstLoader(std::string_view contents) : contents_(contents) {}
+
+  std::unique_ptr<Program> load() {
+    if (contents_.size() < sizeof(AstFileHeader)) {
+      malformed("truncated header");
+    }
+    AstFileHeader header;
+    std::memcpy(&header, contents_.data(), sizeof(header));
+    if (std::memcmp(header.magic, kMagic, sizeof(kMagic)) != 0) {
+      malformed("bad magic");
+    }
+    if (header.version != kAstFileVersion) {
+      std::cout << "AST file version " << header.version
+                << " doesn't match version " << kAstFileVersion
+                << ", it has to be regenerated from source" << std::endl;
+      exit(1);
+    }
+    uint64_t size = sizeof(header) +
+                    (uint64_t(header.name_count) * 2 + header.word_count) *
+                        sizeof(uint32_t) +
+                    header.name_bytes;
+    if (contents_.size() != size) {
+      malformed("size doesn't match the header");
+    }
+    // every node and list entry takes at least a word, which bounds the
+    // arena reservation for corrupt headers
+    if (header.node_count > header.word_count ||
+        header.list_count > header.word_count) {
+      malformed("node counts don't match the records");
+    }
+    name_table_ = contents_.data() + sizeof(header);
+    words_ = name_table_ + header.name_count * 2 * sizeof(uint32_t);
+    name_bytes_ = words_ + header.word_count * sizeof(uint32_t);
+    name_count_ = header.name_count;
+    name_byte_count_ = header.name_bytes;
+    word_count_ = header.word_count;
+
+    // every node, plus the padding in front of it, and every list entry fits
+    // in a single chunk
+    constexpr size_t kMaxNodeSize = std::max(
+        {sizeof(FunctionDeclarationNode), sizeof(BinaryExprNode),
+         sizeof(NumberLiteralNode), sizeof(IdentifierExprNode),
+         sizeof(FunctionCallExprNode), sizeof(IndexExprNode),
+         sizeof(BodyNode), sizeof(ConditionalNode), sizeof(WhileNode),
+         sizeof(ForNode), sizeof(DefinitionNode), sizeof(StoreNode),
+         sizeof(ReturnNode), sizeof(FunctionNode)});
+    arena_ = std::make_unique<Arena>();
+    arena_->reserve(
+        size_t(header.node_count) * (kMaxNodeSize + alignof(std::max_align_t)) +
+        size_t(header.list_count) * sizeof(std::string_view));
+
+    while (word_idx_ < word_count_) {
+      readRecord();
+    }
+    if (!exprs_.empty() || !blocks_.empty() || !bodies_.empty()) {
+      malformed("nodes left outside of a function");
+    }
+    if (functions_.size() != header.function_count) {
+      malformed("function count doesn't match the header");
+    }
+    auto functions = arena_->copyArray(functions_.data(), functions_.size());
+    return std::make_unique<Program>(std::move(arena_), functions);
+  }
+
+private:
+  void readRecord() {
+    uint32_t record_kind = next();
+    switch (record_kind) {
+    case rec_number: {
+      uint32_t kind = next();
+      if (kind > num_f64) {
+        malformed("unknown number kind");
+      }
+      uint32_t halves[4] = {next(), next(), next(), next()};
+      NumberLiteral literal{static_cast<NumberKind>(kind), 0, 0};
+      std::memcpy(&literal.value, halves, sizeof(literal.value));
+      std::memcpy(&literal.integer, halves + 2, sizeof(literal.integer));
+      exprs_.push_back(arena_->make<NumberLiteralNode>(literal));
+      break;
+    }
+    case rec_identifier:
+      exprs_.push_back(arena_->make<IdentifierExprNode>(name(next())));
+      break;
+    case rec_binary: {
+      auto op = static_cast<TokenType>(next());
+      ExprNode *rhs = pop(exprs_);
+      ExprNode *lhs = pop(exprs_);
+      exprs_.push_back(arena_->make<BinaryExprNode>(op, lhs, rhs));
+      break;
+    }
+    case rec_call: {
+      std::string_view callee = name(next());
+      auto args = popArray(exprs_, next());
+      exprs_.push_back(arena_->make<FunctionCallExprNode>(callee, args));
+      break;
+    }
+    case rec_index: {
+      std::string_view slice = name(next());
+      exprs_.push_back(arena_->make<IndexExprNode>(slice, pop(exprs_)));
+      break;
+    }
+    case rec_store: {
+      std::string_view slice = name(next());
+      ExprNode *value = pop(exprs_);
+      ExprNode *index = pop(exprs_);
+      blocks_.push_back(arena_->make<StoreNode>(slice, index, value));
+      break;
+    }
+    case rec_definition: {
+      std::string_view lvalue = name(next());
+      blocks_.push_back(arena_->make<DefinitionNode>(lvalue, pop(exprs_)));
+      break;
+    }
+    case rec_return:
+      blocks_.push_back(arena_->make<ReturnNode>(pop(exprs_)));
+      break;
+    case rec_conditional: {
+      bool has_else = next();
+      uint32_t hint = next();
+      if (hint > branch_unlikely) {
+        malformed("unknown branch hint");
+      }
+      BodyNode *else_body = has_else ? pop(bodies_) : nullptr;
+      BodyNode *if_body = pop(bodies_);
+      ExprNode *if_expr = pop(exprs_);
+      blocks_.push_back(arena_->make<ConditionalNode>(
+          if_expr, if_body, else_body, static_cast<BranchHint>(hint)));
+      break;
+    }
+    case rec_while: {
+      LoopHints hints = LoopHints::unpack(next());
+      BodyNode *body = pop(bodies_);
+      ExprNode *condition = pop(exprs_);
+      blocks_.push_back(arena_->make<WhileNode>(condition, body, hints));
+      break;
+    }
+    case rec_for: {
+      std::string_view variable = name(next());
+      LoopHints hints = LoopHints::unpack(next());
+      BodyNode *body = pop(bodies_);
+      ExprNode *step = pop(exprs_);
+      ExprNode *end = pop(exprs_);
+      ExprNode *start = pop(exprs_);
+      blocks_.push_back(
+          arena_->make<ForNode>(variable, start, end, step, body, hints));
+      break;
+    }
+    case rec_body:
+      bodies_.push_back(arena_->make<BodyNode>(popArray(blocks_, next())));
+      break;
+    case rec_function:
+    case rec_extern: {
+      bool is_extern = record_kind == rec_extern;
+      std::string_view function_name = name(next());
+      uint32_t arg_count = next();
+      ValueType return_type = type(next());
+      if (isSliceType(return_type)) {
+        malformed("function returns a slice");
+      }
+      FloatMode float_mode = float_default;
+      if (!is_extern) {
+        uint32_t mode = next();
+        if (mode > float_fast) {
+          malformed("unknown float mode");
+        }
+        float_mode = static_cast<FloatMode>(mode);
+      }
+      if (arg_count > (word_count_ - word_idx_) / 2) {
+        malformed("truncated argument list");
+      }
+      auto *args = static_cast<std::string_view *>(arena_->allocate(
+          sizeof(std::string_view) * arg_count, alignof(std::string_view)));
+      for (uint32_t i = 0; i < arg_count; i++) {
+        new (&args[i]) std::string_view(name(next()));
+      }
+      // all f64 arguments are stored without types, like the parser does
+      arg_types_.clear();
+      bool typed_args = false;
+      for (uint32_t i = 0; i < arg_count; i++) {
+        arg_types_.push_back(type(next()));
+        typed_args |= arg_types_.back() != type_f64;
+      }
+      ArenaArray<ValueType> arg_types;
+      if (typed_args) {
+        arg_types = arena_->copyArray(arg_types_.data(), arg_count);
+      }
+      auto *declaration = arena_->make<FunctionDeclarationNode>(
+          function_name, ArenaArray<std::string_view>(args, arg_count),
+          arg_types, return_type, is_extern);
+      functions_.push_back(arena_->make<FunctionNode>(
+          declaration, is_extern ? nullptr : pop(bodies_), float_mode));
+      break;
+    }
+    default:
+      malformed("unknown record kind");
+    }
+  }
+
+  uint32_t next() {
+    if (word_idx_ >= word_count_) {
+      malformed("truncated record");
+    }
+    uint32_t word;
+    std::memcpy(&word, words_ + word_idx_ * sizeof(uint32_t), sizeof(word));
+    word_idx_++;
+    return word;
+  }
+
+  ValueType type(uint32_t word) {
+    if (word > type_i32_slice) {
+      malformed("unknown type");
+    }
+    return static_cast<ValueType>(word);
+  }
+
+  std::string_view name(uint32_t id) {
+    if (id >= name_count_) {
+      malformed("name out of range");
+    }
+    uint32_t entry[2];
+    std::memcpy(entry, name_table_ + id * sizeof(entry), sizeof(entry));
+    if (entry[0] > name_byte_count_ || entry[1] > name_byte_count_ - entry[0]) {
+      malformed("name out of range");
+    }
+    return std::string_view(name_bytes_ + entry[0], entry[1]);
+  }
+
+  template <typename T> T *pop(std::vector<T *> &stack) {
+    if (stack.empty()) {
+      malformed("record is missing a child");
+    }
+    T *top = stack.back();
+    stack.pop_back();
+    return top;
+  }
+
+  template <typename T>
+  ArenaArray<T *> popArray(std::vector<T *> &stack, uint32_t count) {
+    if (count > stack.size()) {
+      malformed("record is missing a child");
+    }
+    size_t start = stack.size() - count;
+    auto array = arena_->copyArray(stack.data() + start, count);
+    stack.resize(start);
+    return array;
+  }
+
+  std::string_view contents_;
+  const char *name_table_ = nullptr;
+  const char *words_ = nullptr;
+  const char *name_bytes_ = nullptr;
+  uint32_t name_count_ = 0;
+  uint32_t name_byte_count_ = 0;
+  uint32_t word_count_ = 0;
+  uint32_t word_idx_ = 0;
+
+  std::unique_ptr<Arena> arena_;
+  std::vector<ExprNode *> exprs_;
+  std::vector<BodySubNode *> blocks_;
+  std::vector<BodyNode *> bodies_;
+  std::vector<FunctionNode *> functions_;
+  std::vector<ValueType> arg_types_;
+};
+
+} // namespace
+
+bool isSerializedProgram(std::string_view contents) {
+  return contents.size() >= sizeof(kMagic) &&
+         std::memcmp(contents.data(), kMagic, sizeof(kMagic)) == 0;
+}
+
+std::string serializeProgram(const Program &program) {
+  AstWriter writer;
+  writer.visitProgramNode(&program);
+  return writer.finish();
+}
+
+std::unique_ptr<Program> loadProgram(std::string_view contents) {
+  return AstLoader(contents).load();
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include "parser.h"
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+
+// Binary form of a parsed program, so large generated sources only have to be
+// scanned and parsed once. The file is a header, a table of the interned
+// names, the nodes as a post order stream of 32 bit words and the bytes of
+// the names:
+//
+//   header   "lang-ast", version, name count, name bytes, word count, node
+//            count, list entry count, function count (u32 each)
+//   names    offset and length of each name in the name bytes (u32 each)
+//   words    one record per node, a kind followed by its operands
+//   bytes    the names back to back, each one stored once
+//
+// Words are in host byte order, files are meant to be produced and consumed
+// on the same machine. Only what was parsed is stored, a loaded program has
+// to be type checked again.
+constexpr uint32_t kAstFileVersion = 7;
+
+// Whether the contents start like a serialized program rather than source.
+bool isSerializedProgram(std::string_view contents);
+
+std::string serializeProgram(const Program &program);
+
+// Rebuilds the program in a single arena chunk sized from the header. Names
+// in the tree are views into the contents, which have to outlive the
+// program, e.g. the SourceFile mapping of the file.
+std::unique_ptr<Program> loadProgram(std::string_view contents);
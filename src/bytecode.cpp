@@ -0,0 +1,369 @@
+#include "bytecode.h"
+#include "native.h"
+#include "numeric.h"
+
+#include <cstring>
+#include <iostream>
+#include <optional>
+
+int32_t BytecodeProgram::find(std::string_view name) const {
+  for (size_t i = 0; i < functions.size(); i++) {
+    if (functions[i].name == name) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+BytecodeProgram BytecodeCompiler::compile(const Program &program) {
+  BytecodeCompiler compiler;
+  compiler.visitProgramNode(&program);
+  return std::move(compiler.program_);
+}
+
+uint16_t BytecodeCompiler::emit(Opcode op, uint16_t a, uint16_t b,
+                                uint16_t c) {
+  if (function_->code.size() > UINT16_MAX) {
+    std::cout << function_->name << " is too large for the bytecode VM"
+              << std::endl;
+    exit(1);
+  }
+  function_->code.push_back({op, a, b, c});
+  return function_->code.size() - 1;
+}
+
+uint16_t BytecodeCompiler::allocateTemporary() {
+  if (next_register_ >= UINT16_MAX) {
+    std::cout << function_->name << " needs too many registers" << std::endl;
+    exit(1);
+  }
+  uint16_t reg = next_register_++;
+  if (next_register_ > function_->frame_size) {
+    function_->frame_size = next_register_;
+  }
+  return reg;
+}
+
+uint16_t BytecodeCompiler::constant(double value) {
+  auto &constants = function_->constants;
+  // compared bitwise, so 0 and -0 stay distinct
+  for (size_t i = 0; i < constants.size(); i++) {
+    if (std::memcmp(&constants[i], &value, sizeof(double)) == 0) {
+      return i;
+    }
+  }
+  if (constants.size() > UINT16_MAX) {
+    std::cout << function_->name << " has too many constants" << std::endl;
+    exit(1);
+  }
+  constants.push_back(value);
+  return constants.size() - 1;
+}
+
+uint16_t BytecodeCompiler::variable(std::string_view name) {
+  auto reg = variables_.find(name);
+  if (reg == variables_.end()) {
+    std::cout << "did not find identifier " << name << std::endl;
+    exit(1);
+  }
+  return reg->second;
+}
+
+void BytecodeCompiler::visitProgramNode(const Program *node) {
+  // every function gets its index up front so calls can refer to functions
+  // defined further down
+  for (const auto *function : node->getFunctions()) {
+    const auto *declaration = function->getFunctionDeclaration();
+    function_ids_[declaration->getName()] = program_.functions.size();
+    program_.functions.emplace_back();
+    program_.functions.back().name = declaration->getName();
+    program_.functions.back().arity = declaration->getArgs().size();
+    if (declaration->isTyped()) {
+      for (size_t i = 0; i < declaration->getArgs().size(); i++) {
+        program_.functions.back().arg_types.push_back(
+            declaration->getArgType(i));
+      }
+    }
+  }
+  for (auto *function : node->getFunctions()) {
+    function->accept(this);
+  }
+}
+
+void BytecodeCompiler::visitFunctionNode(const FunctionNode *node) {
+  auto *declaration = node->getFunctionDeclaration();
+  function_ = &program_.functions[function_ids_[declaration->getName()]];
+  if (node->isExtern()) {
+    function_->is_extern = true;
+    if (!declaration->isTyped() && function_->arity <= kMaxNativeArgs) {
+      function_->native = findNativeFunction(declaration->getName());
+    }
+    return;
+  }
+  if (declaration->takesSlices()) {
+    function_->native_only = true;
+    return;
+  }
+  variables_.clear();
+  next_register_ = 0;
+  declaration->accept(this);
+  locals_ = next_register_;
+  node->getBody()->accept(this);
+  // falling off the end returns 0
+  uint16_t zero = allocateTemporary();
+  emit(op_const, zero, constant(0));
+  emit(op_return, zero);
+}
+
+void BytecodeCompiler::visitFunctionDeclarationNode(
+    const FunctionDeclarationNode *node) {
+  for (auto arg : node->getArgs()) {
+    variables_[arg] = allocateTemporary();
+  }
+}
+
+void BytecodeCompiler::visitBodyNode(const BodyNode *node) {
+  for (auto *block : node->getBlocks()) {
+    block->accept(this);
+    // temporaries don't outlive the statement that needed them
+    next_register_ = locals_;
+  }
+}
+
+uint16_t BytecodeCompiler::emitConditionalJump(ExprNode *condition) {
+  if (condition->getExprNodeType() == ExprNode::BinaryExprNode) {
+    const auto *binary = static_cast<const BinaryExprNode *>(condition);
+    Opcode jump = op_jump;
+    switch (binary->getOperator()) {
+    case tok_lt:
+      jump = op_jump_unless_lt;
+      break;
+    case tok_lte:
+      jump = op_jump_unless_lte;
+      break;
+    case tok_gt:
+      jump = op_jump_unless_gt;
+      break;
+    case tok_gte:
+      jump = op_jump_unless_gte;
+      break;
+    default:
+      break;
+    }
+    if (jump != op_jump) {
+      // compare and branch in one instruction, the 1 or 0 is never stored
+      binary->getLHS()->accept(this);
+      uint16_t lhs = last_;
+      binary->getRHS()->accept(this);
+      return emit(jump, lhs, last_);
+    }
+  }
+  condition->accept(this);
+  return emit(op_jump_if_false, last_);
+}
+
+void BytecodeCompiler::visitConditionalNode(const ConditionalNode *node) {
+  uint16_t skip_if = emitConditionalJump(node->getIfExpr());
+  next_register_ = locals_;
+  node->getIfBody()->accept(this);
+  if (!node->getElseBody()) {
+    function_->code[skip_if].c = function_->code.size();
+    return;
+  }
+  uint16_t skip_else = emit(op_jump);
+  function_->code[skip_if].c = function_->code.size();
+  node->getElseBody()->accept(this);
+  function_->code[skip_else].c = function_->code.size();
+}
+
+void BytecodeCompiler::visitWhileNode(const WhileNode *node) {
+  uint16_t loop = function_->code.size();
+  uint16_t exit = emitConditionalJump(node->getCondition());
+  next_register_ = locals_;
+  node->getBody()->accept(this);
+  emit(op_jump, 0, 0, loop);
+  function_->code[exit].c = function_->code.size();
+}
+
+void BytecodeCompiler::visitForNode(const ForNode *node) {
+  uint16_t variable = assign(node->getVariable(), node->getStart());
+  // the end and step are held in registers of their own for the whole loop
+  uint16_t end = storeLocal(node->getEnd());
+  uint16_t step = storeLocal(node->getStep());
+  next_register_ = locals_;
+  uint16_t loop = function_->code.size();
+  uint16_t exit = emit(op_jump_unless_lt, variable, end);
+  node->getBody()->accept(this);
+  emitBinary(tok_add, node->getStart()->getType(), variable, variable, step);
+  emit(op_jump, 0, 0, loop);
+  function_->code[exit].c = function_->code.size();
+}
+
+uint16_t BytecodeCompiler::storeLocal(ExprNode *value) {
+  value->accept(this);
+  // the local takes the first free register, which may be the one the value
+  // was computed into
+  next_register_ = locals_;
+  uint16_t reg = allocateTemporary();
+  locals_++;
+  if (reg != last_) {
+    emit(op_move, reg, last_);
+  }
+  return reg;
+}
+
+uint16_t BytecodeCompiler::assign(std::string_view name, ExprNode *value) {
+  auto existing = variables_.find(name);
+  if (existing != variables_.end()) {
+    value->accept(this);
+    emit(op_move, existing->second, last_);
+    return existing->second;
+  }
+  uint16_t reg = storeLocal(value);
+  variables_[name] = reg;
+  return reg;
+}
+
+// slices only occur in functions that take them, which have no bytecode
+void BytecodeCompiler::visitIndexExprNode(const IndexExprNode *node) {}
+void BytecodeCompiler::visitStoreNode(const StoreNode *node) {}
+
+void BytecodeCompiler::visitDefinitionNode(const DefinitionNode *node) {
+  assign(node->getLValue(), node->getRHS());
+}
+
+void BytecodeCompiler::visitReturnNode(const ReturnNode *node) {
+  node->getExpr()->accept(this);
+  emit(op_return, last_);
+}
+
+void BytecodeCompiler::visitBinaryExprNode(const BinaryExprNode *node) {
+  uint32_t mark = next_register_;
+  node->getLHS()->accept(this);
+  uint16_t lhs = last_;
+  node->getRHS()->accept(this);
+  uint16_t rhs = last_;
+  // operands are read before the result is written, so the result can reuse
+  // their temporaries
+  next_register_ = mark;
+  last_ = allocateTemporary();
+  emitBinary(node->getOperator(), node->getLHS()->getType(), last_, lhs, rhs);
+}
+
+void BytecodeCompiler::emitBinary(TokenType op, ValueType type,
+                                  uint16_t result, uint16_t lhs,
+                                  uint16_t rhs) {
+  bool is_integer = isIntegerType(type);
+  Opcode opcode;
+  switch (op) {
+  case tok_add:
+    opcode = is_integer ? op_iadd : op_add;
+    break;
+  case tok_sub:
+    opcode = is_integer ? op_isub : op_sub;
+    break;
+  case tok_mul:
+    opcode = type == type_i32 ? op_imul_i32 : is_integer ? op_imul : op_mul;
+    break;
+  case tok_div:
+    opcode = is_integer ? op_idiv : op_div;
+    break;
+  case tok_mod:
+    opcode = is_integer ? op_imod : op_mod;
+    break;
+  case tok_lt:
+    opcode = op_lt;
+    break;
+  case tok_lte:
+    opcode = op_lte;
+    break;
+  case tok_gt:
+    opcode = op_gt;
+    break;
+  case tok_gte:
+    opcode = op_gte;
+    break;
+  default:
+    std::cout << "Unknown operator when compiling binary expr" << std::endl;
+    exit(1);
+  }
+  emit(opcode, result, lhs, rhs);
+  if (opcode >= op_lt || opcode == op_imul_i32) {
+    return;
+  }
+  // results that don't fit the type are rounded or wrapped in place
+  if (type == type_i32) {
+    emit(op_wrap_i32, result, result);
+  } else if (type == type_f32) {
+    emit(op_round_f32, result, result);
+  }
+}
+
+void BytecodeCompiler::visitNumberLiteralNode(const NumberLiteralNode *node) {
+  last_ = allocateTemporary();
+  emit(op_const, last_,
+       constant(literalValue(node->getLiteral(), node->getType())));
+}
+
+void BytecodeCompiler::visitIdentifierExprNode(
+    const IdentifierExprNode *node) {
+  last_ = variable(node->getName());
+}
+
+void BytecodeCompiler::emitUnary(Opcode op, uint16_t value) {
+  last_ = allocateTemporary();
+  emit(op, last_, value);
+}
+
+void BytecodeCompiler::visitFunctionCallExprNode(
+    const FunctionCallExprNode *node) {
+  if (node->isConversion()) {
+    // conversions between types are single instructions, if any
+    auto *arg = node->getArgs()[0];
+    ValueType from = arg->getType();
+    ValueType to = node->getType();
+    std::optional<Opcode> op;
+    if (isIntegerType(to) && !isIntegerType(from)) {
+      op = to == type_i64 ? op_to_i64 : op_to_i32;
+    } else if (to == type_i32 && from == type_i64) {
+      op = op_wrap_i32;
+    } else if (to == type_f32 && from != type_f32) {
+      op = op_round_f32;
+    }
+    uint32_t mark = next_register_;
+    arg->accept(this);
+    // without an instruction the value stays in the argument's register,
+    // which is only free to reuse once it's been converted into a new one
+    if (op) {
+      next_register_ = mark;
+      emitUnary(*op, last_);
+    }
+    return;
+  }
+  auto callee = function_ids_.find(node->getName());
+  if (callee == function_ids_.end()) {
+    std::cout << "No function named " << node->getName() << std::endl;
+    exit(1);
+  }
+  if (program_.functions[callee->second].arity != node->getArgs().size()) {
+    std::cout << node->getName() << " takes "
+              << program_.functions[callee->second].arity
+              << " arguments, got " << node->getArgs().size() << std::endl;
+    exit(1);
+  }
+  // the arguments go into consecutive registers at the top of the frame,
+  // which become the first registers of the callee's frame
+  uint32_t first_arg = next_register_;
+  for (auto *arg : node->getArgs()) {
+    uint16_t reg = allocateTemporary();
+    arg->accept(this);
+    if (last_ != reg) {
+      emit(op_move, reg, last_);
+    }
+    next_register_ = reg + 1;
+  }
+  next_register_ = first_arg;
+  last_ = allocateTemporary();
+  emit(node->getCallKind() == call_extern ? op_call_native : op_call, last_,
+       callee->second, first_arg);
+}
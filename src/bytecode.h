@@ -0,0 +1,134 @@
+#pragma once
+
+#include "parser.h"
+#include "visitor.h"
+
+#include <cstdint>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+enum Opcode : uint8_t {
+  op_const,  // a = constants[b]
+  op_move,   // a = b
+  op_add,    // a = b + c
+  op_sub,
+  op_mul,
+  op_div,
+  op_mod,
+  op_iadd, // integer arithmetic on values held in doubles, see numeric.h
+  op_isub,
+  op_imul,
+  op_idiv,
+  op_imod,
+  op_imul_i32,  // a = b * c wrapped to 32 bits, the product may not be exact
+  op_wrap_i32,  // a = b wrapped to 32 bits
+  op_round_f32, // a = b rounded to float
+  op_to_i64,    // a = b converted from a float, saturating
+  op_to_i32,
+  op_lt, // a = b < c ? 1 : 0
+  op_lte,
+  op_gt,
+  op_gte,
+  op_jump,          // goto c
+  op_jump_if_false, // if a == 0 goto c
+  op_jump_unless_lt, // if !(a < b) goto c, for conditions that are comparisons
+  op_jump_unless_lte,
+  op_jump_unless_gt,
+  op_jump_unless_gte,
+  op_call,   // a = functions[b](c, c + 1, ...), args are in registers c...
+  op_call_native, // a = functions[b].native(c, c + 1, ...)
+  op_return, // return a
+};
+
+// a, b and c are register numbers within the frame, constant and function
+// indices or jump targets depending on the opcode
+struct Instruction {
+  Opcode op;
+  uint16_t a;
+  uint16_t b;
+  uint16_t c;
+};
+static_assert(sizeof(Instruction) == 8, "instructions should stay packed");
+
+// Arguments come first in the register file, then the function's variables
+// and the bounds of its loops, then temporaries. Every name is resolved to a
+// register at compile time.
+struct BytecodeFunction {
+  std::string_view name;
+  uint16_t arity = 0;
+  // only filled in for functions with a typed signature
+  std::vector<ValueType> arg_types;
+  // takes slices, which only compiled code can pass, and has no code. only
+  // functions that take slices themselves can call it.
+  bool native_only = false;
+  // extern functions have no code either. native is the C function when it
+  // can be called with doubles, see native.h
+  bool is_extern = false;
+  void *native = nullptr;
+  uint16_t frame_size = 0;
+  std::vector<Instruction> code;
+  std::vector<double> constants;
+};
+
+struct BytecodeProgram {
+  std::vector<BytecodeFunction> functions;
+
+  // index into functions, or -1
+  int32_t find(std::string_view name) const;
+};
+
+// Lowers the AST to register bytecode for the VM. Like the codegen visitor,
+// the register holding the value of the expression that was just visited is
+// left in last_.
+class BytecodeCompiler : public Visitor {
+public:
+  static BytecodeProgram compile(const Program &program);
+
+  void visitBinaryExprNode(const BinaryExprNode *node) override;
+  void visitNumberLiteralNode(const NumberLiteralNode *node) override;
+  void visitIdentifierExprNode(const IdentifierExprNode *node) override;
+  void visitFunctionCallExprNode(const FunctionCallExprNode *node) override;
+  void visitIndexExprNode(const IndexExprNode *node) override;
+  void visitBodyNode(const BodyNode *node) override;
+  void visitConditionalNode(const ConditionalNode *node) override;
+  void visitWhileNode(const WhileNode *node) override;
+  void visitForNode(const ForNode *node) override;
+  void visitDefinitionNode(const DefinitionNode *node) override;
+  void visitStoreNode(const StoreNode *node) override;
+  void visitReturnNode(const ReturnNode *node) override;
+  void
+  visitFunctionDeclarationNode(const FunctionDeclarationNode *node) override;
+  void visitFunctionNode(const FunctionNode *node) override;
+  void visitProgramNode(const Program *node) override;
+
+private:
+  uint16_t emit(Opcode op, uint16_t a = 0, uint16_t b = 0, uint16_t c = 0);
+  uint16_t allocateTemporary();
+  uint16_t constant(double value);
+  uint16_t variable(std::string_view name);
+  // result = lhs op rhs for operands of the type
+  void emitBinary(TokenType op, ValueType type, uint16_t result, uint16_t lhs,
+                  uint16_t rhs);
+  // computes the value into a new register below the temporaries, which
+  // holds it until the function returns
+  uint16_t storeLocal(ExprNode *value);
+  // assigns the variable, or declares it if it doesn't exist yet, and returns
+  // its register
+  uint16_t assign(std::string_view name, ExprNode *value);
+  // puts value, which is in the type, through op into a temporary
+  void emitUnary(Opcode op, uint16_t value);
+  // emits a jump that is taken when the condition is false, and returns it so
+  // its target can be patched
+  uint16_t emitConditionalJump(ExprNode *condition);
+
+  BytecodeProgram program_;
+  std::unordered_map<std::string_view, uint32_t> function_ids_;
+  BytecodeFunction *function_ = nullptr;
+  std::unordered_map<std::string_view, uint16_t> variables_;
+  // registers holding arguments, variables and loop bounds, temporaries are
+  // allocated like a stack above them
+  uint32_t locals_ = 0;
+  uint32_t next_register_ = 0;
+  uint16_t last_ = 0;
+};
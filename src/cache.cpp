@@ -0,0 +1,234 @@
+#include "cache.h"
+#include "target.h"
+#include "llvm/Config/llvm-config.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/Support/xxhash.h"
+#include <cstring>
+#include <iostream>
+
+namespace {
+
+constexpr llvm::StringLiteral kKeyPrefix = "slice-";
+
+void appendU64(std::string &out, uint64_t value) {
+  char bytes[sizeof(value)];
+  std::memcpy(bytes, &value, sizeof(value));
+  out.append(bytes, sizeof(value));
+}
+
+// names are length prefixed so different splits of the same characters
+// serialize differently
+void appendName(std::string &out, std::string_view name) {
+  appendU64(out, name.size());
+  out.append(name.data(), name.size());
+}
+
+void serializeExpr(std::string &out, const ExprNode *expr) {
+  out.push_back(static_cast<char>(expr->getExprNodeType()));
+  // inferred types depend on the signatures of callees, which may live in
+  // other functions, so they're hashed rather than rederived
+  out.push_back(static_cast<char>(expr->getType()));
+  switch (expr->getExprNodeType()) {
+  case ExprNode::BinaryExprNode: {
+    const auto *binary = static_cast<const BinaryExprNode *>(expr);
+    out.push_back(static_cast<char>(binary->getOperator()));
+    serializeExpr(out, binary->getLHS());
+    serializeExpr(out, binary->getRHS());
+    break;
+  }
+  case ExprNode::NumberLiteralNode: {
+    const auto &literal =
+        static_cast<const NumberLiteralNode *>(expr)->getLiteral();
+    uint64_t bits;
+    std::memcpy(&bits, &literal.value, sizeof(bits));
+    out.push_back(static_cast<char>(literal.kind));
+    appendU64(out, bits);
+    appendU64(out, literal.integer);
+    break;
+  }
+  case ExprNode::IdentifierExprNode:
+    appendName(out, static_cast<const IdentifierExprNode *>(expr)->getName());
+    break;
+  case ExprNode::FunctionCallExprNode: {
+    const auto *call = static_cast<const FunctionCallExprNode *>(expr);
+    appendName(out, call->getName());
+    out.push_back(static_cast<char>(call->getCallKind()));
+    appendU64(out, call->getArgs().size());
+    for (const auto *arg : call->getArgs()) {
+      serializeExpr(out, arg);
+    }
+    break;
+  }
+  case ExprNode::IndexExprNode: {
+    const auto *index = static_cast<const IndexExprNode *>(expr);
+    appendName(out, index->getSlice());
+    serializeExpr(out, index->getIndex());
+    break;
+  }
+  }
+}
+
+void serializeBody(std::string &out, const BodyNode *body) {
+  appendU64(out, body->getBlocks().size());
+  for (const auto *block : body->getBlocks()) {
+    out.push_back(static_cast<char>(block->getBodyNodeType()));
+    switch (block->getBodyNodeType()) {
+    case BodySubNode::ConditionalNode: {
+      const auto *conditional = static_cast<const ConditionalNode *>(block);
+      serializeExpr(out, conditional->getIfExpr());
+      out.push_back(static_cast<char>(conditional->getHint()));
+      serializeBody(out, conditional->getIfBody());
+      out.push_back(conditional->getElseBody() != nullptr);
+      if (conditional->getElseBody()) {
+        serializeBody(out, conditional->getElseBody());
+      }
+      break;
+    }
+    case BodySubNode::WhileNode: {
+      const auto *loop = static_cast<const WhileNode *>(block);
+      serializeExpr(out, loop->getCondition());
+      appendU64(out, loop->getHints().pack());
+      serializeBody(out, loop->getBody());
+      break;
+    }
+    case BodySubNode::ForNode: {
+      const auto *loop = static_cast<const ForNode *>(block);
+      appendName(out, loop->getVariable());
+      serializeExpr(out, loop->getStart());
+      serializeExpr(out, loop->getEnd());
+      serializeExpr(out, loop->getStep());
+      appendU64(out, loop->getHints().pack());
+      serializeBody(out, loop->getBody());
+      break;
+    }
+    case BodySubNode::StoreNode: {
+      const auto *store = static_cast<const StoreNode *>(block);
+      appendName(out, store->getSlice());
+      serializeExpr(out, store->getIndex());
+      serializeExpr(out, store->getValue());
+      break;
+    }
+    case BodySubNode::ReturnStatementNode:
+      serializeExpr(out, static_cast<const ReturnNode *>(block)->getExpr());
+      break;
+    case BodySubNode::DefinitionNode: {
+      const auto *definition = static_cast<const DefinitionNode *>(block);
+      appendName(out, definition->getLValue());
+      serializeExpr(out, definition->getRHS());
+      break;
+    }
+    }
+  }
+}
+
+} // namespace
+
+CompileCache::CompileCache(const std::string &directory,
+                           const std::string &options)
+    : directory_(directory) {
+  if (auto ec = llvm::sys::fs::create_directories(directory)) {
+    std::cout << "Could not create cache directory " << directory << ": "
+              << ec.message() << std::endl;
+    exit(1);
+  }
+  auto target_machine = createHostTargetMachine();
+  std::string config = "O3;" + options + ";" +
+                       target_machine->getTargetTriple().str() + ";" +
+                       target_machine->getTargetCPU().str() + ";" +
+                       target_machine->getTargetFeatureString().str() +
+                       ";LLVM " LLVM_VERSION_STRING ";" +
+                       std::to_string(kCacheVersion);
+  config_hash_ = llvm::xxHash64(config);
+}
+
+uint64_t CompileCache::hashFunction(const FunctionNode *function) {
+  std::string out;
+  const auto *declaration = function->getFunctionDeclaration();
+  appendName(out, declaration->getName());
+  appendU64(out, declaration->getArgs().size());
+  for (size_t i = 0; i < declaration->getArgs().size(); i++) {
+    appendName(out, declaration->getArgs()[i]);
+    out.push_back(static_cast<char>(declaration->getArgType(i)));
+  }
+  out.push_back(static_cast<char>(declaration->getReturnType()));
+  out.push_back(function->isExtern());
+  out.push_back(static_cast<char>(function->getFloatMode()));
+  if (!function->isExtern()) {
+    serializeBody(out, function->getBody());
+  }
+  return llvm::xxHash64(out);
+}
+
+std::string
+CompileCache::key(llvm::ArrayRef<uint64_t> function_hashes) const {
+  std::string out;
+  appendU64(out, config_hash_);
+  for (uint64_t hash : function_hashes) {
+    appendU64(out, hash);
+  }
+  std::string key = kKeyPrefix.str();
+  llvm::raw_string_ostream key_out(key);
+  key_out << llvm::format_hex_no_prefix(llvm::xxHash64(out), 16);
+  return key_out.str();
+}
+
+bool CompileCache::isKey(llvm::StringRef identifier) {
+  return identifier.size() == kKeyPrefix.size() + 16 &&
+         identifier.take_front(kKeyPrefix.size()) == kKeyPrefix;
+}
+
+std::string CompileCache::path(const std::string &key,
+                               llvm::StringRef extension) const {
+  llvm::SmallString<128> path(directory_);
+  llvm::sys::path::append(path, key + "." + extension);
+  return path.str().str();
+}
+
+std::unique_ptr<llvm::MemoryBuffer>
+CompileCache::lookup(const std::string &key, llvm::StringRef extension) const {
+  auto buffer = llvm::MemoryBuffer::getFile(path(key, extension));
+  if (!buffer) {
+    return nullptr;
+  }
+  return std::move(*buffer);
+}
+
+void CompileCache::store(const std::string &key, llvm::StringRef extension,
+                         llvm::StringRef contents) const {
+  // written to a temporary file and renamed into place, so concurrent
+  // compiles never see a partial entry
+  llvm::SmallString<128> model(directory_);
+  llvm::sys::path::append(model, key + "-%%%%%%.tmp");
+  int fd;
+  llvm::SmallString<128> temporary;
+  if (llvm::sys::fs::createUniqueFile(model, fd, temporary)) {
+    // the cache is best effort, compiling still succeeded
+    return;
+  }
+  {
+    llvm::raw_fd_ostream out(fd, /*shouldClose=*/true);
+    out << contents;
+  }
+  if (llvm::sys::fs::rename(temporary, path(key, extension))) {
+    llvm::sys::fs::remove(temporary);
+  }
+}
+
+void CompileCache::notifyObjectCompiled(const llvm::Module *module,
+                                        llvm::MemoryBufferRef object) {
+  if (isKey(module->getModuleIdentifier())) {
+    store(module->getModuleIdentifier(), "o", object.getBuffer());
+  }
+}
+
+std::unique_ptr<llvm::MemoryBuffer>
+CompileCache::getObject(const llvm::Module *module) {
+  if (!isKey(module->getModuleIdentifier())) {
+    return nullptr;
+  }
+  return lookup(module->getModuleIdentifier(), "o");
+}
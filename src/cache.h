@@ -0,0 +1,49 @@
+#pragma once
+
+#include "parser.h"
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ExecutionEngine/ObjectCache.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include <cstdint>
+#include <memory>
+#include <string>
+
+// On-disk cache of compiled code, one file per key in the cache directory.
+// Keys are content hashes: of the functions that went into an object, plus
+// the optimization level, codegen options, target CPU and features, LLVM
+// version and kCacheVersion. Bump kCacheVersion whenever the code generated
+// for the same AST changes, otherwise stale objects would be reused.
+//
+// It's also an llvm::ObjectCache, which stores and finds objects for modules
+// whose identifier is a key, so the JIT's compile layer can fill it.
+class CompileCache : public llvm::ObjectCache {
+public:
+  static constexpr uint32_t kCacheVersion = 10;
+
+  // options is CodegenOptions::describe() of the code that goes in
+  explicit CompileCache(const std::string &directory,
+                        const std::string &options = "");
+
+  // hash of everything in the function that affects the code generated for it
+  static uint64_t hashFunction(const FunctionNode *function);
+  std::string key(llvm::ArrayRef<uint64_t> function_hashes) const;
+
+  // entries are stored per key and extension, e.g. the object and the
+  // header prototypes for the same functions
+  std::unique_ptr<llvm::MemoryBuffer> lookup(const std::string &key,
+                                             llvm::StringRef extension) const;
+  void store(const std::string &key, llvm::StringRef extension,
+             llvm::StringRef contents) const;
+
+  void notifyObjectCompiled(const llvm::Module *module,
+                            llvm::MemoryBufferRef object) override;
+  std::unique_ptr<llvm::MemoryBuffer>
+  getObject(const llvm::Module *module) override;
+
+private:
+  static bool isKey(llvm::StringRef identifier);
+  std::string path(const std::string &key, llvm::StringRef extension) const;
+
+  std::string directory_;
+  uint64_t config_hash_;
+};
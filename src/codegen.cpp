@@ -1,11 +1,476 @@
 #include "codegen.h"
 #include "parser.h"
+#include "llvm/ADT/StringSwitch.h"
+#include "llvm/Bitcode/BitcodeReader.h"
+#include "llvm/Bitcode/BitcodeWriter.h"
+#include "llvm/Config/llvm-config.h"
 #include "llvm/IR/DerivedTypes.h"
+#include "llvm/IR/CFG.h"
+#include "llvm/IR/Intrinsics.h"
+#include "llvm/IR/LegacyPassManager.h"
+#include "llvm/IR/MDBuilder.h"
 #include "llvm/IR/ValueSymbolTable.h"
 #include "llvm/IR/Verifier.h"
+#include "llvm/Linker/Linker.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Program.h"
+#include "llvm/Support/SmallVectorMemoryBuffer.h"
+#include <algorithm>
+#include <cstdlib>
 #include <iostream>
 #include <map>
 
+namespace {
+
+std::unique_ptr<llvm::raw_fd_ostream> openOutput(const std::string &path) {
+  std::error_code ec;
+  auto out =
+      std::make_unique<llvm::raw_fd_ostream>(path, ec, llvm::sys::fs::OF_None);
+  if (ec) {
+    std::cout << "Could not open " << path << ": " << ec.message()
+              << std::endl;
+    exit(1);
+  }
+  return out;
+}
+
+// Conditionals whose bodies only assign a handful of cheap values are
+// lowered to selects: both bodies are computed and the condition picks the
+// results, so there's no branch to mispredict. Calls are never speculated,
+// they can be arbitrarily expensive or not terminate.
+constexpr size_t kMaxSpeculatedOps = 8;
+
+bool countSpeculatedOps(const ExprNode *expr, size_t &ops) {
+  switch (expr->getExprNodeType()) {
+  case ExprNode::BinaryExprNode: {
+    const auto *binary = static_cast<const BinaryExprNode *>(expr);
+    // integer division stops the program on a zero divisor, so it only runs
+    // if the program asks for it
+    TokenType op = binary->getOperator();
+    if (isIntegerType(binary->getType()) && (op == tok_div || op == tok_mod)) {
+      return false;
+    }
+    ops++;
+    return countSpeculatedOps(binary->getLHS(), ops) &&
+           countSpeculatedOps(binary->getRHS(), ops);
+  }
+  case ExprNode::NumberLiteralNode:
+  case ExprNode::IdentifierExprNode:
+    return true;
+  case ExprNode::FunctionCallExprNode:
+    return false;
+  case ExprNode::IndexExprNode:
+    // an out of bounds index would trap even if its side isn't taken
+    return false;
+  }
+  return false;
+}
+
+bool countSpeculatedOps(const BodyNode *body, size_t &ops) {
+  for (const auto *block : body->getBlocks()) {
+    if (block->getBodyNodeType() != BodySubNode::DefinitionNode) {
+      return false;
+    }
+    // every assignment costs a select
+    ops++;
+    if (!countSpeculatedOps(
+            static_cast<const DefinitionNode *>(block)->getRHS(), ops)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool isSelectable(const ConditionalNode *node) {
+  // an annotated branch is predictable, so it isn't worth computing both
+  // sides
+  if (node->getHint() != branch_unknown) {
+    return false;
+  }
+  size_t ops = 0;
+  return countSpeculatedOps(node->getIfBody(), ops) &&
+         (!node->getElseBody() ||
+          countSpeculatedOps(node->getElseBody(), ops)) &&
+         ops <= kMaxSpeculatedOps;
+}
+
+bool isComparison(TokenType op) {
+  return op == tok_lt || op == tok_gt || op == tok_lte || op == tok_gte;
+}
+
+const char *cTypeName(ValueType type) {
+  switch (type) {
+  case type_f32:
+    return "float";
+  case type_i64:
+    return "int64_t";
+  case type_i32:
+    return "int32_t";
+  default:
+    return "double";
+  }
+}
+
+// calls f on every statement of the body, nested ones included
+template <typename F> void forEachStatement(const BodyNode *body, F &&f) {
+  for (const auto *block : body->getBlocks()) {
+    f(block);
+    switch (block->getBodyNodeType()) {
+    case BodySubNode::ConditionalNode: {
+      const auto *conditional = static_cast<const ConditionalNode *>(block);
+      forEachStatement(conditional->getIfBody(), f);
+      if (conditional->getElseBody()) {
+        forEachStatement(conditional->getElseBody(), f);
+      }
+      break;
+    }
+    case BodySubNode::WhileNode:
+      forEachStatement(static_cast<const WhileNode *>(block)->getBody(), f);
+      break;
+    case BodySubNode::ForNode:
+      forEachStatement(static_cast<const ForNode *>(block)->getBody(), f);
+      break;
+    default:
+      break;
+    }
+  }
+}
+
+// calls f on every index expression within the expression
+template <typename F> void forEachIndex(const ExprNode *expr, F &&f) {
+  switch (expr->getExprNodeType()) {
+  case ExprNode::BinaryExprNode: {
+    const auto *binary = static_cast<const BinaryExprNode *>(expr);
+    forEachIndex(binary->getLHS(), f);
+    forEachIndex(binary->getRHS(), f);
+    break;
+  }
+  case ExprNode::FunctionCallExprNode:
+    for (const auto *arg :
+         static_cast<const FunctionCallExprNode *>(expr)->getArgs()) {
+      forEachIndex(arg, f);
+    }
+    break;
+  case ExprNode::IndexExprNode: {
+    const auto *index = static_cast<const IndexExprNode *>(expr);
+    f(index->getSlice(), index->getIndex());
+    forEachIndex(index->getIndex(), f);
+    break;
+  }
+  default:
+    break;
+  }
+}
+
+// calls f with the slice and index of every access in the statement itself,
+// stores included, but not in its nested bodies
+template <typename F> void forEachAccess(const BodySubNode *block, F &&f) {
+  switch (block->getBodyNodeType()) {
+  case BodySubNode::ConditionalNode:
+    forEachIndex(static_cast<const ConditionalNode *>(block)->getIfExpr(), f);
+    break;
+  case BodySubNode::WhileNode:
+    forEachIndex(static_cast<const WhileNode *>(block)->getCondition(), f);
+    break;
+  case BodySubNode::ForNode: {
+    const auto *loop = static_cast<const ForNode *>(block);
+    forEachIndex(loop->getStart(), f);
+    forEachIndex(loop->getEnd(), f);
+    forEachIndex(loop->getStep(), f);
+    break;
+  }
+  case BodySubNode::ReturnStatementNode:
+    forEachIndex(static_cast<const ReturnNode *>(block)->getExpr(), f);
+    break;
+  case BodySubNode::DefinitionNode:
+    forEachIndex(static_cast<const DefinitionNode *>(block)->getRHS(), f);
+    break;
+  case BodySubNode::StoreNode: {
+    const auto *store = static_cast<const StoreNode *>(block);
+    f(store->getSlice(), store->getIndex());
+    forEachIndex(store->getIndex(), f);
+    forEachIndex(store->getValue(), f);
+    break;
+  }
+  }
+}
+
+bool isIdentifier(const ExprNode *expr, std::string_view name) {
+  return expr->getExprNodeType() == ExprNode::IdentifierExprNode &&
+         static_cast<const IdentifierExprNode *>(expr)->getName() == name;
+}
+
+// whether expr is len(slice)
+bool isLengthOf(const ExprNode *expr, std::string_view slice) {
+  if (expr->getExprNodeType() != ExprNode::FunctionCallExprNode) {
+    return false;
+  }
+  const auto *call = static_cast<const FunctionCallExprNode *>(expr);
+  return call->getCallKind() == call_length &&
+         isIdentifier(call->getArgs()[0], slice);
+}
+
+// name, with underscores appended if it's taken by an argument of the
+// function
+std::string unusedName(const FunctionDeclarationNode *node,
+                       std::string name) {
+  const auto &args = node->getArgs();
+  while (std::find(args.begin(), args.end(), name) != args.end()) {
+    name += "_";
+  }
+  return name;
+}
+
+// the value of an integer literal, if the expression is one
+std::optional<int64_t> integerLiteral(const ExprNode *expr) {
+  if (expr->getExprNodeType() != ExprNode::NumberLiteralNode ||
+      !isIntegerType(expr->getType())) {
+    return std::nullopt;
+  }
+  return static_cast<const NumberLiteralNode *>(expr)->getLiteral().integer;
+}
+
+// The C math functions that have an LLVM intrinsic with the same semantics,
+// apart from errno, which the intrinsics never set. The float versions are
+// named with an f suffix, e.g. sqrtf.
+struct MathIntrinsic {
+  const char *name;
+  llvm::Intrinsic::ID id;
+  size_t arity;
+};
+constexpr MathIntrinsic kMathIntrinsics[] = {
+    {"sqrt", llvm::Intrinsic::sqrt, 1},
+    {"fabs", llvm::Intrinsic::fabs, 1},
+    {"exp", llvm::Intrinsic::exp, 1},
+    {"exp2", llvm::Intrinsic::exp2, 1},
+    {"log", llvm::Intrinsic::log, 1},
+    {"log2", llvm::Intrinsic::log2, 1},
+    {"log10", llvm::Intrinsic::log10, 1},
+    {"sin", llvm::Intrinsic::sin, 1},
+    {"cos", llvm::Intrinsic::cos, 1},
+    {"pow", llvm::Intrinsic::pow, 2},
+    {"fma", llvm::Intrinsic::fma, 3},
+    {"floor", llvm::Intrinsic::floor, 1},
+    {"ceil", llvm::Intrinsic::ceil, 1},
+    {"trunc", llvm::Intrinsic::trunc, 1},
+    {"round", llvm::Intrinsic::round, 1},
+    {"rint", llvm::Intrinsic::rint, 1},
+    {"nearbyint", llvm::Intrinsic::nearbyint, 1},
+    {"copysign", llvm::Intrinsic::copysign, 2},
+    {"fmin", llvm::Intrinsic::minnum, 2},
+    {"fmax", llvm::Intrinsic::maxnum, 2},
+};
+
+// the intrinsic for a call to the C function with these types, if there is
+// one
+std::optional<llvm::Intrinsic::ID>
+mathIntrinsic(llvm::StringRef name, llvm::ArrayRef<llvm::Type *> arg_types,
+              llvm::Type *return_type) {
+  if (return_type->isFloatTy()) {
+    if (!name.consume_back("f")) {
+      return std::nullopt;
+    }
+  } else if (!return_type->isDoubleTy()) {
+    return std::nullopt;
+  }
+  for (const auto &intrinsic : kMathIntrinsics) {
+    if (name != intrinsic.name || arg_types.size() != intrinsic.arity) {
+      continue;
+    }
+    for (auto *type : arg_types) {
+      if (type != return_type) {
+        return std::nullopt;
+      }
+    }
+    return intrinsic.id;
+  }
+  return std::nullopt;
+}
+
+} // namespace
+
+std::optional<llvm::TargetLibraryInfoImpl::VectorLibrary>
+vectorLibraryFromName(llvm::StringRef name) {
+  return llvm::StringSwitch<
+             std::optional<llvm::TargetLibraryInfoImpl::VectorLibrary>>(name)
+      .Case("none", llvm::TargetLibraryInfoImpl::NoLibrary)
+      .Case("libmvec", llvm::TargetLibraryInfoImpl::LIBMVEC_X86)
+      .Case("svml", llvm::TargetLibraryInfoImpl::SVML)
+      .Case("massv", llvm::TargetLibraryInfoImpl::MASSV)
+      .Case("accelerate", llvm::TargetLibraryInfoImpl::Accelerate)
+      .Default(std::nullopt);
+}
+
+std::string boxedName(llvm::StringRef name) {
+  return (name + kBoxedSuffix).str();
+}
+
+std::string batchName(llvm::StringRef name) {
+  return (name + kBatchSuffix).str();
+}
+
+std::string CodegenOptions::describe() const {
+  std::string description = batch_entries ? "batch" : "";
+  if (vector_library != llvm::TargetLibraryInfoImpl::NoLibrary) {
+    description += ";veclib" + std::to_string(vector_library);
+  }
+  if (float_mode != float_strict) {
+    description += ";float" + std::to_string(float_mode);
+  }
+  return description;
+}
+
+std::string createTemporaryObject() {
+  llvm::SmallString<128> object_path;
+  if (llvm::sys::fs::createTemporaryFile("slice", "o", object_path)) {
+    std::cout << "Could not create temporary object file" << std::endl;
+    exit(1);
+  }
+  return object_path.str().str();
+}
+
+void linkObjects(const std::string &mode, const std::string &output,
+                 const std::vector<std::string> &objects) {
+  // there's no in-process linker, so this runs the system one. it's started
+  // directly rather than through a shell, so paths are passed on as is.
+  auto cc = llvm::sys::findProgramByName("cc");
+  if (!cc) {
+    std::cout << "Linking " << output << " needs cc, which wasn't found"
+              << std::endl;
+    exit(1);
+  }
+  std::vector<llvm::StringRef> args = {*cc, mode, "-o", output};
+  args.insert(args.end(), objects.begin(), objects.end());
+  std::string error;
+  if (llvm::sys::ExecuteAndWait(*cc, args, {}, {}, 0, 0, &error) != 0) {
+    std::cout << "Linking " << output << " failed"
+              << (error.empty() ? "" : ": " + error) << std::endl;
+    exit(1);
+  }
+}
+
+void CodegenVisitor::emitObject(const std::string &path) {
+  auto out = openOutput(path);
+  emitObject(*out);
+  out->flush();
+}
+
+std::unique_ptr<llvm::MemoryBuffer> CodegenVisitor::emitObjectToMemory() {
+  llvm::SmallVector<char, 0> object;
+  llvm::raw_svector_ostream out(object);
+  emitObject(out);
+  return std::make_unique<llvm::SmallVectorMemoryBuffer>(
+      std::move(object), module_->getModuleIdentifier());
+}
+
+void CodegenVisitor::emitObject(llvm::raw_pwrite_stream &out) {
+#if LLVM_VERSION_MAJOR >= 18
+  auto file_type = llvm::CodeGenFileType::ObjectFile;
+#else
+  auto file_type = llvm::CGFT_ObjectFile;
+#endif
+  llvm::legacy::PassManager pass_manager;
+  if (target_machine_->addPassesToEmitFile(pass_manager, out, nullptr,
+                                           file_type)) {
+    std::cout << "Target can't emit object files" << std::endl;
+    exit(1);
+  }
+  pass_manager.run(*module_);
+}
+
+void CodegenVisitor::emitSharedLibrary(const std::string &path) {
+  std::string object_path = createTemporaryObject();
+  emitObject(object_path);
+  linkObjects("-shared", path, {object_path});
+  llvm::sys::fs::remove(object_path);
+}
+
+void CodegenVisitor::emitBitcode(const std::string &path) {
+  auto out = openOutput(path);
+  llvm::WriteBitcodeToFile(*module_, *out);
+}
+
+void CodegenVisitor::linkIn(CodegenVisitor &other) {
+  llvm::SmallString<0> bitcode;
+  llvm::raw_svector_ostream bitcode_out(bitcode);
+  llvm::WriteBitcodeToFile(*other.module_, bitcode_out);
+  auto module = llvm::parseBitcodeFile(
+      llvm::MemoryBufferRef(bitcode.str(), other.module_->getName()),
+      *context_);
+  if (!module) {
+    std::cout << "Could not read back module: "
+              << llvm::toString(module.takeError()) << std::endl;
+    exit(1);
+  }
+  if (llvm::Linker::linkModules(*module_, std::move(*module))) {
+    std::cout << "Could not link modules" << std::endl;
+    exit(1);
+  }
+  prototypes_ += other.prototypes_;
+}
+
+void CodegenVisitor::writeHeader(llvm::raw_ostream &out) {
+  std::string prototypes;
+  llvm::raw_string_ostream prototypes_out(prototypes);
+  writePrototypes(prototypes_out);
+  writeHeader(out, prototypes_out.str());
+}
+
+void CodegenVisitor::writePrototypes(llvm::raw_ostream &out) {
+  out << prototypes_;
+}
+
+void CodegenVisitor::addPrototype(const llvm::Function *function,
+                                  const FunctionDeclarationNode *node) {
+  llvm::raw_string_ostream out(prototypes_);
+  out << cTypeName(node->getReturnType()) << " " << node->getName() << "(";
+  if (node->getArgs().empty()) {
+    out << "void";
+  }
+  auto arg = function->arg_begin();
+  for (size_t i = 0; i < node->getArgs().size(); i++, arg++) {
+    if (i > 0) {
+      out << ", ";
+    }
+    auto name = node->getArgs()[i];
+    ValueType type = node->getArgType(i);
+    if (!isSliceType(type)) {
+      out << cTypeName(type) << " " << name;
+      continue;
+    }
+    if (arg->hasAttribute(llvm::Attribute::ReadOnly)) {
+      out << "const ";
+    }
+    out << cTypeName(elementType(type)) << " *" << name << ", size_t "
+        << name << "_len";
+    arg++;
+  }
+  out << ");\n";
+  if (!options_.batch_entries || node->takesSlices()) {
+    return;
+  }
+  out << "void " << batchName(function->getName()) << "(";
+  for (size_t i = 0; i < node->getArgs().size(); i++) {
+    out << "const " << cTypeName(node->getArgType(i)) << " *"
+        << node->getArgs()[i] << ", ";
+  }
+  out << cTypeName(node->getReturnType()) << " *" << unusedName(node, "out")
+      << ", size_t " << unusedName(node, "count") << ");\n";
+}
+
+void CodegenVisitor::writeHeader(llvm::raw_ostream &out,
+                                 llvm::StringRef prototypes) {
+  out << "#pragma once\n\n"
+      << "#include <stddef.h>\n"
+      << "#include <stdint.h>\n\n"
+      << "#ifdef __cplusplus\n"
+      << "extern \"C\" {\n"
+      << "#endif\n\n"
+      << prototypes << "\n#ifdef __cplusplus\n"
+      << "}\n"
+      << "#endif\n";
+}
+
 void CodegenVisitor::visitProgramNode(const Program *node) {
   for (const auto &function : node->getFunctions()) {
     function->accept(this);
@@ -13,35 +478,268 @@ void CodegenVisitor::visitProgramNode(const Program *node) {
 }
 
 void CodegenVisitor::visitFunctionNode(const FunctionNode *node) {
-  onEnterBlock(node->getFunctionDeclaration()->getName());
-  node->getFunctionDeclaration()->accept(this);
+  auto *declaration = node->getFunctionDeclaration();
+  if (node->isExtern()) {
+    // the C function is linked in from elsewhere, only the entry for calling
+    // it with doubles is generated
+    if (declaration->isTyped() && !declaration->takesSlices()) {
+      emitBoxedEntry(declareFunction(declaration), declaration);
+    }
+    return;
+  }
+  ssa_.clear();
+  slices_.clear();
+  trap_blocks_.clear();
+  symbols_.pushScope();
+  declaration->accept(this);
   auto function = static_cast<llvm::Function *>(ret_);
+  // slices the body never stores to are read only, and const in the header
+  auto arg = function->arg_begin();
+  for (size_t i = 0; i < declaration->getArgs().size(); i++, arg++) {
+    if (!isSliceType(declaration->getArgType(i))) {
+      continue;
+    }
+    bool stored = false;
+    forEachStatement(node->getBody(), [&](const BodySubNode *block) {
+      stored |= block->getBodyNodeType() == BodySubNode::StoreNode &&
+                static_cast<const StoreNode *>(block)->getSlice() ==
+                    declaration->getArgs()[i];
+    });
+    if (!stored) {
+      arg->addAttr(llvm::Attribute::ReadOnly);
+    }
+    arg++;
+  }
+  addPrototype(function, declaration);
+  setFloatMode(function, node->getFloatMode() == float_default
+                             ? options_.float_mode
+                             : node->getFloatMode());
   node->getBody()->accept(this);
+  // falling off the end of a function returns 0
+  if (!builder_->GetInsertBlock()->getTerminator()) {
+    builder_->CreateRet(
+        llvm::Constant::getNullValue(function->getReturnType()));
+  }
+  for (auto *trap_block : trap_blocks_) {
+    trap_block->insertInto(function);
+  }
   llvm::verifyFunction(*function);
-  onExitBlock();
+  symbols_.popScope();
+  builder_->clearFastMathFlags();
+  // slices can't be boxed in a double
+  if (declaration->isTyped() && !declaration->takesSlices()) {
+    emitBoxedEntry(function, declaration);
+  }
+  if (options_.batch_entries && !declaration->takesSlices()) {
+    emitBatchEntry(function, declaration);
+  }
 }
 
-void CodegenVisitor::visitFunctionDeclarationNode(
-    const FunctionDeclarationNode *node) {
+void CodegenVisitor::setFloatMode(llvm::Function *function, FloatMode mode) {
+  llvm::FastMathFlags flags;
+  if (mode == float_contract) {
+    flags.setAllowContract();
+  } else if (mode == float_fast) {
+    flags.setFast();
+    // the backend reads these rather than the flags of each instruction
+    for (const char *attribute :
+         {"unsafe-fp-math", "no-nans-fp-math", "no-infs-fp-math",
+          "no-signed-zeros-fp-math", "approx-func-fp-math"}) {
+      function->addFnAttr(attribute, "true");
+    }
+  }
+  builder_->setFastMathFlags(flags);
+}
 
-  std::vector<llvm::Type *> doubles(node->getArgs().size(),
-                                    llvm::Type::getDoubleTy(*context_));
-  llvm::FunctionType *function_type = llvm::FunctionType::get(
-      llvm::Type::getDoubleTy(*context_), doubles, false);
-  llvm::Function *function =
-      llvm::Function::Create(function_type, llvm::Function::ExternalLinkage,
-                             node->getName(), module_.get());
-  size_t i = 0;
+void CodegenVisitor::emitBoxedEntry(llvm::Function *function,
+                                    const FunctionDeclarationNode *node) {
+  auto *double_type = llvm::Type::getDoubleTy(*context_);
+  std::vector<llvm::Type *> doubles(function->arg_size(), double_type);
+  auto *boxed = llvm::Function::Create(
+      llvm::FunctionType::get(double_type, doubles, false),
+      llvm::Function::ExternalLinkage, boxedName(function->getName()),
+      module_.get());
+  builder_->SetInsertPoint(llvm::BasicBlock::Create(*context_, "entry", boxed));
+  std::vector<llvm::Value *> args;
+  for (auto &arg : boxed->args()) {
+    args.push_back(
+        emitConversion(&arg, type_f64, node->getArgType(arg.getArgNo())));
+  }
+  llvm::Value *result = builder_->CreateCall(function, args);
+  builder_->CreateRet(
+      emitConversion(result, node->getReturnType(), type_f64));
+  llvm::verifyFunction(*boxed);
+}
+
+void CodegenVisitor::emitBatchEntry(llvm::Function *function,
+                                    const FunctionDeclarationNode *node) {
+  auto *i64 = llvm::Type::getInt64Ty(*context_);
+  std::vector<llvm::Type *> arg_types;
   for (auto &arg : function->args()) {
-    arg.setName(node->getArgs()[i++]);
+    arg_types.push_back(llvm::PointerType::getUnqual(arg.getType()));
+  }
+  arg_types.push_back(
+      llvm::PointerType::getUnqual(function->getReturnType()));
+  arg_types.push_back(i64);
+  auto *batch = llvm::Function::Create(
+      llvm::FunctionType::get(llvm::Type::getVoidTy(*context_), arg_types,
+                              false),
+      llvm::Function::ExternalLinkage, batchName(function->getName()),
+      module_.get());
+  const auto &data_layout = module_->getDataLayout();
+  // the output may be one of the inputs, so neither is noalias
+  llvm::Argument *out = batch->getArg(function->arg_size());
+  llvm::Argument *count = batch->getArg(function->arg_size() + 1);
+  for (size_t i = 0; i < function->arg_size(); i++) {
+    llvm::Argument *input = batch->getArg(i);
+    input->setName(node->getArgs()[i]);
+    input->addAttr(llvm::Attribute::ReadOnly);
+  }
+  out->setName(unusedName(node, "out"));
+  out->addAttr(llvm::Attribute::WriteOnly);
+  count->setName(unusedName(node, "count"));
+  for (size_t i = 0; i <= function->arg_size(); i++) {
+    llvm::Type *element = i < function->arg_size()
+                              ? function->getArg(i)->getType()
+                              : function->getReturnType();
+    batch->getArg(i)->addAttr(llvm::Attribute::NoCapture);
+    batch->getArg(i)->addAttr(llvm::Attribute::getWithAlignment(
+        *context_, data_layout.getABITypeAlign(element)));
+  }
+
+  auto entry = llvm::BasicBlock::Create(*context_, "entry", batch);
+  auto loop = llvm::BasicBlock::Create(*context_, "loop", batch);
+  auto exit_block = llvm::BasicBlock::Create(*context_, "afterloop", batch);
+  builder_->SetInsertPoint(entry);
+  builder_->CreateCondBr(
+      builder_->CreateICmpEQ(count, llvm::ConstantInt::get(i64, 0),
+                             "emptytmp"),
+      exit_block, loop);
+  builder_->SetInsertPoint(loop);
+  auto *index = builder_->CreatePHI(i64, 2, "i");
+  index->addIncoming(llvm::ConstantInt::get(i64, 0), entry);
+  std::vector<llvm::Value *> args;
+  for (auto &arg : function->args()) {
+    llvm::Type *type = arg.getType();
+    auto *address = builder_->CreateInBoundsGEP(
+        type, batch->getArg(arg.getArgNo()), index, "addrtmp");
+    args.push_back(builder_->CreateAlignedLoad(
+        type, address, data_layout.getABITypeAlign(type), "elementtmp"));
+  }
+  auto *result = builder_->CreateCall(function, args, "calltmp");
+  // the body has to be in the loop to be vectorized, however large it is
+  result->addFnAttr(llvm::Attribute::AlwaysInline);
+  builder_->CreateAlignedStore(
+      result,
+      builder_->CreateInBoundsGEP(function->getReturnType(), out, index,
+                                  "addrtmp"),
+      data_layout.getABITypeAlign(function->getReturnType()));
+  auto *next = builder_->CreateAdd(index, llvm::ConstantInt::get(i64, 1),
+                                   "nexttmp", true, true);
+  index->addIncoming(next, loop);
+  builder_->CreateCondBr(builder_->CreateICmpULT(next, count, "cmptmp"), loop,
+                         exit_block);
+  builder_->SetInsertPoint(exit_block);
+  builder_->CreateRetVoid();
+  llvm::verifyFunction(*batch);
+}
+
+llvm::Type *CodegenVisitor::llvmType(ValueType type) {
+  if (isSliceType(type)) {
+    return llvm::PointerType::getUnqual(llvmType(elementType(type)));
+  }
+  switch (type) {
+  case type_f32:
+    return llvm::Type::getFloatTy(*context_);
+  case type_i64:
+    return llvm::Type::getInt64Ty(*context_);
+  case type_i32:
+    return llvm::Type::getInt32Ty(*context_);
+  default:
+    return llvm::Type::getDoubleTy(*context_);
   }
+}
+
+llvm::Value *CodegenVisitor::emitConversion(llvm::Value *value,
+                                            ValueType from, ValueType to) {
+  if (from == to) {
+    return value;
+  }
+  llvm::Type *type = llvmType(to);
+  if (isIntegerType(from) && isIntegerType(to)) {
+    return builder_->CreateSExtOrTrunc(value, type, "convtmp");
+  } else if (isIntegerType(from)) {
+    return builder_->CreateSIToFP(value, type, "convtmp");
+  } else if (isIntegerType(to)) {
+    // saturates out of range values and turns NaN into 0 rather than
+    // producing poison
+    return builder_->CreateIntrinsic(llvm::Intrinsic::fptosi_sat,
+                                     {type, value->getType()}, {value},
+                                     nullptr, "convtmp");
+  }
+  return builder_->CreateFPCast(value, type, "convtmp");
+}
+
+llvm::Function *
+CodegenVisitor::declareFunction(const FunctionDeclarationNode *node) {
+  std::vector<llvm::Type *> arg_types;
+  for (size_t i = 0; i < node->getArgs().size(); i++) {
+    arg_types.push_back(llvmType(node->getArgType(i)));
+    if (isSliceType(node->getArgType(i))) {
+      arg_types.push_back(llvm::Type::getInt64Ty(*context_));
+    }
+  }
+  llvm::FunctionType *function_type = llvm::FunctionType::get(
+      llvmType(node->getReturnType()), arg_types, false);
+  if (auto *function = module_->getFunction(node->getName())) {
+    if (function->isDeclaration() &&
+        function->getFunctionType() == function_type) {
+      return function;
+    }
+  }
+  return llvm::Function::Create(function_type,
+                                llvm::Function::ExternalLinkage,
+                                node->getName(), module_.get());
+}
+
+void CodegenVisitor::visitFunctionDeclarationNode(
+    const FunctionDeclarationNode *node) {
+  llvm::Function *function = declareFunction(node);
   auto entry = llvm::BasicBlock::Create(*context_, "entry", function);
   builder_->SetInsertPoint(entry);
+  // nothing branches back to the entry block
+  ssa_.sealBlock(entry);
+  auto arg = function->arg_begin();
+  for (size_t i = 0; i < node->getArgs().size(); i++, arg++) {
+    const auto &arg_name = node->getArgs()[i];
+    arg->setName(arg_name);
+    auto variable = ssa_.addVariable(arg->getType());
+    symbols_.declare(names_.intern(arg_name), variable);
+    if (!isSliceType(node->getArgType(i))) {
+      ssa_.writeVariable(variable, entry, &*arg);
+      continue;
+    }
+    // slices never change, so they're kept out of the SSA builder. the
+    // caller promises they don't overlap each other when one is written,
+    // which lets loops over them be vectorized without runtime checks.
+    llvm::Type *element = llvmType(elementType(node->getArgType(i)));
+    arg->addAttr(llvm::Attribute::NoAlias);
+    arg->addAttr(llvm::Attribute::NoCapture);
+    arg->addAttr(llvm::Attribute::getWithAlignment(
+        *context_, module_->getDataLayout().getABITypeAlign(element)));
+    llvm::Argument *data = &*arg++;
+    arg->setName(std::string(arg_name) + "_len");
+    slices_[variable] = {data, &*arg, element};
+  }
   ret_ = function;
 }
 
 void CodegenVisitor::visitBodyNode(const BodyNode *node) {
   for (const auto &block : node->getBlocks()) {
+    // everything after a return is unreachable
+    if (builder_->GetInsertBlock()->getTerminator()) {
+      break;
+    }
     block->accept(this);
   }
 }
@@ -51,21 +749,43 @@ void CodegenVisitor::visitBinaryExprNode(const BinaryExprNode *node) {
   auto lhs = ret_;
   node->getRHS()->accept(this);
   auto rhs = ret_;
+  // integers are signed, and wrap around on overflow
+  bool is_integer = lhs->getType()->isIntegerTy();
   switch (node->getOperator()) {
   case tok_add: {
-    ret_ = builder_->CreateFAdd(lhs, rhs, "addtmp");
+    ret_ = is_integer ? builder_->CreateAdd(lhs, rhs, "addtmp")
+                      : builder_->CreateFAdd(lhs, rhs, "addtmp");
     break;
   }
   case tok_sub: {
-    ret_ = builder_->CreateFSub(lhs, rhs, "subtmp");
+    ret_ = is_integer ? builder_->CreateSub(lhs, rhs, "subtmp")
+                      : builder_->CreateFSub(lhs, rhs, "subtmp");
     break;
   }
   case tok_mul: {
-    ret_ = builder_->CreateFMul(lhs, rhs, "multmp");
+    ret_ = is_integer ? builder_->CreateMul(lhs, rhs, "multmp")
+                      : builder_->CreateFMul(lhs, rhs, "multmp");
     break;
   }
   case tok_div: {
-    ret_ = builder_->CreateFDiv(lhs, rhs, "divtmp");
+    ret_ = is_integer ? emitIntegerDivision(tok_div, lhs, rhs)
+                      : builder_->CreateFDiv(lhs, rhs, "divtmp");
+    break;
+  }
+  case tok_mod: {
+    ret_ = is_integer ? emitIntegerDivision(tok_mod, lhs, rhs)
+                      : builder_->CreateFRem(lhs, rhs, "modtmp");
+    break;
+  }
+  case tok_lt:
+  case tok_gt:
+  case tok_lte:
+  case tok_gte: {
+    // comparisons are 1 or 0 when used as values
+    auto *comparison = emitComparison(node->getOperator(), lhs, rhs);
+    ret_ = is_integer
+               ? builder_->CreateZExt(comparison, lhs->getType(), "booltmp")
+               : builder_->CreateUIToFP(comparison, lhs->getType(), "booltmp");
     break;
   }
   default: {
@@ -74,38 +794,576 @@ void CodegenVisitor::visitBinaryExprNode(const BinaryExprNode *node) {
   }
   }
 }
+llvm::Value *CodegenVisitor::emitIntegerDivision(TokenType op,
+                                                 llvm::Value *lhs,
+                                                 llvm::Value *rhs) {
+  // sdiv and srem are undefined for both, so neither may reach them
+  auto *divisor = llvm::dyn_cast<llvm::ConstantInt>(rhs);
+  if (!divisor || divisor->isZero()) {
+    emitCheck(builder_->CreateICmpNE(
+                  rhs, llvm::ConstantInt::get(rhs->getType(), 0), "nonzerotmp"),
+              "divisionbyzero", "nonzero");
+  }
+  auto *minus_one = llvm::ConstantInt::get(rhs->getType(), -1, true);
+  auto *is_minus_one = builder_->CreateICmpEQ(rhs, minus_one, "minusonetmp");
+  auto *safe_rhs = builder_->CreateSelect(
+      is_minus_one, llvm::ConstantInt::get(rhs->getType(), 1), rhs);
+  if (op == tok_div) {
+    // x / -1 is -x, which wraps for the minimum
+    return builder_->CreateSelect(is_minus_one, builder_->CreateNeg(lhs),
+                                  builder_->CreateSDiv(lhs, safe_rhs),
+                                  "divtmp");
+  }
+  return builder_->CreateSelect(is_minus_one,
+                                llvm::ConstantInt::get(lhs->getType(), 0),
+                                builder_->CreateSRem(lhs, safe_rhs),
+                                "modtmp");
+}
+
 void CodegenVisitor::visitNumberLiteralNode(const NumberLiteralNode *node) {
-  llvm::Value *literal =
-      llvm::ConstantFP::get(*context_, llvm::APFloat(node->getValue()));
-  ret_ = literal;
+  const auto &literal = node->getLiteral();
+  llvm::Type *type = llvmType(node->getType());
+  if (isIntegerType(node->getType())) {
+    ret_ = llvm::ConstantInt::get(type, literal.integer, true);
+  } else {
+    ret_ = llvm::ConstantFP::get(type, literal.value);
+  }
 }
 void CodegenVisitor::visitIdentifierExprNode(const IdentifierExprNode *node) {
-  const auto symbol_table_node = current_symbol_table_->get(node->getName());
-  if (!symbol_table_node) {
-    std::cout << "did not find identifier" << std::endl;
+  const auto *variable = symbols_.lookup(names_.intern(node->getName()));
+  if (!variable) {
+    std::cout << "did not find identifier " << node->getName() << std::endl;
     exit(1);
   }
-  ret_ =
-      builder_->CreateLoad(symbol_table_node->getAlloca()->getAllocatedType(),
-                           symbol_table_node->getAlloca(), node->getName());
+  ret_ = ssa_.readVariable(*variable, builder_->GetInsertBlock());
 }
 
 void CodegenVisitor::visitFunctionCallExprNode(
-    const FunctionCallExprNode *node) {}
+    const FunctionCallExprNode *node) {
+  // i64(x) and friends are conversions rather than calls
+  if (node->isConversion()) {
+    auto *arg = node->getArgs()[0];
+    arg->accept(this);
+    ret_ = emitConversion(ret_, arg->getType(), node->getType());
+  } else if (node->getCallKind() == call_length) {
+    auto name =
+        static_cast<const IdentifierExprNode *>(node->getArgs()[0])->getName();
+    ret_ = slices_[*symbols_.lookup(names_.intern(name))].length;
+  } else {
+    ret_ = emitCall(node);
+  }
+}
+
+llvm::Value *CodegenVisitor::emitCall(const FunctionCallExprNode *node) {
+  std::vector<llvm::Value *> args;
+  for (auto *arg : node->getArgs()) {
+    if (!isSliceType(arg->getType())) {
+      arg->accept(this);
+      args.push_back(ret_);
+      continue;
+    }
+    // slices are only ever named, and passed on as their data and length
+    auto name = static_cast<const IdentifierExprNode *>(arg)->getName();
+    const Slice &slice = slices_[*symbols_.lookup(names_.intern(name))];
+    args.push_back(slice.data);
+    args.push_back(slice.length);
+  }
+  std::vector<llvm::Type *> arg_types;
+  for (auto *arg : args) {
+    arg_types.push_back(arg->getType());
+  }
+  llvm::Type *return_type = llvmType(node->getType());
+  if (node->getCallKind() == call_extern) {
+    if (auto id = mathIntrinsic(node->getName(), arg_types, return_type)) {
+      return builder_->CreateIntrinsic(*id, {return_type}, args, nullptr,
+                                       "calltmp");
+    }
+  }
+  // functions defined further down, in other modules or in C are declared
+  // with the signature the type checker gave the call
+  auto callee = module_->getOrInsertFunction(
+      node->getName(),
+      llvm::FunctionType::get(return_type, arg_types, false));
+  return builder_->CreateCall(callee, args, "calltmp");
+}
+
+void CodegenVisitor::visitIndexExprNode(const IndexExprNode *node) {
+  llvm::Value *address =
+      emitElementAddress(node->getSlice(), node->getIndex());
+  llvm::Type *element = llvmType(node->getType());
+  ret_ = builder_->CreateAlignedLoad(
+      element, address, module_->getDataLayout().getABITypeAlign(element),
+      "elementtmp");
+}
+
+void CodegenVisitor::visitStoreNode(const StoreNode *node) {
+  llvm::Value *address =
+      emitElementAddress(node->getSlice(), node->getIndex());
+  node->getValue()->accept(this);
+  builder_->CreateAlignedStore(
+      ret_, address,
+      module_->getDataLayout().getABITypeAlign(ret_->getType()));
+}
+
+llvm::Value *CodegenVisitor::emitElementAddress(std::string_view name,
+                                                ExprNode *index) {
+  auto variable = *symbols_.lookup(names_.intern(name));
+  Slice slice = slices_[variable];
+  index->accept(this);
+  llvm::Value *offset = ret_;
+  bool checked = false;
+  if (index->getExprNodeType() == ExprNode::IdentifierExprNode) {
+    const auto *index_variable = symbols_.lookup(names_.intern(
+        static_cast<const IdentifierExprNode *>(index)->getName()));
+    checked = std::find(in_bounds_.begin(), in_bounds_.end(),
+                        std::make_pair(variable, *index_variable)) !=
+              in_bounds_.end();
+  }
+  if (!checked) {
+    // unsigned, so negative indices are out of bounds too
+    emitCheck(builder_->CreateICmpULT(offset, slice.length, "boundtmp"),
+              "outofbounds", "inbounds");
+  }
+  return builder_->CreateInBoundsGEP(slice.element, slice.data, offset,
+                                     "addrtmp");
+}
+
+void CodegenVisitor::emitCheck(llvm::Value *ok, llvm::StringRef trap,
+                               llvm::StringRef next) {
+  auto trap_block =
+      std::find_if(trap_blocks_.begin(), trap_blocks_.end(),
+                   [&](llvm::BasicBlock *block) {
+                     return block->getName() == trap;
+                   });
+  if (trap_block == trap_blocks_.end()) {
+    trap_blocks_.push_back(llvm::BasicBlock::Create(*context_, trap));
+    trap_block = trap_blocks_.end() - 1;
+    llvm::IRBuilder<> trap_builder(*trap_block);
+    trap_builder.CreateCall(
+        llvm::Intrinsic::getDeclaration(module_.get(), llvm::Intrinsic::trap));
+    trap_builder.CreateUnreachable();
+  }
+  llvm::Function *function = builder_->GetInsertBlock()->getParent();
+  auto next_block = llvm::BasicBlock::Create(*context_, next, function);
+  builder_->CreateCondBr(ok, next_block, *trap_block,
+                         branchWeights(branch_likely));
+  ssa_.sealBlock(next_block);
+  builder_->SetInsertPoint(next_block);
+}
+
+llvm::Value *CodegenVisitor::emitRangeCheck(const ForNode *node,
+                                            SsaBuilder::Variable variable,
+                                            llvm::Value *start,
+                                            llvm::Value *end) {
+  // the variable only ever takes the values start, start + step, ... below
+  // end if the body doesn't assign it and the step is a positive literal.
+  // small steps can't wrap around past a length that fits in memory.
+  auto step = integerLiteral(node->getStep());
+  if (node->getStart()->getType() != type_i64 || !step || *step < 1 ||
+      *step > INT32_MAX) {
+    return nullptr;
+  }
+  std::string_view name = node->getVariable();
+  bool assigned = false;
+  llvm::SmallVector<std::string_view, 4> indexed;
+  forEachStatement(node->getBody(), [&](const BodySubNode *block) {
+    if (block->getBodyNodeType() == BodySubNode::DefinitionNode) {
+      assigned |=
+          static_cast<const DefinitionNode *>(block)->getLValue() == name;
+    } else if (block->getBodyNodeType() == BodySubNode::ForNode) {
+      assigned |= static_cast<const ForNode *>(block)->getVariable() == name;
+    }
+    forEachAccess(block, [&](std::string_view slice, const ExprNode *index) {
+      if (isIdentifier(index, name) &&
+          std::find(indexed.begin(), indexed.end(), slice) == indexed.end()) {
+        indexed.push_back(slice);
+      }
+    });
+  });
+  if (assigned || indexed.empty()) {
+    return nullptr;
+  }
+
+  // every index is in [start, end), so start >= 0 and end <= len(slice)
+  // cover them all. neither has to hold if the loop doesn't run.
+  llvm::Value *in_bounds = nullptr;
+  auto require = [&](llvm::Value *condition) {
+    in_bounds = in_bounds ? builder_->CreateAnd(in_bounds, condition)
+                          : condition;
+  };
+  auto start_literal = integerLiteral(node->getStart());
+  if (!start_literal || *start_literal < 0) {
+    require(builder_->CreateICmpSGE(
+        start, llvm::ConstantInt::get(start->getType(), 0), "boundtmp"));
+  }
+  for (auto slice : indexed) {
+    auto slice_variable = *symbols_.lookup(names_.intern(slice));
+    if (!isLengthOf(node->getEnd(), slice)) {
+      require(builder_->CreateICmpSLE(end, slices_[slice_variable].length,
+                                      "boundtmp"));
+    }
+    in_bounds_.push_back({slice_variable, variable});
+  }
+  if (!in_bounds) {
+    return nullptr;
+  }
+  return builder_->CreateOr(builder_->CreateICmpSGE(start, end, "emptytmp"),
+                            in_bounds);
+}
+
+llvm::Value *CodegenVisitor::emitComparison(TokenType op, llvm::Value *lhs,
+                                            llvm::Value *rhs) {
+  if (lhs->getType()->isIntegerTy()) {
+    switch (op) {
+    case tok_lt:
+      return builder_->CreateICmpSLT(lhs, rhs, "cmptmp");
+    case tok_gt:
+      return builder_->CreateICmpSGT(lhs, rhs, "cmptmp");
+    case tok_lte:
+      return builder_->CreateICmpSLE(lhs, rhs, "cmptmp");
+    case tok_gte:
+      return builder_->CreateICmpSGE(lhs, rhs, "cmptmp");
+    default:
+      break;
+    }
+  }
+  // ordered, a comparison with NaN is false
+  switch (op) {
+  case tok_lt:
+    return builder_->CreateFCmpOLT(lhs, rhs, "cmptmp");
+  case tok_gt:
+    return builder_->CreateFCmpOGT(lhs, rhs, "cmptmp");
+  case tok_lte:
+    return builder_->CreateFCmpOLE(lhs, rhs, "cmptmp");
+  case tok_gte:
+    return builder_->CreateFCmpOGE(lhs, rhs, "cmptmp");
+  default:
+    std::cout << "Unknown comparison operator" << std::endl;
+    exit(1);
+  }
+}
+
+llvm::Value *CodegenVisitor::emitCondition(ExprNode *expr) {
+  if (expr->getExprNodeType() == ExprNode::BinaryExprNode) {
+    const auto *binary = static_cast<const BinaryExprNode *>(expr);
+    if (isComparison(binary->getOperator())) {
+      binary->getLHS()->accept(this);
+      auto lhs = ret_;
+      binary->getRHS()->accept(this);
+      return emitComparison(binary->getOperator(), lhs, ret_);
+    }
+  }
+  // anything else is true unless it's 0
+  expr->accept(this);
+  if (ret_->getType()->isIntegerTy()) {
+    return builder_->CreateICmpNE(
+        ret_, llvm::ConstantInt::get(ret_->getType(), 0), "ifcond");
+  }
+  return builder_->CreateFCmpUNE(
+      ret_, llvm::ConstantFP::get(ret_->getType(), 0.0), "ifcond");
+}
+
+llvm::MDNode *CodegenVisitor::branchWeights(BranchHint hint) {
+  // the same odds clang gives __builtin_expect
+  constexpr uint32_t kLikelyWeight = 2000;
+  constexpr uint32_t kUnlikelyWeight = 1;
+  llvm::MDBuilder md_builder(*context_);
+  switch (hint) {
+  case branch_likely:
+    return md_builder.createBranchWeights(kLikelyWeight, kUnlikelyWeight);
+  case branch_unlikely:
+    return md_builder.createBranchWeights(kUnlikelyWeight, kLikelyWeight);
+  default:
+    return nullptr;
+  }
+}
 
 void CodegenVisitor::visitConditionalNode(const ConditionalNode *node) {
-  onEnterBlock(""); // todo...
-  onExitBlock();
+  llvm::Value *condition = emitCondition(node->getIfExpr());
+  if (isSelectable(node)) {
+    emitSelects(node, condition);
+  } else {
+    emitBranches(node, condition);
+  }
+}
+
+void CodegenVisitor::emitBranches(const ConditionalNode *node,
+                                  llvm::Value *condition) {
+  llvm::Function *function = builder_->GetInsertBlock()->getParent();
+  // blocks are added to the function as they're reached, so they end up in
+  // source order around nested conditionals
+  auto then_block = llvm::BasicBlock::Create(*context_, "then", function);
+  auto else_block = node->getElseBody()
+                        ? llvm::BasicBlock::Create(*context_, "else")
+                        : nullptr;
+  auto merge_block = llvm::BasicBlock::Create(*context_, "ifcont");
+  builder_->CreateCondBr(condition, then_block,
+                         else_block ? else_block : merge_block,
+                         branchWeights(node->getHint()));
+
+  // the branch above is the only way into either body
+  ssa_.sealBlock(then_block);
+  emitBranchBody(node->getIfBody(), then_block, merge_block);
+  if (else_block) {
+    else_block->insertInto(function);
+    ssa_.sealBlock(else_block);
+    emitBranchBody(node->getElseBody(), else_block, merge_block);
+  }
+
+  if (llvm::pred_empty(merge_block)) {
+    // both bodies returned, so does the conditional
+    delete merge_block;
+    return;
+  }
+  merge_block->insertInto(function);
+  ssa_.sealBlock(merge_block);
+  builder_->SetInsertPoint(merge_block);
+}
+
+void CodegenVisitor::emitBranchBody(BodyNode *body,
+                                    llvm::BasicBlock *block,
+                                    llvm::BasicBlock *merge_block) {
+  builder_->SetInsertPoint(block);
+  symbols_.pushScope();
+  body->accept(this);
+  symbols_.popScope();
+  if (!builder_->GetInsertBlock()->getTerminator()) {
+    builder_->CreateBr(merge_block);
+  }
+}
+
+CodegenVisitor::AssignedValues
+CodegenVisitor::speculateBody(const BodyNode *body) {
+  // the body is generated in the current block, the variables it assigns
+  // are put back afterwards and their new values returned instead. only
+  // variables that existed before the body can outlive it.
+  llvm::BasicBlock *block = builder_->GetInsertBlock();
+  size_t outer_variables = ssa_.variableCount();
+  AssignedValues previous;
+  symbols_.pushScope();
+  for (auto *definition : body->getBlocks()) {
+    const auto *lvalue = symbols_.lookup(names_.intern(
+        static_cast<const DefinitionNode *>(definition)->getLValue()));
+    auto is_lvalue = [&](const auto &entry) { return entry.first == *lvalue; };
+    if (lvalue && *lvalue < outer_variables &&
+        std::none_of(previous.begin(), previous.end(), is_lvalue)) {
+      previous.push_back({*lvalue, ssa_.readVariable(*lvalue, block)});
+    }
+    definition->accept(this);
+  }
+  symbols_.popScope();
+
+  AssignedValues assigned;
+  for (auto [variable, value] : previous) {
+    assigned.push_back({variable, ssa_.readVariable(variable, block)});
+    ssa_.writeVariable(variable, block, value);
+  }
+  return assigned;
+}
+
+void CodegenVisitor::emitSelects(const ConditionalNode *node,
+                                 llvm::Value *condition) {
+  llvm::BasicBlock *block = builder_->GetInsertBlock();
+  AssignedValues if_values = speculateBody(node->getIfBody());
+  AssignedValues else_values;
+  if (node->getElseBody()) {
+    else_values = speculateBody(node->getElseBody());
+  }
+
+  // a variable only one side assigns keeps its value on the other
+  auto valueIn = [&](const AssignedValues &values,
+                     SsaBuilder::Variable variable) {
+    for (auto [assigned, value] : values) {
+      if (assigned == variable) {
+        return value;
+      }
+    }
+    return ssa_.readVariable(variable, block);
+  };
+  llvm::SmallVector<SsaBuilder::Variable, 4> merged;
+  for (const auto *values : {&if_values, &else_values}) {
+    for (auto [variable, value] : *values) {
+      if (std::find(merged.begin(), merged.end(), variable) == merged.end()) {
+        merged.push_back(variable);
+      }
+    }
+  }
+  for (auto variable : merged) {
+    ssa_.writeVariable(variable, block,
+                       builder_->CreateSelect(condition,
+                                              valueIn(if_values, variable),
+                                              valueIn(else_values, variable),
+                                              "selecttmp"));
+  }
+}
+
+llvm::MDNode *CodegenVisitor::loopMetadata(const LoopHints &hints) {
+  if (hints.empty()) {
+    return nullptr;
+  }
+  auto *i32 = llvm::Type::getInt32Ty(*context_);
+  auto option = [&](const char *name, llvm::Metadata *value = nullptr) {
+    llvm::SmallVector<llvm::Metadata *, 2> operands = {
+        llvm::MDString::get(*context_, name)};
+    if (value) {
+      operands.push_back(value);
+    }
+    return llvm::MDNode::get(*context_, operands);
+  };
+  auto count = [&](uint32_t value) {
+    return llvm::ConstantAsMetadata::get(llvm::ConstantInt::get(i32, value));
+  };
+  // the first operand of a loop id refers to the id itself, which keeps
+  // loops with the same hints apart
+  llvm::SmallVector<llvm::Metadata *, 4> operands = {nullptr};
+  if (hints.vectorize) {
+    operands.push_back(
+        option("llvm.loop.vectorize.enable",
+               llvm::ConstantAsMetadata::get(llvm::ConstantInt::getTrue(
+                   llvm::Type::getInt1Ty(*context_)))));
+    if (hints.vectorize_width) {
+      operands.push_back(
+          option("llvm.loop.vectorize.width", count(hints.vectorize_width)));
+    }
+  }
+  if (hints.unroll_count == 1) {
+    operands.push_back(option("llvm.loop.unroll.disable"));
+  } else if (hints.unroll_count > 1) {
+    operands.push_back(
+        option("llvm.loop.unroll.count", count(hints.unroll_count)));
+  }
+  auto *loop_id = llvm::MDNode::getDistinct(*context_, operands);
+  loop_id->replaceOperandWith(0, loop_id);
+  return loop_id;
+}
+
+bool CodegenVisitor::emitLoopBody(BodyNode *body,
+                                  llvm::BasicBlock *body_block) {
+  ssa_.sealBlock(body_block);
+  builder_->SetInsertPoint(body_block);
+  symbols_.pushScope();
+  body->accept(this);
+  symbols_.popScope();
+  return !builder_->GetInsertBlock()->getTerminator();
+}
+
+void CodegenVisitor::emitBackEdge(llvm::BasicBlock *header,
+                                  const LoopHints &hints) {
+  auto *back_edge = builder_->CreateBr(header);
+  if (auto *loop_id = loopMetadata(hints)) {
+    back_edge->setMetadata(llvm::LLVMContext::MD_loop, loop_id);
+  }
+}
+
+void CodegenVisitor::visitWhileNode(const WhileNode *node) {
+  llvm::Function *function = builder_->GetInsertBlock()->getParent();
+  // the block before the loop only branches to the header, so it's the
+  // preheader loop passes expect
+  auto header = llvm::BasicBlock::Create(*context_, "loop", function);
+  builder_->CreateBr(header);
+  builder_->SetInsertPoint(header);
+  llvm::Value *condition = emitCondition(node->getCondition());
+  auto body_block = llvm::BasicBlock::Create(*context_, "loopbody", function);
+  auto exit_block = llvm::BasicBlock::Create(*context_, "afterloop");
+  builder_->CreateCondBr(condition, body_block, exit_block);
+
+  if (emitLoopBody(node->getBody(), body_block)) {
+    emitBackEdge(header, node->getHints());
+  }
+  // the back edge was the header's last missing predecessor
+  ssa_.sealBlock(header);
+  exit_block->insertInto(function);
+  ssa_.sealBlock(exit_block);
+  builder_->SetInsertPoint(exit_block);
+}
+
+void CodegenVisitor::visitForNode(const ForNode *node) {
+  // i = start, then the end and step are computed once before the loop
+  symbols_.pushScope();
+  node->getStart()->accept(this);
+  uint32_t name = names_.intern(node->getVariable());
+  const auto *existing = symbols_.lookup(name);
+  auto variable = existing ? *existing : ssa_.addVariable(ret_->getType());
+  if (!existing) {
+    symbols_.declare(name, variable);
+  }
+  ssa_.writeVariable(variable, builder_->GetInsertBlock(), ret_);
+  llvm::Value *start = ret_;
+  node->getEnd()->accept(this);
+  llvm::Value *end = ret_;
+  node->getStep()->accept(this);
+  llvm::Value *step = ret_;
+  size_t outer_in_bounds = in_bounds_.size();
+  llvm::Value *in_range = emitRangeCheck(node, variable, start, end);
+  if (!in_range) {
+    emitForLoop(node, variable, end, step);
+  } else {
+    // the range may not fit even though every access does, when the body
+    // guards them or leaves the loop early. so the loop is generated twice,
+    // without checks for when the range fits and with them otherwise.
+    llvm::Function *function = builder_->GetInsertBlock()->getParent();
+    auto unchecked = llvm::BasicBlock::Create(*context_, "inbounds", function);
+    auto checked = llvm::BasicBlock::Create(*context_, "checked", function);
+    auto merge = llvm::BasicBlock::Create(*context_, "afterversions");
+    builder_->CreateCondBr(in_range, unchecked, checked,
+                           branchWeights(branch_likely));
+    ssa_.sealBlock(unchecked);
+    ssa_.sealBlock(checked);
+    builder_->SetInsertPoint(unchecked);
+    emitForLoop(node, variable, end, step);
+    builder_->CreateBr(merge);
+    in_bounds_.resize(outer_in_bounds);
+    builder_->SetInsertPoint(checked);
+    emitForLoop(node, variable, end, step);
+    builder_->CreateBr(merge);
+    merge->insertInto(function);
+    ssa_.sealBlock(merge);
+    builder_->SetInsertPoint(merge);
+  }
+  in_bounds_.resize(outer_in_bounds);
+  symbols_.popScope();
+}
+
+void CodegenVisitor::emitForLoop(const ForNode *node,
+                                 SsaBuilder::Variable variable,
+                                 llvm::Value *end, llvm::Value *step) {
+  llvm::Function *function = builder_->GetInsertBlock()->getParent();
+  auto header = llvm::BasicBlock::Create(*context_, "loop", function);
+  builder_->CreateBr(header);
+  builder_->SetInsertPoint(header);
+  llvm::Value *condition = emitComparison(
+      tok_lt, ssa_.readVariable(variable, header), end);
+  auto body_block = llvm::BasicBlock::Create(*context_, "loopbody", function);
+  auto exit_block = llvm::BasicBlock::Create(*context_, "afterloop");
+  builder_->CreateCondBr(condition, body_block, exit_block);
+
+  if (emitLoopBody(node->getBody(), body_block)) {
+    // the increment is at the end of the body, whose last block becomes the
+    // latch
+    llvm::BasicBlock *latch = builder_->GetInsertBlock();
+    llvm::Value *current = ssa_.readVariable(variable, latch);
+    ssa_.writeVariable(variable, latch,
+                       current->getType()->isIntegerTy()
+                           ? builder_->CreateAdd(current, step, "nexttmp")
+                           : builder_->CreateFAdd(current, step, "nexttmp"));
+    emitBackEdge(header, node->getHints());
+  }
+  ssa_.sealBlock(header);
+  exit_block->insertInto(function);
+  ssa_.sealBlock(exit_block);
+  builder_->SetInsertPoint(exit_block);
 }
 
 void CodegenVisitor::visitDefinitionNode(const DefinitionNode *node) {
   node->getRHS()->accept(this);
-  const auto &var_name = node->getLValue();
-  auto alloca = builder_->CreateAlloca(llvm::Type::getDoubleTy(*context_),
-                                       nullptr, var_name);
-  current_symbol_table_->insert(
-      std::make_shared<SymbolTableNode>(var_name, alloca));
-  builder_->CreateStore(ret_, alloca);
+  // assigns a visible variable, or declares one in the innermost scope
+  uint32_t name = names_.intern(node->getLValue());
+  const auto *existing = symbols_.lookup(name);
+  auto variable = existing ? *existing : ssa_.addVariable(ret_->getType());
+  if (!existing) {
+    symbols_.declare(name, variable);
+  }
+  ssa_.writeVariable(variable, builder_->GetInsertBlock(), ret_);
 }
 
 void CodegenVisitor::visitReturnNode(const ReturnNode *node) {
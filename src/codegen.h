@@ -1,4 +1,13 @@
+#pragma once
+
+#include "parser.h"
+#include "scanner.h"
+#include "ssa.h"
+#include "symbol_table.h"
+#include "target.h"
 #include "visitor.h"
+#include "llvm/Analysis/TargetLibraryInfo.h"
+#include "llvm/ExecutionEngine/Orc/ThreadSafeModule.h"
 #include "llvm/IR/IRBuilder.h"
 #include "llvm/IR/Module.h"
 #include "llvm/IR/PassManager.h"
@@ -12,70 +21,75 @@
 #include "llvm/Transforms/Scalar/SimplifyCFG.h"
 #include <fstream>
 #include <iostream>
-
-class SymbolTableNode {
-public:
-  SymbolTableNode(const std::string &name, llvm::AllocaInst *alloca)
-      : name_(name), alloca_(alloca) {}
-
-  std::string getName() const { return name_; }
-  llvm::AllocaInst *getAlloca() const { return alloca_; }
-
-private:
-  std::string name_;
-  llvm::AllocaInst *alloca_;
-};
-
-class SymbolTable {
-public:
-  void insert(std::shared_ptr<SymbolTableNode> node) {
-    table_[node->getName()] = node;
-  }
-
-  std::shared_ptr<SymbolTableNode> get(const std::string &name) {
-    auto el = table_.find(name);
-    return el->second;
-  }
-
-  void addChild(const std::string &scope_name,
-                std::shared_ptr<SymbolTable> symbol_table) {
-    children_[scope_name] = symbol_table;
-  }
-
-  void setParent(std::shared_ptr<SymbolTable> symbol_table) {
-    parent_ = symbol_table;
-  }
-
-  std::shared_ptr<SymbolTable> getParentSymbolTable() const { return parent_; }
-
-private:
-  std::unordered_map<std::string, std::shared_ptr<SymbolTableNode>> table_;
-  std::shared_ptr<SymbolTable> parent_;
-  std::unordered_map<std::string, std::shared_ptr<SymbolTable>> children_;
+#include <optional>
+
+// Objects are linked by running `cc <mode> -o <output> <objects...>`, mode
+// being e.g. -shared or -r.
+std::string createTemporaryObject();
+void linkObjects(const std::string &mode, const std::string &output,
+                 const std::vector<std::string> &objects);
+
+// Functions whose signature isn't all f64 get a second entry point taking and
+// returning doubles, named after the function plus this suffix. It's what the
+// JIT and the tiered engine call, and isn't part of the header.
+constexpr const char *kBoxedSuffix = ".boxed";
+std::string boxedName(llvm::StringRef name);
+
+// With CodegenOptions::batch_entries, every function that doesn't take slices
+// also gets an entry point that calls it on whole arrays, e.g. for
+// `def f(x, y)`
+//
+//   void f_batch(const double *x, const double *y, double *out, size_t count)
+//
+// sets out[i] = f(x[i], y[i]) for i < count. The function is inlined into
+// the loop, which the vectorizer can then turn into SIMD code. out may be
+// one of the inputs, but mustn't partially overlap them.
+constexpr const char *kBatchSuffix = "_batch";
+std::string batchName(llvm::StringRef name);
+
+// none, libmvec (glibc), svml (Intel), massv (IBM) or accelerate (Apple)
+std::optional<llvm::TargetLibraryInfoImpl::VectorLibrary>
+vectorLibraryFromName(llvm::StringRef name);
+
+// Settings that change the code generated for the same AST.
+struct CodegenOptions {
+  // vectorizing every batch loop makes optimizing a module many times slower,
+  // so they're only worth it for code that is compiled ahead of time
+  bool batch_entries = false;
+  // vectorized math functions that calls to extern math functions in loops
+  // can be replaced with, see vectorLibraryFromName
+  llvm::TargetLibraryInfoImpl::VectorLibrary vector_library =
+      llvm::TargetLibraryInfoImpl::NoLibrary;
+  // for functions without a float mode annotation of their own
+  FloatMode float_mode = float_strict;
+
+  // part of the cache key, empty for the defaults
+  std::string describe() const;
 };
 
 class CodegenVisitor : public Visitor {
 public:
-  CodegenVisitor() {
-    llvm::InitializeNativeTarget();
-    llvm::InitializeNativeTargetAsmPrinter();
-    llvm::InitializeNativeTargetAsmParser();
+  explicit CodegenVisitor(const CodegenOptions &options = {})
+      : options_(options) {
+    target_machine_ = createHostTargetMachine();
 
     context_ = std::make_unique<llvm::LLVMContext>();
     module_ = std::make_unique<llvm::Module>("slice", *context_);
+    configureModuleForTarget(*module_, *target_machine_);
 
-    // module_->setDataLayout()
     builder_ = std::make_unique<llvm::IRBuilder<>>(*context_);
-    root_symbol_table_ = std::make_shared<SymbolTable>();
-    current_symbol_table_ = root_symbol_table_;
   }
   void visitBinaryExprNode(const BinaryExprNode *node) override;
   void visitNumberLiteralNode(const NumberLiteralNode *node) override;
   void visitIdentifierExprNode(const IdentifierExprNode *node) override;
   void visitFunctionCallExprNode(const FunctionCallExprNode *node) override;
+  void visitIndexExprNode(const IndexExprNode *node) override;
   void visitBodyNode(const BodyNode *node) override;
   void visitConditionalNode(const ConditionalNode *node) override;
+  void visitWhileNode(const WhileNode *node) override;
+  void visitForNode(const ForNode *node) override;
   void visitDefinitionNode(const DefinitionNode *node) override;
+  void visitStoreNode(const StoreNode *node) override;
   void visitReturnNode(const ReturnNode *node) override;
   void
   visitFunctionDeclarationNode(const FunctionDeclarationNode *node) override;
@@ -87,7 +101,13 @@ public:
     llvm::FunctionAnalysisManager fam;
     llvm::CGSCCAnalysisManager cgam;
     llvm::ModuleAnalysisManager mam;
-    llvm::PassBuilder passbuilder;
+    llvm::PassBuilder passbuilder(target_machine_.get());
+
+    // registered first, so the default one without vector functions isn't
+    llvm::TargetLibraryInfoImpl library_info(
+        llvm::Triple(module_->getTargetTriple()));
+    library_info.addVectorizableFunctionsFromVecLib(options_.vector_library);
+    fam.registerPass([&] { return llvm::TargetLibraryAnalysis(library_info); });
 
     passbuilder.registerModuleAnalyses(mam);
     passbuilder.registerCGSCCAnalyses(cgam);
@@ -101,27 +121,128 @@ public:
     mpm.run(*module_, mam);
   }
 
-  void dump() { module_->print(llvm::outs(), nullptr); }
-
-private:
-  void setCurrentSymbolTable(std::shared_ptr<SymbolTable> symbol_table) {
-    current_symbol_table_ = symbol_table;
+  void dump(llvm::raw_ostream &out = llvm::outs()) {
+    module_->print(out, nullptr);
   }
-  void onEnterBlock(const std::string &block_name) {
-    auto new_symbol_table = std::make_shared<SymbolTable>();
-    current_symbol_table_->addChild(block_name, new_symbol_table);
-    new_symbol_table->setParent(current_symbol_table_);
 
-    current_symbol_table_ = new_symbol_table;
+  void emitObject(const std::string &path);
+  void emitObject(llvm::raw_pwrite_stream &out);
+  std::unique_ptr<llvm::MemoryBuffer> emitObjectToMemory();
+  void emitSharedLibrary(const std::string &path);
+  void emitBitcode(const std::string &path);
+  // writes a C/C++ header with a prototype for every function in the module.
+  // a slice argument xs becomes a pointer xs and a size_t xs_len.
+  void writeHeader(llvm::raw_ostream &out);
+  // just the prototypes, and the header around prototypes that were written
+  // separately, e.g. for functions spread over several modules
+  void writePrototypes(llvm::raw_ostream &out);
+  static void writeHeader(llvm::raw_ostream &out, llvm::StringRef prototypes);
+
+  // names the module, e.g. after the key the JIT caches its object under
+  void setModuleIdentifier(llvm::StringRef identifier) {
+    module_->setModuleIdentifier(identifier);
   }
-  void onExitBlock() {
-    current_symbol_table_ = current_symbol_table_->getParentSymbolTable();
+
+  // moves the functions of other's module into this one. the modules live in
+  // different contexts, so this goes through bitcode.
+  void linkIn(CodegenVisitor &other);
+
+  // hands ownership of the module (and the context it lives in) to the caller,
+  // e.g. the JIT. the visitor can't be used to generate more code afterwards.
+  llvm::orc::ThreadSafeModule takeModule() {
+    builder_.reset();
+    return llvm::orc::ThreadSafeModule(std::move(module_), std::move(context_));
   }
 
+private:
+  using AssignedValues =
+      llvm::SmallVector<std::pair<SsaBuilder::Variable, llvm::Value *>, 4>;
+  // a slice argument is passed as a pointer to its first element and an i64
+  // length
+  struct Slice {
+    llvm::Value *data;
+    llvm::Value *length;
+    llvm::Type *element;
+  };
+
+  // sets up the builder and the function's attributes for the rewrites the
+  // mode allows
+  void setFloatMode(llvm::Function *function, FloatMode mode);
+  llvm::Type *llvmType(ValueType type);
+  // the function's declaration in this module, created unless an earlier
+  // call already declared it
+  llvm::Function *declareFunction(const FunctionDeclarationNode *node);
+  // calls to extern C math functions become LLVM intrinsics, which the
+  // optimizer can fold and the vectorizer can widen
+  llvm::Value *emitCall(const FunctionCallExprNode *node);
+  llvm::Value *emitConversion(llvm::Value *value, ValueType from,
+                              ValueType to);
+  void emitBoxedEntry(llvm::Function *function,
+                      const FunctionDeclarationNode *node);
+  void emitBatchEntry(llvm::Function *function,
+                      const FunctionDeclarationNode *node);
+  void addPrototype(const llvm::Function *function,
+                    const FunctionDeclarationNode *node);
+  llvm::Value *emitComparison(TokenType op, llvm::Value *lhs,
+                              llvm::Value *rhs);
+  // the condition as an i1, comparisons are used as is
+  llvm::Value *emitCondition(ExprNode *expr);
+  llvm::MDNode *branchWeights(BranchHint hint);
+  void emitBranches(const ConditionalNode *node, llvm::Value *condition);
+  void emitBranchBody(BodyNode *body, llvm::BasicBlock *block,
+                      llvm::BasicBlock *merge_block);
+  void emitSelects(const ConditionalNode *node, llvm::Value *condition);
+  // the llvm.loop metadata for the hints, or nullptr if there are none
+  llvm::MDNode *loopMetadata(const LoopHints &hints);
+  // emits the body of a loop into body_block, which only the loop header
+  // branches to. returns whether the body falls through to the back edge.
+  bool emitLoopBody(BodyNode *body, llvm::BasicBlock *body_block);
+  // the loop's only back edge, which carries the hints
+  void emitBackEdge(llvm::BasicBlock *header, const LoopHints &hints);
+  AssignedValues speculateBody(const BodyNode *body);
+  // the address of slice[index], checked against the length unless the loop
+  // around it already did
+  llvm::Value *emitElementAddress(std::string_view slice, ExprNode *index);
+  // continues in a new block named next if ok holds, and otherwise branches
+  // to the function's block named trap, which stops the program
+  void emitCheck(llvm::Value *ok, llvm::StringRef trap, llvm::StringRef next);
+  // lhs / rhs or lhs % rhs on integers, with the interpreter's semantics: a
+  // zero divisor stops the program and dividing the minimum by -1 wraps
+  llvm::Value *emitIntegerDivision(TokenType op, llvm::Value *lhs,
+                                   llvm::Value *rhs);
+  // records that the slices the body of a for loop indexes with the loop
+  // variable are long enough for its whole range, so those accesses need no
+  // check of their own. returns the condition under which that holds, or
+  // nullptr if it always does or nothing was recorded.
+  llvm::Value *emitRangeCheck(const ForNode *node,
+                              SsaBuilder::Variable variable,
+                              llvm::Value *start, llvm::Value *end);
+  // the header, body and latch of a for loop, continuing after it
+  void emitForLoop(const ForNode *node, SsaBuilder::Variable variable,
+                   llvm::Value *end, llvm::Value *step);
+
+  CodegenOptions options_;
+  std::unique_ptr<llvm::TargetMachine> target_machine_;
   std::unique_ptr<llvm::LLVMContext> context_;
   std::unique_ptr<llvm::Module> module_;
   std::unique_ptr<llvm::IRBuilder<>> builder_;
   llvm::Value *ret_;
-  std::shared_ptr<SymbolTable> root_symbol_table_;
-  std::shared_ptr<SymbolTable> current_symbol_table_;
+  // values of the variables of the function being generated, no stack slots
+  // are created for them
+  SsaBuilder ssa_;
+  // names are interned once per module, the symbol table maps them to the
+  // variable they refer to at the current point of the function
+  IdentifierTable names_;
+  SymbolTable<SsaBuilder::Variable> symbols_;
+  // the slice arguments of the function being generated
+  llvm::DenseMap<SsaBuilder::Variable, Slice> slices_;
+  // slice and loop variable pairs for which slice[variable] is known to be
+  // in bounds
+  llvm::SmallVector<std::pair<SsaBuilder::Variable, SsaBuilder::Variable>, 4>
+      in_bounds_;
+  // the blocks failed checks of the function branch to, one per reason,
+  // added to the end of the function once it's done
+  llvm::SmallVector<llvm::BasicBlock *, 2> trap_blocks_;
+  // the C prototypes of the functions generated so far
+  std::string prototypes_;
 };
\ No newline at end of file
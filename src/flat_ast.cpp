@@ -0,0 +1,392 @@
+#include "flat_ast.h"
+#include "numeric.h"
+#include "visitor.h"
+
+#include <iostream>
+
+// Appends nodes in post order while walking the tree. Like the codegen
+// visitor, the id of the node that was just visited is left in last_.
+class FlatAstBuilder : public Visitor {
+public:
+  FlatAstBuilder(FlatAst &ast) : ast_(ast) {}
+
+  void visitBinaryExprNode(const BinaryExprNode *node) override {
+    node->getLHS()->accept(this);
+    NodeId lhs = last_;
+    node->getRHS()->accept(this);
+    last_ = ast_.add(flat_binary, node->getOperator(), lhs, last_, 0,
+                     node->getType());
+  }
+
+  void visitNumberLiteralNode(const NumberLiteralNode *node) override {
+    ast_.numbers_.push_back(node->getLiteral());
+    last_ = ast_.add(flat_number, ast_.numbers_.size() - 1, 0, 0, 0,
+                     node->getType());
+  }
+
+  void visitIdentifierExprNode(const IdentifierExprNode *node) override {
+    last_ = ast_.add(flat_identifier, ast_.names_.intern(node->getName()), 0,
+                     0, 0, node->getType());
+  }
+
+  void visitFunctionCallExprNode(const FunctionCallExprNode *node) override {
+    std::vector<NodeId> args;
+    for (auto *arg : node->getArgs()) {
+      arg->accept(this);
+      args.push_back(last_);
+    }
+    uint32_t first = appendList(args);
+    last_ = ast_.add(flat_call, ast_.names_.intern(node->getName()), first,
+                     args.size(), node->getCallKind(), node->getType());
+  }
+
+  void visitIndexExprNode(const IndexExprNode *node) override {
+    node->getIndex()->accept(this);
+    last_ = ast_.add(flat_index, ast_.names_.intern(node->getSlice()), last_,
+                     0, 0, node->getType());
+  }
+
+  void visitBodyNode(const BodyNode *node) override {
+    std::vector<NodeId> blocks;
+    for (auto *block : node->getBlocks()) {
+      block->accept(this);
+      blocks.push_back(last_);
+    }
+    uint32_t first = appendList(blocks);
+    last_ = ast_.add(flat_body, 0, first, blocks.size());
+  }
+
+  void visitConditionalNode(const ConditionalNode *node) override {
+    node->getIfExpr()->accept(this);
+    NodeId condition = last_;
+    node->getIfBody()->accept(this);
+    NodeId if_body = last_;
+    NodeId else_body = kNoNode;
+    if (node->getElseBody()) {
+      node->getElseBody()->accept(this);
+      else_body = last_;
+    }
+    last_ = ast_.add(flat_conditional, node->getHint(), condition, if_body,
+                     else_body);
+  }
+
+  void visitWhileNode(const WhileNode *node) override {
+    node->getCondition()->accept(this);
+    NodeId condition = last_;
+    node->getBody()->accept(this);
+    last_ = ast_.add(flat_while, node->getHints().pack(), condition, last_);
+  }
+
+  void visitForNode(const ForNode *node) override {
+    std::vector<NodeId> range;
+    for (auto *expr : {node->getStart(), node->getEnd(), node->getStep()}) {
+      expr->accept(this);
+      range.push_back(last_);
+    }
+    uint32_t first = appendList(range);
+    node->getBody()->accept(this);
+    last_ = ast_.add(flat_for, node->getHints().pack(),
+                     ast_.names_.intern(node->getVariable()), first, last_);
+  }
+
+  void visitDefinitionNode(const DefinitionNode *node) override {
+    node->getRHS()->accept(this);
+    last_ = ast_.add(flat_definition, ast_.names_.intern(node->getLValue()),
+                     last_);
+  }
+
+  void visitStoreNode(const StoreNode *node) override {
+    node->getIndex()->accept(this);
+    NodeId index = last_;
+    node->getValue()->accept(this);
+    last_ = ast_.add(flat_store, ast_.names_.intern(node->getSlice()), index,
+                     last_);
+  }
+
+  void visitReturnNode(const ReturnNode *node) override {
+    node->getExpr()->accept(this);
+    last_ = ast_.add(flat_return, 0, last_);
+  }
+
+  void
+  visitFunctionDeclarationNode(const FunctionDeclarationNode *node) override {
+    std::vector<uint32_t> args;
+    for (auto arg : node->getArgs()) {
+      args.push_back(ast_.names_.intern(arg));
+    }
+    for (size_t i = 0; i < node->getArgs().size(); i++) {
+      args.push_back(node->getArgType(i));
+    }
+    last_ = appendList(args);
+  }
+
+  void visitFunctionNode(const FunctionNode *node) override {
+    NodeId begin = ast_.size();
+    node->getFunctionDeclaration()->accept(this);
+    uint32_t first_arg = last_;
+    ast_.lists_.push_back(node->getFloatMode());
+    NodeId body = kNoNode;
+    if (!node->isExtern()) {
+      node->getBody()->accept(this);
+      body = last_;
+    }
+    const auto *declaration = node->getFunctionDeclaration();
+    last_ = ast_.add(flat_function, ast_.names_.intern(declaration->getName()),
+                     first_arg, declaration->getArgs().size(), body,
+                     declaration->getReturnType());
+    ast_.functions_.push_back(last_);
+    ast_.function_begins_.push_back(begin);
+  }
+
+  void visitProgramNode(const Program *node) override {
+    for (auto *function : node->getFunctions()) {
+      function->accept(this);
+    }
+  }
+
+private:
+  uint32_t appendList(const std::vector<uint32_t> &ids) {
+    uint32_t first = ast_.lists_.size();
+    ast_.lists_.insert(ast_.lists_.end(), ids.begin(), ids.end());
+    return first;
+  }
+
+  FlatAst &ast_;
+  NodeId last_ = kNoNode;
+};
+
+NodeId FlatAst::add(FlatNodeKind kind, uint32_t payload, uint32_t a,
+                    uint32_t b, uint32_t c, ValueType type) {
+  kinds_.push_back(kind);
+  payload_.push_back(payload);
+  a_.push_back(a);
+  b_.push_back(b);
+  c_.push_back(c);
+  types_.push_back(type);
+  return kinds_.size() - 1;
+}
+
+FlatAst FlatAst::fromProgram(const Program &program) {
+  FlatAst ast;
+  FlatAstBuilder builder(ast);
+  builder.visitProgramNode(&program);
+  return ast;
+}
+
+std::optional<NumberLiteral> FlatAst::foldBinary(NodeId id) const {
+  ValueType type = this->type(id);
+  auto op = static_cast<TokenType>(payload_[id]);
+  if (op != tok_add && op != tok_sub && op != tok_mul && op != tok_div &&
+      op != tok_mod) {
+    return std::nullopt;
+  }
+  if (isIntegerType(type)) {
+    // the operands of an integer operation are integer literals, untyped ones
+    // included
+    int64_t lhs = literal(a_[id]).integer;
+    int64_t rhs = literal(b_[id]).integer;
+    if (rhs == 0 && (op == tok_div || op == tok_mod)) {
+      return std::nullopt;
+    }
+    int64_t value = integerArithmetic(op, lhs, rhs);
+    if (type == type_i32) {
+      value = static_cast<int32_t>(value);
+      return NumberLiteral{num_i32, static_cast<double>(value), value};
+    }
+    return NumberLiteral{num_i64, static_cast<double>(value), value};
+  }
+
+  double value = floatArithmetic(op, number(a_[id]), number(b_[id]));
+  if (type == type_f32) {
+    // f32 operands are exact in a double, and rounding the double result
+    // once gives the same value as the f32 operation
+    return NumberLiteral{num_f32, static_cast<float>(value), 0};
+  }
+  return NumberLiteral{num_f64, value, 0};
+}
+
+void FlatAst::foldConstants() {
+  // children come first, so folded operands are already literals by the time
+  // their parent is reached
+  for (NodeId id = 0; id < size(); id++) {
+    if (kinds_[id] != flat_binary || kinds_[a_[id]] != flat_number ||
+        kinds_[b_[id]] != flat_number) {
+      continue;
+    }
+    auto value = foldBinary(id);
+    if (!value) {
+      continue;
+    }
+    numbers_.push_back(*value);
+    kinds_[id] = flat_number;
+    payload_[id] = numbers_.size() - 1;
+  }
+}
+
+std::vector<bool>
+FlatAst::liveFunctions(const std::vector<std::string_view> &roots) const {
+  // function ids by name id, a name maps to at most one function
+  std::vector<int32_t> function_by_name(names_.size(), -1);
+  for (size_t i = 0; i < functions_.size(); i++) {
+    function_by_name[payload_[functions_[i]]] = i;
+  }
+
+  std::vector<bool> live(functions_.size(), false);
+  std::vector<size_t> worklist;
+  for (size_t i = 0; i < functions_.size(); i++) {
+    for (auto root : roots) {
+      if (name(functions_[i]) == root && !live[i]) {
+        live[i] = true;
+        worklist.push_back(i);
+      }
+    }
+  }
+
+  while (!worklist.empty()) {
+    size_t function = worklist.back();
+    worklist.pop_back();
+    for (NodeId id = function_begins_[function]; id < functions_[function];
+         id++) {
+      if (kinds_[id] != flat_call) {
+        continue;
+      }
+      int32_t callee = function_by_name[payload_[id]];
+      if (callee >= 0 && !live[callee]) {
+        live[callee] = true;
+        worklist.push_back(callee);
+      }
+    }
+  }
+  return live;
+}
+
+void FlatAst::removeDeadFunctions(const std::vector<std::string_view> &roots) {
+  auto live = liveFunctions(roots);
+  size_t kept = 0;
+  for (size_t i = 0; i < functions_.size(); i++) {
+    if (live[i]) {
+      functions_[kept] = functions_[i];
+      function_begins_[kept] = function_begins_[i];
+      kept++;
+    }
+  }
+  functions_.resize(kept);
+  function_begins_.resize(kept);
+}
+
+ExprNode *FlatAst::expandExpr(NodeId id, Arena &arena) const {
+  ExprNode *expr;
+  switch (kinds_[id]) {
+  case flat_binary:
+    expr = arena.make<BinaryExprNode>(static_cast<TokenType>(payload_[id]),
+                                      expandExpr(a_[id], arena),
+                                      expandExpr(b_[id], arena));
+    break;
+  case flat_number:
+    expr = arena.make<NumberLiteralNode>(literal(id));
+    break;
+  case flat_identifier:
+    expr = arena.make<IdentifierExprNode>(name(id));
+    break;
+  case flat_call: {
+    std::vector<ExprNode *> args;
+    for (uint32_t i = 0; i < b_[id]; i++) {
+      args.push_back(expandExpr(lists_[a_[id] + i], arena));
+    }
+    auto *call = arena.make<FunctionCallExprNode>(
+        name(id), arena.copyArray(args.data(), args.size()));
+    call->setCallKind(static_cast<CallKind>(c_[id]));
+    expr = call;
+    break;
+  }
+  case flat_index:
+    expr = arena.make<IndexExprNode>(name(id), expandExpr(a_[id], arena));
+    break;
+  default:
+    std::cout << "Flat node " << id << " is not an expression" << std::endl;
+    exit(1);
+  }
+  expr->setType(type(id));
+  return expr;
+}
+
+BodyNode *FlatAst::expandBody(NodeId id, Arena &arena) const {
+  std::vector<BodySubNode *> blocks;
+  for (uint32_t i = 0; i < b_[id]; i++) {
+    NodeId block = lists_[a_[id] + i];
+    switch (kinds_[block]) {
+    case flat_conditional: {
+      BodyNode *else_body = c_[block] == kNoNode
+                                ? nullptr
+                                : expandBody(c_[block], arena);
+      blocks.push_back(arena.make<ConditionalNode>(
+          expandExpr(a_[block], arena), expandBody(b_[block], arena),
+          else_body, static_cast<BranchHint>(payload_[block])));
+      break;
+    }
+    case flat_while:
+      blocks.push_back(arena.make<WhileNode>(
+          expandExpr(a_[block], arena), expandBody(b_[block], arena),
+          LoopHints::unpack(payload_[block])));
+      break;
+    case flat_for: {
+      const uint32_t *range = &lists_[b_[block]];
+      blocks.push_back(arena.make<ForNode>(
+          names_.get(a_[block]), expandExpr(range[0], arena),
+          expandExpr(range[1], arena), expandExpr(range[2], arena),
+          expandBody(c_[block], arena), LoopHints::unpack(payload_[block])));
+      break;
+    }
+    case flat_definition:
+      blocks.push_back(arena.make<DefinitionNode>(
+          name(block), expandExpr(a_[block], arena)));
+      break;
+    case flat_store:
+      blocks.push_back(arena.make<StoreNode>(name(block),
+                                             expandExpr(a_[block], arena),
+                                             expandExpr(b_[block], arena)));
+      break;
+    case flat_return:
+      blocks.push_back(arena.make<ReturnNode>(expandExpr(a_[block], arena)));
+      break;
+    default:
+      std::cout << "Flat node " << block << " is not a body block"
+                << std::endl;
+      exit(1);
+    }
+  }
+  return arena.make<BodyNode>(arena.copyArray(blocks.data(), blocks.size()));
+}
+
+FunctionNode *FlatAst::expandFunction(NodeId id, Arena &arena) const {
+  std::vector<std::string_view> args;
+  std::vector<ValueType> arg_types;
+  bool typed_args = false;
+  for (uint32_t i = 0; i < b_[id]; i++) {
+    args.push_back(names_.get(lists_[a_[id] + i]));
+    arg_types.push_back(static_cast<ValueType>(lists_[a_[id] + b_[id] + i]));
+    typed_args |= arg_types.back() != type_f64;
+  }
+  if (!typed_args) {
+    arg_types.clear();
+  }
+  bool is_extern = c_[id] == kNoNode;
+  auto declaration = arena.make<FunctionDeclarationNode>(
+      name(id), arena.copyArray(args.data(), args.size()),
+      arena.copyArray(arg_types.data(), arg_types.size()), type(id),
+      is_extern);
+  auto float_mode = static_cast<FloatMode>(lists_[a_[id] + 2 * b_[id]]);
+  return arena.make<FunctionNode>(
+      declaration, is_extern ? nullptr : expandBody(c_[id], arena),
+      float_mode);
+}
+
+std::unique_ptr<Program> FlatAst::toProgram() const {
+  auto arena = std::make_unique<Arena>();
+  std::vector<FunctionNode *> functions;
+  for (NodeId function : functions_) {
+    functions.push_back(expandFunction(function, *arena));
+  }
+  auto function_array = arena->copyArray(functions.data(), functions.size());
+  return std::make_unique<Program>(std::move(arena), function_array);
+}
@@ -0,0 +1,121 @@
+#pragma once
+
+#include "parser.h"
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <string_view>
+#include <vector>
+
+using NodeId = uint32_t;
+constexpr NodeId kNoNode = UINT32_MAX;
+
+enum FlatNodeKind : uint8_t {
+  flat_function,
+  flat_body,
+  flat_conditional,
+  flat_while,
+  flat_for,
+  flat_definition,
+  flat_store,
+  flat_return,
+  flat_binary,
+  flat_number,
+  flat_identifier,
+  flat_call,
+  flat_index,
+};
+
+// The AST as a struct of arrays indexed by 32 bit node ids. Nodes are stored
+// in post order, so children always come before their parents and all the
+// nodes of a function sit in one contiguous range that ends with the
+// function node itself. Passes over the whole program are then linear scans.
+//
+// What the a/b/c/payload columns hold depends on the kind:
+//   function     payload: name, a: first arg in lists, b: arg count, c: body
+//                or kNoNode for extern functions, the arg names are followed
+//                by the arg types and the FloatMode in lists
+//   body         a: first block in lists, b: block count
+//   conditional  payload: branch hint, a: condition, b: if body, c: else body
+//                or kNoNode
+//   while        payload: loop hints, a: condition, b: body
+//   for          payload: loop hints, a: variable name, b: first of start,
+//                end and step in lists, c: body
+//   definition   payload: name, a: rhs
+//   store        payload: slice name, a: index, b: value
+//   return       a: expr
+//   binary       payload: operator, a: lhs, b: rhs
+//   number       payload: index into the number table
+//   identifier   payload: name
+//   call         payload: name, a: first arg in lists, b: arg count, c: the
+//                CallKind
+//   index        payload: slice name, a: index
+// Names are ids into names(). Function arguments are stored in lists as name
+// ids, body blocks, call arguments and loop ranges as node ids. Loop hints
+// are packed with LoopHints::pack. The type column holds the type of
+// expressions and the return type of functions.
+class FlatAst {
+public:
+  static FlatAst fromProgram(const Program &program);
+
+  // Expands the flat form back into an arena allocated Program, so anything
+  // written against the Visitor interface (e.g. codegen) can consume it.
+  std::unique_ptr<Program> toProgram() const;
+
+  // Replaces every arithmetic expression whose operands are both literals
+  // with the resulting literal, computed in the expression's type. Integer
+  // division by zero is left to run.
+  void foldConstants();
+
+  // Marks the functions reachable through calls from any of the roots,
+  // indexed like functions().
+  std::vector<bool>
+  liveFunctions(const std::vector<std::string_view> &roots) const;
+  // Keeps only the functions reachable from the roots.
+  void removeDeadFunctions(const std::vector<std::string_view> &roots);
+
+  size_t size() const { return kinds_.size(); }
+  FlatNodeKind kind(NodeId id) const {
+    return static_cast<FlatNodeKind>(kinds_[id]);
+  }
+  uint32_t a(NodeId id) const { return a_[id]; }
+  uint32_t b(NodeId id) const { return b_[id]; }
+  uint32_t c(NodeId id) const { return c_[id]; }
+  uint32_t payload(NodeId id) const { return payload_[id]; }
+  ValueType type(NodeId id) const { return static_cast<ValueType>(types_[id]); }
+  uint32_t list(uint32_t idx) const { return lists_[idx]; }
+  double number(NodeId id) const { return numbers_[payload_[id]].value; }
+  const NumberLiteral &literal(NodeId id) const {
+    return numbers_[payload_[id]];
+  }
+  std::string_view name(NodeId id) const { return names_.get(payload_[id]); }
+
+  const std::vector<NodeId> &functions() const { return functions_; }
+  const IdentifierTable &names() const { return names_; }
+
+private:
+  friend class FlatAstBuilder;
+
+  NodeId add(FlatNodeKind kind, uint32_t payload = 0, uint32_t a = 0,
+             uint32_t b = 0, uint32_t c = 0, ValueType type = type_f64);
+  // the folded value of a binary node over two literals, if it has one
+  std::optional<NumberLiteral> foldBinary(NodeId id) const;
+
+  ExprNode *expandExpr(NodeId id, Arena &arena) const;
+  BodyNode *expandBody(NodeId id, Arena &arena) const;
+  FunctionNode *expandFunction(NodeId id, Arena &arena) const;
+
+  std::vector<uint8_t> kinds_;
+  std::vector<uint32_t> payload_;
+  std::vector<uint32_t> a_;
+  std::vector<uint32_t> b_;
+  std::vector<uint32_t> c_;
+  std::vector<uint8_t> types_;
+  std::vector<uint32_t> lists_;
+  std::vector<NumberLiteral> numbers_;
+  IdentifierTable names_;
+  // function node ids in source order, and the id of each function's first
+  // node
+  std::vector<NodeId> functions_;
+  std::vector<NodeId> function_begins_;
+};
@@ -0,0 +1,120 @@
+#include "frontend.h"
+
+#include <cctype>
+#include <exception>
+#include <thread>
+
+namespace {
+
+bool isIdentifierChar(char c) {
+  return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+         (c >= '0' && c <= '9');
+}
+
+bool inComment(std::string_view source, size_t pos) {
+  size_t line_start = source.rfind('\n', pos);
+  line_start = line_start == std::string_view::npos ? 0 : line_start + 1;
+  return source.substr(line_start, pos - line_start).find('#') !=
+         std::string_view::npos;
+}
+
+// A def can only start a function, so any def keyword outside a comment is a
+// top-level boundary. Comments run to the end of the line, which makes the
+// check local: only the current line has to be looked at.
+bool isFunctionStart(std::string_view source, size_t pos) {
+  if (pos > 0 && isIdentifierChar(source[pos - 1])) {
+    return false;
+  }
+  size_t end = pos + 3;
+  if (end < source.size() && isIdentifierChar(source[end])) {
+    return false;
+  }
+  return !inComment(source, pos);
+}
+
+// the def itself, or the extern in front of it
+size_t declarationStart(std::string_view source, size_t def) {
+  constexpr std::string_view kExtern = "extern";
+  size_t pos = def;
+  while (pos > 0 && std::isspace(static_cast<unsigned char>(source[pos - 1]))) {
+    pos--;
+  }
+  if (pos < kExtern.size() ||
+      source.substr(pos - kExtern.size(), kExtern.size()) != kExtern) {
+    return def;
+  }
+  pos -= kExtern.size();
+  if ((pos > 0 && isIdentifierChar(source[pos - 1])) ||
+      inComment(source, pos)) {
+    return def;
+  }
+  return pos;
+}
+
+// the start of the first declaration at or after pos
+size_t nextFunctionStart(std::string_view source, size_t pos) {
+  size_t def = pos;
+  while ((def = source.find("def", def)) != std::string_view::npos) {
+    if (isFunctionStart(source, def)) {
+      size_t start = declarationStart(source, def);
+      if (start >= pos) {
+        return start;
+      }
+    }
+    def++;
+  }
+  return source.size();
+}
+
+} // namespace
+
+std::vector<std::string_view> splitAtFunctions(std::string_view source,
+                                               size_t parts) {
+  std::vector<std::string_view> slices;
+  size_t begin = 0;
+  for (size_t i = 1; i < parts && begin < source.size(); i++) {
+    size_t target = source.size() / parts * i;
+    size_t cut = nextFunctionStart(source, target > begin ? target : begin);
+    if (cut == begin) {
+      // the slice would be empty, look for the def after this one
+      cut = nextFunctionStart(source, begin + 1);
+    }
+    if (cut >= source.size()) {
+      break;
+    }
+    slices.push_back(source.substr(begin, cut - begin));
+    begin = cut;
+  }
+  slices.push_back(source.substr(begin));
+  return slices;
+}
+
+std::unique_ptr<Program> parseParallel(std::string_view source,
+                                       unsigned threads) {
+  auto slices = splitAtFunctions(source, threads);
+  std::vector<std::unique_ptr<Program>> programs(slices.size());
+  // scanner errors are thrown on the workers and rethrown here
+  std::vector<std::exception_ptr> errors(slices.size());
+
+  std::vector<std::thread> workers;
+  for (size_t i = 0; i < slices.size(); i++) {
+    workers.emplace_back([&, i] {
+      try {
+        Scanner scanner(slices[i]);
+        Parser parser(scanner);
+        programs[i] = parser.parse();
+      } catch (...) {
+        errors[i] = std::current_exception();
+      }
+    });
+  }
+  for (auto &worker : workers) {
+    worker.join();
+  }
+  for (auto &error : errors) {
+    if (error) {
+      std::rethrow_exception(error);
+    }
+  }
+  return Program::merge(std::move(programs));
+}
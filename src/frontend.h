@@ -0,0 +1,18 @@
+#pragma once
+
+#include "parser.h"
+
+#include <memory>
+#include <string_view>
+#include <vector>
+
+// Cuts the source into at most `parts` contiguous slices of roughly equal
+// size. Every slice but the first starts at a top-level def or extern def,
+// so the slices can be scanned and parsed independently.
+std::vector<std::string_view> splitAtFunctions(std::string_view source,
+                                               size_t parts);
+
+// Scans and parses the source on `threads` worker threads, one slice each,
+// and merges the functions back into a single program in source order.
+std::unique_ptr<Program> parseParallel(std::string_view source,
+                                       unsigned threads);
@@ -0,0 +1,201 @@
+#include "interpreter.h"
+#include "native.h"
+#include "numeric.h"
+
+#include <iostream>
+
+double Interpreter::run(const FunctionNode *function,
+                        const std::vector<double> &args) {
+  const auto &names = function->getFunctionDeclaration()->getArgs();
+  if (names.size() != args.size()) {
+    std::cout << function->getFunctionDeclaration()->getName() << " takes "
+              << names.size() << " arguments, got " << args.size()
+              << std::endl;
+    exit(1);
+  }
+  // converting is a no-op for values that already have the argument's type,
+  // like those of calls from other functions
+  const auto *declaration = function->getFunctionDeclaration();
+  if (function->isExtern()) {
+    // without generated code in between, only C functions on doubles can be
+    // called
+    void *native = declaration->isTyped()
+                       ? nullptr
+                       : findNativeFunction(declaration->getName());
+    if (!native || args.size() > kMaxNativeArgs) {
+      std::cout << declaration->getName()
+                << " is an extern function only compiled code can call"
+                << std::endl;
+      exit(1);
+    }
+    return callNative(native, args.data(), args.size());
+  }
+  if (declaration->takesSlices()) {
+    std::cout << declaration->getName()
+              << " takes slices, which only compiled code can pass"
+              << std::endl;
+    exit(1);
+  }
+  Frame frame;
+  for (size_t i = 0; i < args.size(); i++) {
+    frame.emplace_back(names[i], convertValue(args[i], type_f64,
+                                              declaration->getArgType(i)));
+  }
+  const FunctionNode *caller = function_;
+  uint32_t caller_back_edges = back_edges_;
+  function_ = function;
+  back_edges_ = 0;
+  double result = 0;
+  execute(function->getBody(), frame, result);
+  function_ = caller;
+  back_edges_ = caller_back_edges;
+  return result;
+}
+
+void Interpreter::countBackEdge() {
+  if (back_edge_ && ++back_edges_ == kBackEdgeBatch) {
+    back_edges_ = 0;
+    back_edge_(function_, kBackEdgeBatch);
+  }
+}
+
+double &Interpreter::slot(Frame &frame, std::string_view name) {
+  for (auto &[variable, value] : frame) {
+    if (variable == name) {
+      return value;
+    }
+  }
+  return frame.emplace_back(name, 0).second;
+}
+
+double Interpreter::evaluate(const ExprNode *expr, Frame &frame) {
+  switch (expr->getExprNodeType()) {
+  case ExprNode::BinaryExprNode: {
+    const auto *binary = static_cast<const BinaryExprNode *>(expr);
+    double lhs = evaluate(binary->getLHS(), frame);
+    double rhs = evaluate(binary->getRHS(), frame);
+    ValueType type = binary->getLHS()->getType();
+    switch (binary->getOperator()) {
+    case tok_add:
+    case tok_sub:
+    case tok_mul:
+    case tok_div:
+    case tok_mod:
+      if (isIntegerType(type) && rhs == 0 &&
+          (binary->getOperator() == tok_div ||
+           binary->getOperator() == tok_mod)) {
+        std::cout << "Integer division by zero" << std::endl;
+        exit(1);
+      }
+      return typedArithmetic(binary->getOperator(), lhs, rhs, type);
+    case tok_lt:
+      return lhs < rhs;
+    case tok_lte:
+      return lhs <= rhs;
+    case tok_gt:
+      return lhs > rhs;
+    case tok_gte:
+      return lhs >= rhs;
+    default:
+      std::cout << "Unknown operator when interpreting binary expr"
+                << std::endl;
+      exit(1);
+    }
+  }
+  case ExprNode::NumberLiteralNode:
+    return literalValue(
+        static_cast<const NumberLiteralNode *>(expr)->getLiteral(),
+        expr->getType());
+  case ExprNode::IdentifierExprNode: {
+    auto name = static_cast<const IdentifierExprNode *>(expr)->getName();
+    for (const auto &[variable, value] : frame) {
+      if (variable == name) {
+        return value;
+      }
+    }
+    std::cout << "did not find identifier " << name << std::endl;
+    exit(1);
+  }
+  case ExprNode::FunctionCallExprNode: {
+    const auto *call = static_cast<const FunctionCallExprNode *>(expr);
+    if (call->isConversion()) {
+      const auto *arg = call->getArgs()[0];
+      return convertValue(evaluate(arg, frame), arg->getType(),
+                          call->getType());
+    }
+    std::vector<double> args;
+    args.reserve(call->getArgs().size());
+    for (const auto *arg : call->getArgs()) {
+      args.push_back(evaluate(arg, frame));
+    }
+    return call_(call->getName(), args);
+  }
+  case ExprNode::IndexExprNode:
+    // only functions taking slices index, and run() rejects those
+    break;
+  }
+  return 0;
+}
+
+bool Interpreter::execute(const BodyNode *body, Frame &frame,
+                          double &result) {
+  for (const auto *block : body->getBlocks()) {
+    switch (block->getBodyNodeType()) {
+    case BodySubNode::ConditionalNode: {
+      const auto *conditional = static_cast<const ConditionalNode *>(block);
+      if (evaluate(conditional->getIfExpr(), frame) != 0) {
+        if (execute(conditional->getIfBody(), frame, result)) {
+          return true;
+        }
+      } else if (conditional->getElseBody()) {
+        if (execute(conditional->getElseBody(), frame, result)) {
+          return true;
+        }
+      }
+      break;
+    }
+    case BodySubNode::WhileNode: {
+      const auto *loop = static_cast<const WhileNode *>(block);
+      while (evaluate(loop->getCondition(), frame) != 0) {
+        if (execute(loop->getBody(), frame, result)) {
+          return true;
+        }
+        countBackEdge();
+      }
+      break;
+    }
+    case BodySubNode::ForNode: {
+      const auto *loop = static_cast<const ForNode *>(block);
+      double start = evaluate(loop->getStart(), frame);
+      slot(frame, loop->getVariable()) = start;
+      double end = evaluate(loop->getEnd(), frame);
+      double step = evaluate(loop->getStep(), frame);
+      ValueType type = loop->getStart()->getType();
+      // the body may assign the variable, and may declare variables that
+      // move it around in the frame
+      while (slot(frame, loop->getVariable()) < end) {
+        if (execute(loop->getBody(), frame, result)) {
+          return true;
+        }
+        double &variable = slot(frame, loop->getVariable());
+        variable = typedArithmetic(tok_add, variable, step, type);
+        countBackEdge();
+      }
+      break;
+    }
+    case BodySubNode::ReturnStatementNode:
+      result =
+          evaluate(static_cast<const ReturnNode *>(block)->getExpr(), frame);
+      return true;
+    case BodySubNode::DefinitionNode: {
+      const auto *definition = static_cast<const DefinitionNode *>(block);
+      double value = evaluate(definition->getRHS(), frame);
+      slot(frame, definition->getLValue()) = value;
+      break;
+    }
+    case BodySubNode::StoreNode:
+      break;
+    }
+  }
+  return false;
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include "parser.h"
+
+#include <cstdint>
+#include <functional>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+// Tree walking interpreter over the arena AST, used as the first execution
+// tier: it starts running right away where compiling through LLVM would take
+// tens of milliseconds. Values are doubles, comparisons yield 1 or 0 and any
+// non-zero condition is true. A function that falls off its end returns 0.
+// Integer and f32 values are held in doubles too, see numeric.h.
+class Interpreter {
+public:
+  // calls to slice functions go through `call`, so the caller decides which
+  // tier runs the callee
+  using CallHandler = std::function<double(std::string_view name,
+                                           const std::vector<double> &args)>;
+  // told about the loop iterations of a function while it runs, in batches
+  // of kBackEdgeBatch, so a caller can tell a single long running call is hot
+  using BackEdgeHandler =
+      std::function<void(const FunctionNode *function, uint32_t count)>;
+  static constexpr uint32_t kBackEdgeBatch = 256;
+
+  explicit Interpreter(CallHandler call, BackEdgeHandler back_edge = {})
+      : call_(std::move(call)), back_edge_(std::move(back_edge)) {}
+
+  double run(const FunctionNode *function, const std::vector<double> &args);
+
+private:
+  // variables of the running function, looked up by name. functions are
+  // small, so a linear scan beats hashing.
+  using Frame = std::vector<std::pair<std::string_view, double>>;
+
+  // the variable's value, a new variable is added to the frame
+  static double &slot(Frame &frame, std::string_view name);
+  double evaluate(const ExprNode *expr, Frame &frame);
+  // returns true once a return statement has been executed
+  bool execute(const BodyNode *body, Frame &frame, double &result);
+  void countBackEdge();
+
+  CallHandler call_;
+  BackEdgeHandler back_edge_;
+  // the running function, and its loop iterations not reported yet
+  const FunctionNode *function_ = nullptr;
+  uint32_t back_edges_ = 0;
+};
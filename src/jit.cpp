@@ -0,0 +1,236 @@
+#include "jit.h"
+#include "codegen.h"
+#include "native.h"
+#include "llvm/Config/llvm-config.h"
+#include "llvm/ExecutionEngine/Orc/CompileUtils.h"
+#include "llvm/ExecutionEngine/Orc/ExecutionUtils.h"
+#include "llvm/Support/TargetSelect.h"
+#include <iostream>
+
+namespace {
+
+template <typename T> T exitOnError(llvm::Expected<T> value) {
+  if (!value) {
+    std::cout << "JIT error: " << llvm::toString(value.takeError())
+              << std::endl;
+    exit(1);
+  }
+  return std::move(*value);
+}
+
+void exitOnError(llvm::Error err) {
+  if (err) {
+    std::cout << "JIT error: " << llvm::toString(std::move(err)) << std::endl;
+    exit(1);
+  }
+}
+
+#if LLVM_VERSION_MAJOR >= 15
+void *toPointer(llvm::orc::ExecutorAddr symbol) {
+  return symbol.toPtr<void *>();
+}
+#else
+void *toPointer(llvm::JITEvaluatedSymbol symbol) {
+  return reinterpret_cast<void *>(symbol.getAddress());
+}
+#endif
+
+// the symbols codegen defines for the function
+std::vector<std::string> entryPoints(const FunctionNode *function) {
+  const auto *declaration = function->getFunctionDeclaration();
+  std::string name(declaration->getName());
+  bool boxed = declaration->isTyped() && !declaration->takesSlices();
+  if (function->isExtern()) {
+    // the C function itself comes from the process
+    if (boxed) {
+      return {boxedName(name)};
+    }
+    return {};
+  }
+  if (boxed) {
+    return {name, boxedName(name)};
+  }
+  return {name};
+}
+
+void lazyCallFailed() {
+  std::cout << "JIT error: lazily compiled function could not be materialized"
+            << std::endl;
+  exit(1);
+}
+
+// Defines a single slice function, which is generated from its AST only when
+// the symbol is first looked up.
+class FunctionMaterializationUnit : public llvm::orc::MaterializationUnit {
+public:
+  FunctionMaterializationUnit(llvm::orc::LLJIT &jit, FunctionNode *function,
+                              CompileCache *cache,
+                              const CodegenOptions &options,
+                              std::atomic<size_t> &compiled)
+      : MaterializationUnit(interface(jit, function)), jit_(jit),
+        function_(function), cache_(cache), options_(options),
+        compiled_(compiled) {}
+
+  llvm::StringRef getName() const override {
+    return "FunctionMaterializationUnit";
+  }
+
+  void materialize(std::unique_ptr<llvm::orc::MaterializationResponsibility>
+                       responsibility) override {
+    std::string key;
+    if (cache_) {
+      key = cache_->key({CompileCache::hashFunction(function_)});
+      if (auto object = cache_->lookup(key, "o")) {
+        jit_.getObjLinkingLayer().emit(std::move(responsibility),
+                                       std::move(object));
+        return;
+      }
+    }
+    CodegenVisitor visitor(options_);
+    function_->accept(&visitor);
+    visitor.optimize();
+    if (cache_) {
+      visitor.setModuleIdentifier(key);
+    }
+    compiled_++;
+    jit_.getIRCompileLayer().emit(std::move(responsibility),
+                                  visitor.takeModule());
+  }
+
+private:
+  static Interface interface(llvm::orc::LLJIT &jit, FunctionNode *function) {
+    llvm::orc::SymbolFlagsMap symbols;
+    for (const auto &name : entryPoints(function)) {
+      symbols[jit.mangleAndIntern(name)] =
+          llvm::JITSymbolFlags::Exported | llvm::JITSymbolFlags::Callable;
+    }
+    return Interface(std::move(symbols), nullptr);
+  }
+
+  void discard(const llvm::orc::JITDylib &dylib,
+               const llvm::orc::SymbolStringPtr &name) override {}
+
+  llvm::orc::LLJIT &jit_;
+  FunctionNode *function_;
+  CompileCache *cache_;
+  const CodegenOptions &options_;
+  std::atomic<size_t> &compiled_;
+};
+
+} // namespace
+
+JIT::JIT(CompileCache *cache, const CodegenOptions &options)
+    : cache_(cache), options_(options) {
+  llvm::InitializeNativeTarget();
+  llvm::InitializeNativeTargetAsmPrinter();
+  llvm::InitializeNativeTargetAsmParser();
+
+  llvm::orc::LLJITBuilder builder;
+  // the default compiler shares one TargetMachine, but lazy functions may be
+  // compiled from several threads at once, e.g. by the tiered engine's
+  // background thread while native code calls a stub. with a cache, the
+  // compile layer also stores objects for modules named after a cache key.
+  builder.setCompileFunctionCreator(
+      [cache](llvm::orc::JITTargetMachineBuilder target_machine_builder)
+          -> llvm::Expected<
+              std::unique_ptr<llvm::orc::IRCompileLayer::IRCompiler>> {
+        return std::make_unique<llvm::orc::ConcurrentIRCompiler>(
+            std::move(target_machine_builder), cache);
+      });
+  jit_ = exitOnError(builder.create());
+
+  // let slice code resolve symbols from the host process (e.g. libm)
+  char prefix = jit_->getDataLayout().getGlobalPrefix();
+  jit_->getMainJITDylib().addGenerator(exitOnError(
+      llvm::orc::DynamicLibrarySearchGenerator::GetForCurrentProcess(prefix)));
+}
+
+void JIT::addModule(llvm::orc::ThreadSafeModule module) {
+  exitOnError(jit_->addIRModule(std::move(module)));
+}
+
+void JIT::addObject(std::unique_ptr<llvm::MemoryBuffer> object) {
+  exitOnError(jit_->addObjectFile(std::move(object)));
+}
+
+void JIT::setUpLazyCompilation() {
+  const auto &triple = jit_->getTargetTriple();
+#if LLVM_VERSION_MAJOR >= 17
+  auto error_handler = llvm::orc::ExecutorAddr::fromPtr(&lazyCallFailed);
+#else
+  auto error_handler = llvm::pointerToJITTargetAddress(&lazyCallFailed);
+#endif
+  call_through_ = exitOnError(llvm::orc::createLocalLazyCallThroughManager(
+      triple, jit_->getExecutionSession(), error_handler));
+  stubs_ = llvm::orc::createLocalIndirectStubsManagerBuilder(triple)();
+  auto lazy_dylib = jit_->createJITDylib("lazy");
+  if (!lazy_dylib) {
+    exitOnError(lazy_dylib.takeError());
+  }
+  lazy_dylib_ = &*lazy_dylib;
+  // the generated code may call back into the process, and into the other
+  // lazy functions through their stubs
+  lazy_dylib_->addToLinkOrder(jit_->getMainJITDylib());
+}
+
+void JIT::addLazyProgram(std::unique_ptr<Program> program) {
+  if (!lazy_dylib_) {
+    setUpLazyCompilation();
+  }
+  llvm::orc::SymbolAliasMap stubs;
+  for (auto *function : program->getFunctions()) {
+    if (entryPoints(function).empty()) {
+      continue;
+    }
+    exitOnError(
+        lazy_dylib_->define(std::make_unique<FunctionMaterializationUnit>(
+            *jit_, function, cache_, options_, compiled_functions_)));
+    for (const auto &name : entryPoints(function)) {
+      auto symbol = jit_->mangleAndIntern(name);
+      stubs[symbol] = llvm::orc::SymbolAliasMapEntry(
+          symbol,
+          llvm::JITSymbolFlags::Exported | llvm::JITSymbolFlags::Callable);
+    }
+  }
+  exitOnError(jit_->getMainJITDylib().define(llvm::orc::lazyReexports(
+      *call_through_, *stubs_, *lazy_dylib_, std::move(stubs))));
+  lazy_programs_.push_back(std::move(program));
+}
+
+void *JIT::lookup(const std::string &name) {
+  return toPointer(exitOnError(jit_->lookup(name)));
+}
+
+void *JIT::compile(const std::string &name) {
+  if (!lazy_dylib_) {
+    std::cout << "JIT error: " << name << " wasn't added lazily" << std::endl;
+    exit(1);
+  }
+  // the main dylib only holds the stub, the body lives in the lazy dylib
+  auto boxed = jit_->lookup(*lazy_dylib_, boxedName(name));
+  if (boxed) {
+    return toPointer(*boxed);
+  }
+  llvm::consumeError(boxed.takeError());
+  auto body = jit_->lookup(*lazy_dylib_, name);
+  if (body) {
+    return toPointer(*body);
+  }
+  // untyped extern functions are called directly, nothing is generated
+  llvm::consumeError(body.takeError());
+  return lookup(name);
+}
+
+double JIT::call(const std::string &name, const std::vector<double> &args) {
+  // functions with a typed signature are called through their all f64 entry
+  auto boxed = jit_->lookup(boxedName(name));
+  if (boxed) {
+    return callAddress(toPointer(*boxed), args);
+  }
+  llvm::consumeError(boxed.takeError());
+  return callAddress(lookup(name), args);
+}
+
+double JIT::callAddress(void *fn, const std::vector<double> &args) {
+  return callNative(fn, args.data(), args.size());
+}
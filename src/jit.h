@@ -0,0 +1,60 @@
+#pragma once
+
+#include "cache.h"
+#include "codegen.h"
+#include "parser.h"
+#include "llvm/ExecutionEngine/Orc/IndirectionUtils.h"
+#include "llvm/ExecutionEngine/Orc/LLJIT.h"
+#include "llvm/ExecutionEngine/Orc/LazyReexports.h"
+#include "llvm/ExecutionEngine/Orc/ThreadSafeModule.h"
+#include <atomic>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Thin wrapper around an ORC LLJIT instance. Modules produced by the
+// CodegenVisitor are added to the main dylib and their functions can be
+// called in-process, without going through llc and a linker.
+class JIT {
+public:
+  // with a cache, lazily compiled functions are looked up in and added to it.
+  // they're generated with the options, which the cache's key should describe.
+  explicit JIT(CompileCache *cache = nullptr,
+               const CodegenOptions &options = {});
+
+  void addModule(llvm::orc::ThreadSafeModule module);
+  void addObject(std::unique_ptr<llvm::MemoryBuffer> object);
+  // Registers every function of the program behind a lazy call-through stub.
+  // A function is only lowered, optimized and compiled from its AST the
+  // first time it's called, functions that never run never reach LLVM. The
+  // JIT keeps the program alive.
+  void addLazyProgram(std::unique_ptr<Program> program);
+  // how many lazily added functions have been compiled so far
+  size_t compiledFunctions() const { return compiled_functions_; }
+  void *lookup(const std::string &name);
+
+  // calls a slice function with doubles, going through the all f64 entry of
+  // functions with a typed signature
+  double call(const std::string &name, const std::vector<double> &args);
+  // same, for a function whose address was already looked up. the function
+  // has to take and return doubles.
+  static double callAddress(void *fn, const std::vector<double> &args);
+  // compiles a lazily added function now rather than on its first call, and
+  // returns the address of its body, or of its all f64 entry if it has one.
+  // untyped extern functions resolve to the C function itself.
+  void *compile(const std::string &name);
+
+private:
+  void setUpLazyCompilation();
+
+  std::unique_ptr<llvm::orc::LLJIT> jit_;
+  CompileCache *cache_;
+  CodegenOptions options_;
+  // lazy functions are defined in lazy_dylib_ and re-exported into the main
+  // dylib through stubs
+  llvm::orc::JITDylib *lazy_dylib_ = nullptr;
+  std::unique_ptr<llvm::orc::LazyCallThroughManager> call_through_;
+  std::unique_ptr<llvm::orc::IndirectStubsManager> stubs_;
+  std::vector<std::unique_ptr<Program>> lazy_programs_;
+  std::atomic<size_t> compiled_functions_{0};
+};
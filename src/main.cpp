@@ -1,36 +1,292 @@
-#include <fstream>
 #include <iostream>
-#include <sstream>
 #include <string>
 
+#include "ast_file.h"
+#include "bytecode.h"
+#include "cache.h"
 #include "codegen.h"
+#include "flat_ast.h"
+#include "frontend.h"
+#include "jit.h"
+#include "parallel_codegen.h"
 #include "parser.h"
 #include "scanner.h"
+#include "source.h"
+#include "tiered.h"
+#include "types.h"
+#include "vm.h"
+#include "llvm/Support/DynamicLibrary.h"
 
-std::string readFile(std::string filepath) {
-  std::ifstream f(filepath);
-  std::stringstream ss;
-  ss << f.rdbuf();
-  return ss.str();
+const FunctionDeclarationNode *findFunction(const Program *program,
+                                            const std::string &name) {
+  for (const auto &function : program->getFunctions()) {
+    if (function->getFunctionDeclaration()->getName() == name) {
+      return function->getFunctionDeclaration();
+    }
+  }
+  return nullptr;
+}
+
+// the shared library the JIT has to load for the functions of the vector
+// library, or nullptr if it can't be loaded on this platform
+const char *
+vectorLibraryPath(llvm::TargetLibraryInfoImpl::VectorLibrary library) {
+  switch (library) {
+  case llvm::TargetLibraryInfoImpl::LIBMVEC_X86:
+    return "libmvec.so.1";
+  case llvm::TargetLibraryInfoImpl::SVML:
+    return "libsvml.so";
+  default:
+    return nullptr;
+  }
 }
 
+// usage:
+//   lang [--emit=ll|bc|obj|so|ast] [-o <output>] [--header <output.h>]
+//        [-j <threads>] [--cache-dir <dir>] [--no-batch]
+//        [--vector-library=<name>] [-ffast-math|-ffp-contract=on|off]
+//        <file>
+//   lang --jit <function> [--lazy|--tiered|--vm] [-j <threads>]
+//        [--cache-dir <dir>] [--vector-library=<name>]
+//        [-ffast-math|-ffp-contract=on|off] <file> [args...]
+// -j runs the front end and the backend on that many threads, --lazy compiles
+// each function the first time it's called, --tiered interprets functions
+// until they get hot and --vm runs bytecode without touching LLVM.
+// --cache-dir reuses the objects of unchanged functions from earlier runs.
+// --emit=ast saves the parsed program, which can be passed back in place of
+// the source to skip scanning and parsing. Compiled output has a name_batch
+// entry point for every function, unless --no-batch leaves them out to save
+// compile time. --vector-library lets loops calling extern math functions be
+// vectorized with that library's SIMD versions, see vectorLibraryFromName.
+// Output compiled with it has to be linked against the library.
+// -ffast-math and -ffp-contract=on set the float mode of every def without
+// one of its own to fastmath or contract, the last of them wins.
 int main(int argc, char **argv) {
-  if (argc < 2) {
+  std::string filepath;
+  std::string jit_entry;
+  std::vector<double> jit_args;
+  std::string emit = "ll";
+  std::string output;
+  std::string header;
+  std::string cache_dir;
+  unsigned threads = 1;
+  bool lazy = false;
+  bool tiered = false;
+  bool vm = false;
+  CodegenOptions options;
+  options.batch_entries = true;
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    if (arg == "--jit" || arg == "-o" || arg == "--header" || arg == "-j" ||
+        arg == "--threads" || arg == "--cache-dir") {
+      if (i + 1 >= argc) {
+        throw std::runtime_error(arg + " requires an argument");
+      }
+      std::string value = argv[++i];
+      if (arg == "--jit") {
+        jit_entry = value;
+      } else if (arg == "-o") {
+        output = value;
+      } else if (arg == "-j" || arg == "--threads") {
+        threads = std::stoul(value);
+      } else if (arg == "--cache-dir") {
+        cache_dir = value;
+      } else {
+        header = value;
+      }
+    } else if (arg == "--lazy") {
+      lazy = true;
+    } else if (arg == "--tiered") {
+      tiered = true;
+    } else if (arg == "--vm") {
+      vm = true;
+    } else if (arg == "--no-batch") {
+      options.batch_entries = false;
+    } else if (arg.rfind("--vector-library=", 0) == 0) {
+      std::string name = arg.substr(std::string("--vector-library=").size());
+      auto library = vectorLibraryFromName(name);
+      if (!library) {
+        throw std::runtime_error("Unknown vector library " + name);
+      }
+      options.vector_library = *library;
+    } else if (arg == "-ffast-math") {
+      options.float_mode = float_fast;
+    } else if (arg == "-fno-fast-math" || arg == "-ffp-contract=off") {
+      options.float_mode = float_strict;
+    } else if (arg == "-ffp-contract=on" || arg == "-ffp-contract=fast") {
+      options.float_mode = float_contract;
+    } else if (arg.rfind("--emit=", 0) == 0) {
+      emit = arg.substr(std::string("--emit=").size());
+    } else if (filepath.empty()) {
+      filepath = arg;
+    } else {
+      jit_args.push_back(std::stod(arg));
+    }
+  }
+  if (filepath.empty()) {
     throw std::runtime_error("File to parse required");
   }
-  std::string filepath = argv[1];
-  std::string source = readFile(filepath);
+  if ((lazy || tiered || vm) && jit_entry.empty()) {
+    throw std::runtime_error("--lazy, --tiered and --vm require --jit");
+  }
+  if (!jit_entry.empty()) {
+    // nothing calls them from the command line
+    options.batch_entries = false;
+  }
+  if (!jit_entry.empty() && !vm &&
+      options.vector_library != llvm::TargetLibraryInfoImpl::NoLibrary) {
+    // the vectorized calls are resolved from the process
+    const char *path = vectorLibraryPath(options.vector_library);
+    std::string error;
+    if (!path ||
+        llvm::sys::DynamicLibrary::LoadLibraryPermanently(path, &error)) {
+      std::cout << "Could not load the vector library for --jit"
+                << (error.empty() ? "" : ": " + error) << std::endl;
+      return 1;
+    }
+  }
+  auto source = SourceFile::open(filepath);
+  bool serialized = isSerializedProgram(source->contents());
+  bool emit_ast = jit_entry.empty() && emit == "ast";
+
+  // textual and bitcode output need the IR of every function, so there's
+  // nothing to reuse from the cache for them
+  std::unique_ptr<CompileCache> cache;
+  if (!cache_dir.empty() && (emit == "obj" || emit == "so" ||
+                             !jit_entry.empty())) {
+    cache = std::make_unique<CompileCache>(cache_dir, options.describe());
+  }
+
+  std::unique_ptr<ParallelCodegen> codegen;
+  std::unique_ptr<Program> program;
+  if (threads <= 1 && jit_entry.empty() && !cache && !serialized &&
+      !emit_ast) {
+    // every function ends up in the output, so each one is generated as soon
+    // as it's parsed while the rest of the file is still being scanned
+    Scanner scanner(source->contents());
+    Parser parser(scanner);
+    auto visitor = std::make_unique<CodegenVisitor>(options);
+    TypeChecker checker;
+    while (FunctionNode *function = parser.parseFunction()) {
+      checker.check(function);
+      function->accept(visitor.get());
+    }
+    codegen = std::make_unique<ParallelCodegen>(std::move(visitor));
+  } else {
+    if (serialized) {
+      program = loadProgram(source->contents());
+    } else if (threads > 1) {
+      program = parseParallel(source->contents(), threads);
+    } else {
+      Scanner scanner(source->contents());
+      program = Parser(scanner).parse();
+    }
+    checkTypes(*program);
+    if (!jit_entry.empty()) {
+      FlatAst flat = FlatAst::fromProgram(*program);
+      flat.foldConstants();
+      // only what the entry point can reach needs to be compiled
+      flat.removeDeadFunctions({jit_entry});
+      program = flat.toProgram();
+    }
+    if (!lazy && !tiered && !vm && !emit_ast) {
+      codegen = std::make_unique<ParallelCodegen>(*program, threads,
+                                                  cache.get(), options);
+    }
+  }
 
-  Scanner scanner(source);
-  scanner.scanTokens();
+  if (!header.empty() && !codegen) {
+    std::cout
+        << "--header can't be combined with --lazy, --tiered, --vm or "
+           "--emit=ast"
+        << std::endl;
+    return 1;
+  }
+  if (!header.empty()) {
+    std::error_code ec;
+    llvm::raw_fd_ostream header_out(header, ec);
+    if (ec) {
+      std::cout << "Could not open " << header << ": " << ec.message()
+                << std::endl;
+      return 1;
+    }
+    codegen->writeHeader(header_out);
+  }
+
+  if (jit_entry.empty()) {
+    if (emit_ast && !output.empty()) {
+      std::error_code ec;
+      llvm::raw_fd_ostream out(output, ec);
+      if (ec) {
+        std::cout << "Could not open " << output << ": " << ec.message()
+                  << std::endl;
+        return 1;
+      }
+      out << serializeProgram(*program);
+      return 0;
+    }
+    if (emit == "ll" && output.empty()) {
+      codegen->linkPartitions().dump();
+    } else if (output.empty()) {
+      std::cout << "--emit=" << emit << " requires -o <output>" << std::endl;
+      return 1;
+    } else if (emit == "ll") {
+      std::error_code ec;
+      llvm::raw_fd_ostream out(output, ec);
+      if (ec) {
+        std::cout << "Could not open " << output << ": " << ec.message()
+                  << std::endl;
+        return 1;
+      }
+      codegen->linkPartitions().dump(out);
+    } else if (emit == "bc") {
+      codegen->linkPartitions().emitBitcode(output);
+    } else if (emit == "obj") {
+      codegen->emitObject(output);
+    } else if (emit == "so") {
+      codegen->emitSharedLibrary(output);
+    } else {
+      std::cout << "Unknown --emit kind " << emit << std::endl;
+      return 1;
+    }
+    return 0;
+  }
+
+  const auto *entry = findFunction(program.get(), jit_entry);
+  if (!entry) {
+    std::cout << "No function named " << jit_entry << std::endl;
+    return 1;
+  }
+  if (entry->takesSlices()) {
+    std::cout << jit_entry
+              << " takes slices, which can't be passed from the command line"
+              << std::endl;
+    return 1;
+  }
+  if (entry->getArgs().size() != jit_args.size()) {
+    std::cout << jit_entry << " takes " << entry->getArgs().size()
+              << " arguments, got " << jit_args.size() << std::endl;
+    return 1;
+  }
 
-  Parser parser(scanner.tokens());
-  std::unique_ptr<Program> program = parser.parse();
+  if (vm) {
+    BytecodeProgram bytecode = BytecodeCompiler::compile(*program);
+    std::cout << VM(bytecode).call(jit_entry, jit_args) << std::endl;
+    return 0;
+  }
+  if (tiered) {
+    TieredEngine engine(std::move(program), 1000, options);
+    std::cout << engine.call(jit_entry, jit_args) << std::endl;
+    return 0;
+  }
 
-  CodegenVisitor visitor;
-  visitor.visitProgramNode(program.get());
-  visitor.optimize();
-  visitor.dump();
+  JIT jit(cache.get(), options);
+  if (lazy) {
+    jit.addLazyProgram(std::move(program));
+  } else {
+    codegen->addToJIT(jit);
+  }
+  std::cout << jit.call(jit_entry, jit_args) << std::endl;
 
   return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,30 @@
+#include "native.h"
+
+#include <dlfcn.h>
+#include <iostream>
+#include <string>
+
+void *findNativeFunction(std::string_view name) {
+  return dlsym(RTLD_DEFAULT, std::string(name).c_str());
+}
+
+double callNative(void *fn, const double *args, size_t count) {
+  switch (count) {
+  case 0:
+    return reinterpret_cast<double (*)()>(fn)();
+  case 1:
+    return reinterpret_cast<double (*)(double)>(fn)(args[0]);
+  case 2:
+    return reinterpret_cast<double (*)(double, double)>(fn)(args[0], args[1]);
+  case 3:
+    return reinterpret_cast<double (*)(double, double, double)>(fn)(
+        args[0], args[1], args[2]);
+  case 4:
+    return reinterpret_cast<double (*)(double, double, double, double)>(fn)(
+        args[0], args[1], args[2], args[3]);
+  default:
+    std::cout << "Native functions can only be called with up to "
+              << kMaxNativeArgs << " arguments, got " << count << std::endl;
+    exit(1);
+  }
+}
@@ -0,0 +1,17 @@
+#pragma once
+
+#include <cstddef>
+#include <string_view>
+
+// Calls C functions with doubles, for the tiers that don't compile the
+// caller: extern functions called from the interpreter and the VM, and
+// compiled functions called through their all f64 entry. Without generated
+// code in between nothing converts the arguments, so the function has to
+// take up to kMaxNativeArgs doubles and return a double.
+constexpr size_t kMaxNativeArgs = 4;
+
+// the function of that name in the running process or a library it loaded,
+// or nullptr
+void *findNativeFunction(std::string_view name);
+// calls fn with count doubles
+double callNative(void *fn, const double *args, size_t count);
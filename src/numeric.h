@@ -0,0 +1,139 @@
+#pragma once
+
+#include "parser.h"
+#include "scanner.h"
+
+#include <cmath>
+#include <cstdint>
+#include <iostream>
+#include <limits>
+
+// The interpreter and the VM hold every value in a double, whatever its type.
+// Integer operations are done on 64 bit integers and stored back, which is
+// exact for i32 and for i64 values of up to 2^53. An i64 value past that
+// stops the program rather than being rounded. f32 values are rounded to
+// float after every operation, which gives the same result as computing in
+// float.
+
+constexpr int64_t kMaxExactInteger = int64_t(1) << 53;
+
+// float to integer conversion that saturates and turns NaN into 0, like the
+// code generated for i64(x) and i32(x)
+template <typename T> T saturatingCast(double value) {
+  if (std::isnan(value)) {
+    return 0;
+  }
+  if (value <= static_cast<double>(std::numeric_limits<T>::min())) {
+    return std::numeric_limits<T>::min();
+  }
+  if (value >= static_cast<double>(std::numeric_limits<T>::max())) {
+    return std::numeric_limits<T>::max();
+  }
+  return static_cast<T>(value);
+}
+
+// the i64 value as a double, if the double holds it exactly
+inline double holdInteger(int64_t value) {
+  if (value > kMaxExactInteger || value < -kMaxExactInteger) {
+    std::cout << "i64 value " << value
+              << " is past 2^53, only compiled code holds it exactly, run "
+                 "with --jit and without --tiered or --vm"
+              << std::endl;
+    exit(1);
+  }
+  return static_cast<double>(value);
+}
+
+// wraps around on overflow. the caller has to rule out division by zero.
+inline int64_t integerArithmetic(TokenType op, int64_t lhs, int64_t rhs) {
+  auto a = static_cast<uint64_t>(lhs);
+  auto b = static_cast<uint64_t>(rhs);
+  switch (op) {
+  case tok_add:
+    return a + b;
+  case tok_sub:
+    return a - b;
+  case tok_mul:
+    return a * b;
+  case tok_div:
+    // the one quotient that doesn't fit wraps around to itself
+    return rhs == -1 ? 0 - a : lhs / rhs;
+  case tok_mod:
+    return rhs == -1 ? 0 : lhs % rhs;
+  default:
+    return 0;
+  }
+}
+
+// the same on integer values held in doubles. only products of i32 values
+// can leave the exact range, they're wrapped by multiplyI32 instead.
+inline double integerArithmetic(TokenType op, double lhs, double rhs) {
+  return holdInteger(integerArithmetic(op, saturatingCast<int64_t>(lhs),
+                                       saturatingCast<int64_t>(rhs)));
+}
+
+inline double multiplyI32(double lhs, double rhs) {
+  return static_cast<int32_t>(
+      integerArithmetic(tok_mul, saturatingCast<int64_t>(lhs),
+                        saturatingCast<int64_t>(rhs)));
+}
+
+inline double floatArithmetic(TokenType op, double lhs, double rhs) {
+  switch (op) {
+  case tok_add:
+    return lhs + rhs;
+  case tok_sub:
+    return lhs - rhs;
+  case tok_mul:
+    return lhs * rhs;
+  case tok_div:
+    return lhs / rhs;
+  case tok_mod:
+    return std::fmod(lhs, rhs);
+  default:
+    return 0;
+  }
+}
+
+// the value rounded or wrapped into the type
+inline double roundToType(double value, ValueType type) {
+  switch (type) {
+  case type_f32:
+    return static_cast<float>(value);
+  case type_i32:
+    return static_cast<int32_t>(saturatingCast<int64_t>(value));
+  default:
+    return value;
+  }
+}
+
+// an arithmetic operation on two values of the type
+inline double typedArithmetic(TokenType op, double lhs, double rhs,
+                              ValueType type) {
+  if (type == type_i32 && op == tok_mul) {
+    return multiplyI32(lhs, rhs);
+  }
+  if (isIntegerType(type)) {
+    return roundToType(integerArithmetic(op, lhs, rhs), type);
+  }
+  return roundToType(floatArithmetic(op, lhs, rhs), type);
+}
+
+inline double literalValue(const NumberLiteral &literal, ValueType type) {
+  if (type == type_i64) {
+    return holdInteger(literal.integer);
+  }
+  if (isIntegerType(type)) {
+    return roundToType(literal.integer, type);
+  }
+  return roundToType(literal.value, type);
+}
+
+// i64(x), i32(x), f32(x) and f64(x)
+inline double convertValue(double value, ValueType from, ValueType to) {
+  if (isIntegerType(to) && !isIntegerType(from)) {
+    return to == type_i32 ? saturatingCast<int32_t>(value)
+                          : holdInteger(saturatingCast<int64_t>(value));
+  }
+  return roundToType(value, to);
+}
@@ -0,0 +1,202 @@
+#include "parallel_codegen.h"
+#include "llvm/Support/FileSystem.h"
+
+#include <algorithm>
+#include <atomic>
+#include <iostream>
+#include <thread>
+
+namespace {
+
+// content defined partitions end after a function whose hash has these bits
+// clear, which makes them about 32 functions long
+constexpr uint64_t kPartitionMask = 31;
+constexpr size_t kMaxPartitionSize = 256;
+
+template <typename F> void runOnWorkers(size_t count, F work) {
+  std::vector<std::thread> workers;
+  for (size_t i = 0; i < count; i++) {
+    workers.emplace_back(work, i);
+  }
+  for (auto &worker : workers) {
+    worker.join();
+  }
+}
+
+void writeFile(const std::string &path, llvm::StringRef contents) {
+  std::error_code ec;
+  llvm::raw_fd_ostream out(path, ec, llvm::sys::fs::OF_None);
+  if (ec) {
+    std::cout << "Could not open " << path << ": " << ec.message()
+              << std::endl;
+    exit(1);
+  }
+  out << contents;
+}
+
+} // namespace
+
+ParallelCodegen::ParallelCodegen(const Program &program, unsigned threads,
+                                 CompileCache *cache,
+                                 const CodegenOptions &options) {
+  if (cache) {
+    compileCached(program, threads, *cache, options);
+    return;
+  }
+  const auto &functions = program.getFunctions();
+  size_t count = std::min<size_t>(threads, functions.size());
+  if (count == 0) {
+    count = 1;
+  }
+  partitions_.resize(count);
+  for (auto &partition : partitions_) {
+    partition.visitor = std::make_unique<CodegenVisitor>(options);
+  }
+  runOnWorkers(count, [&](size_t partition) {
+    size_t begin = functions.size() * partition / count;
+    size_t end = functions.size() * (partition + 1) / count;
+    CodegenVisitor &visitor = *partitions_[partition].visitor;
+    for (size_t i = begin; i < end; i++) {
+      functions[i]->accept(&visitor);
+    }
+    visitor.optimize();
+  });
+}
+
+ParallelCodegen::ParallelCodegen(std::unique_ptr<CodegenVisitor> visitor) {
+  visitor->optimize();
+  partitions_.emplace_back();
+  partitions_.back().visitor = std::move(visitor);
+}
+
+void ParallelCodegen::compileCached(const Program &program, unsigned threads,
+                                    CompileCache &cache,
+                                    const CodegenOptions &options) {
+  const auto &functions = program.getFunctions();
+  std::vector<uint64_t> hashes;
+  std::vector<size_t> begins = {0};
+  for (size_t i = 0; i < functions.size(); i++) {
+    hashes.push_back(CompileCache::hashFunction(functions[i]));
+    bool last = i + 1 == functions.size();
+    if (!last && ((hashes[i] & kPartitionMask) == 0 ||
+                  i + 1 - begins.back() >= kMaxPartitionSize)) {
+      begins.push_back(i + 1);
+    }
+  }
+  partitions_.resize(begins.size());
+
+  std::atomic<size_t> next_partition{0};
+  std::atomic<size_t> hits{0};
+  size_t workers =
+      std::max<size_t>(1, std::min<size_t>(threads, begins.size()));
+  runOnWorkers(workers, [&](size_t) {
+    size_t idx;
+    while ((idx = next_partition++) < partitions_.size()) {
+      size_t begin = begins[idx];
+      size_t end = idx + 1 < begins.size() ? begins[idx + 1] : functions.size();
+      std::string key = cache.key(
+          llvm::ArrayRef<uint64_t>(hashes.data() + begin, end - begin));
+      Partition &partition = partitions_[idx];
+
+      partition.object = cache.lookup(key, "o");
+      auto prototypes = cache.lookup(key, "h");
+      if (partition.object && prototypes) {
+        partition.prototypes = prototypes->getBuffer().str();
+        hits++;
+        continue;
+      }
+
+      CodegenVisitor visitor(options);
+      for (size_t i = begin; i < end; i++) {
+        functions[i]->accept(&visitor);
+      }
+      visitor.optimize();
+      partition.object = visitor.emitObjectToMemory();
+      llvm::raw_string_ostream prototypes_out(partition.prototypes);
+      visitor.writePrototypes(prototypes_out);
+      prototypes_out.flush();
+      cache.store(key, "o", partition.object->getBuffer());
+      cache.store(key, "h", partition.prototypes);
+    }
+  });
+  cache_hits_ = hits;
+}
+
+std::vector<std::string> ParallelCodegen::emitObjects() {
+  std::vector<std::string> objects;
+  for (size_t i = 0; i < partitions_.size(); i++) {
+    objects.push_back(createTemporaryObject());
+  }
+  runOnWorkers(partitions_.size(), [&](size_t idx) {
+    Partition &partition = partitions_[idx];
+    if (partition.object) {
+      writeFile(objects[idx], partition.object->getBuffer());
+    } else {
+      partition.visitor->emitObject(objects[idx]);
+    }
+  });
+  return objects;
+}
+
+void ParallelCodegen::emitObject(const std::string &path) {
+  if (partitions_.size() == 1) {
+    Partition &partition = partitions_.front();
+    if (partition.object) {
+      writeFile(path, partition.object->getBuffer());
+    } else {
+      partition.visitor->emitObject(path);
+    }
+    return;
+  }
+  auto objects = emitObjects();
+  linkObjects("-r", path, objects);
+  for (const auto &object : objects) {
+    llvm::sys::fs::remove(object);
+  }
+}
+
+void ParallelCodegen::emitSharedLibrary(const std::string &path) {
+  auto objects = emitObjects();
+  linkObjects("-shared", path, objects);
+  for (const auto &object : objects) {
+    llvm::sys::fs::remove(object);
+  }
+}
+
+void ParallelCodegen::writeHeader(llvm::raw_ostream &out) {
+  std::string prototypes;
+  llvm::raw_string_ostream prototypes_out(prototypes);
+  for (auto &partition : partitions_) {
+    if (partition.visitor) {
+      partition.visitor->writePrototypes(prototypes_out);
+    } else {
+      prototypes_out << partition.prototypes;
+    }
+  }
+  CodegenVisitor::writeHeader(out, prototypes_out.str());
+}
+
+CodegenVisitor &ParallelCodegen::linkPartitions() {
+  for (auto &partition : partitions_) {
+    if (!partition.visitor) {
+      std::cout << "Cached objects can't be emitted as IR" << std::endl;
+      exit(1);
+    }
+  }
+  for (size_t i = 1; i < partitions_.size(); i++) {
+    partitions_.front().visitor->linkIn(*partitions_[i].visitor);
+  }
+  partitions_.resize(1);
+  return *partitions_.front().visitor;
+}
+
+void ParallelCodegen::addToJIT(JIT &jit) {
+  for (auto &partition : partitions_) {
+    if (partition.object) {
+      jit.addObject(std::move(partition.object));
+    } else {
+      jit.addModule(partition.visitor->takeModule());
+    }
+  }
+  partitions_.clear();
+}
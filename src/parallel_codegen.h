@@ -0,0 +1,56 @@
+#pragma once
+
+#include "cache.h"
+#include "codegen.h"
+#include "jit.h"
+#include "parser.h"
+
+#include <memory>
+#include <string>
+#include <vector>
+
+// Lowers a program on worker threads. The functions are split into
+// contiguous partitions, each with its own CodegenVisitor (and so its own
+// context, module and target machine), which are generated, optimized and
+// emitted concurrently. Optimization doesn't see across partitions.
+//
+// With a cache, partitions are cut by content rather than by thread count,
+// so editing one function only invalidates the partition around it. Each
+// partition is compiled straight to an object, or taken from the cache
+// without generating any IR.
+class ParallelCodegen {
+public:
+  ParallelCodegen(const Program &program, unsigned threads,
+                  CompileCache *cache = nullptr,
+                  const CodegenOptions &options = {});
+  // a single partition that was already generated, e.g. while streaming
+  explicit ParallelCodegen(std::unique_ptr<CodegenVisitor> visitor);
+
+  // each partition is emitted on its own worker, the objects are then
+  // combined with a relocatable or shared link
+  void emitObject(const std::string &path);
+  void emitSharedLibrary(const std::string &path);
+  void writeHeader(llvm::raw_ostream &out);
+  // links every partition into the first one, for textual or bitcode output.
+  // not available for cached partitions, which never had any IR.
+  CodegenVisitor &linkPartitions();
+  void addToJIT(JIT &jit);
+
+  // how many partitions were found in the cache
+  size_t cacheHits() const { return cache_hits_; }
+
+private:
+  struct Partition {
+    std::unique_ptr<CodegenVisitor> visitor;
+    // set instead of the visitor when compiling through the cache
+    std::unique_ptr<llvm::MemoryBuffer> object;
+    std::string prototypes;
+  };
+
+  void compileCached(const Program &program, unsigned threads,
+                     CompileCache &cache, const CodegenOptions &options);
+  std::vector<std::string> emitObjects();
+
+  std::vector<Partition> partitions_;
+  size_t cache_hits_ = 0;
+};
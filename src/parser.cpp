@@ -3,13 +3,26 @@
 
 #include <iostream>
 
-std::optional<Token> Parser::getCurrentToken() {
-  if (token_idx_ >= tokens_.size()) {
+std::optional<Token> Parser::pullToken() {
+  if (scanner_) {
+    return scanner_->nextToken();
+  }
+  if (fetched_ >= tokens_.size()) {
     return std::nullopt;
   }
-  return tokens_[token_idx_];
+  return tokens_[fetched_];
 }
 
+std::optional<Token> Parser::peekToken(size_t offset) {
+  while (fetched_ <= token_idx_ + offset) {
+    lookahead_[fetched_ % kLookahead] = pullToken();
+    fetched_++;
+  }
+  return lookahead_[(token_idx_ + offset) % kLookahead];
+}
+
+std::optional<Token> Parser::getCurrentToken() { return peekToken(0); }
+
 std::optional<Token> Parser::getNextToken() {
   advance();
   return getCurrentToken();
@@ -34,7 +47,7 @@ Token Parser::expectedNextToken(TokenType type) {
 
 void Parser::advance() { token_idx_++; }
 
-std::unique_ptr<ExprNode> Parser::handlePrimary() {
+ExprNode *Parser::handlePrimary() {
   auto token = getCurrentToken();
   if (!token) {
     std::cout << "Expected token in expression";
@@ -44,31 +57,43 @@ std::unique_ptr<ExprNode> Parser::handlePrimary() {
   switch (token->getType()) {
   case tok_identifier: {
     // peek ahead to see if its a fn call or a variable
-    bool is_fn_call = token_idx_ + 1 < tokens_.size() &&
-                      tokens_[token_idx_ + 1].getType() == tok_lpar;
+    auto next = peekToken(1);
+    bool is_fn_call = next && next->getType() == tok_lpar;
     if (is_fn_call) {
-      std::vector<std::unique_ptr<ExprNode>> args;
+      size_t args_start = arg_scratch_.size();
       expectedNextToken(tok_lpar);
-      while (auto token = getNextToken()) {
-        if (token->getType() != tok_identifier) {
-          break;
+      advance(); // skip lpar
+      auto arg = getCurrentToken();
+      if (arg && arg->getType() != tok_rpar) {
+        while (true) {
+          arg_scratch_.push_back(handleExpression());
+          if (!getCurrentToken() ||
+              getCurrentToken()->getType() != tok_comma) {
+            break;
+          }
+          advance(); // skip comma
         }
-        args.push_back(handleExpression());
-        if (!getCurrentToken() || getCurrentToken()->getType() != tok_comma) {
-          break;
-        }
-        expectedNextToken(tok_comma);
+      }
+      if (!getCurrentToken() || getCurrentToken()->getType() != tok_rpar) {
+        std::cout << "Expected , or ) after argument " << arg_scratch_.size()
+                  << " of call to " << tokens_.getIdentifier(*token)
+                  << std::endl;
+        exit(1);
       }
       advance(); // skip past rpar
-      return std::make_unique<FunctionCallExprNode>(token->getIdentifier(),
-                                                    std::move(args));
+      return arena_->make<FunctionCallExprNode>(
+          tokens_.getIdentifier(*token), popScratch(arg_scratch_, args_start));
     }
     advance();
-    return std::make_unique<IdentifierExprNode>(token->getIdentifier());
+    if (next && next->getType() == tok_lsquare) {
+      auto index = handleIndex();
+      return arena_->make<IndexExprNode>(tokens_.getIdentifier(*token), index);
+    }
+    return arena_->make<IdentifierExprNode>(tokens_.getIdentifier(*token));
   }
   case tok_number:
     advance();
-    return std::make_unique<NumberLiteralNode>(token->getNumber());
+    return arena_->make<NumberLiteralNode>(tokens_.getNumberLiteral(*token));
   case tok_lpar: {
     advance();
     auto expr = handleExpression();
@@ -88,32 +113,37 @@ std::unique_ptr<ExprNode> Parser::handlePrimary() {
   }
 }
 
+ExprNode *Parser::handleIndex() {
+  advance(); // skip lsquare
+  auto index = handleExpression();
+  if (!getCurrentToken() || getCurrentToken()->getType() != tok_rsquare) {
+    std::cout << "Expected ] after index" << std::endl;
+    exit(1);
+  }
+  advance(); // skip rsquare
+  return index;
+}
+
 int32_t Parser::getBinOpPrecedence(Token bin_op) {
+  // binary operators are left associative, higher binds tighter
   switch (bin_op.getType()) {
+  case tok_lt:
+  case tok_gt:
+  case tok_lte:
+  case tok_gte:
+    return 10;
   case tok_add:
-    return 0;
   case tok_sub:
-    return 1000;
+    return 20;
   case tok_mul:
-    return 2000;
   case tok_div:
-    return 3000;
   case tok_mod:
-    return 4000;
-  case tok_gt:
-    return 5000;
-  case tok_gte:
-    return 6000;
-  case tok_lt:
-    return 7000;
-  case tok_lte:
-    return 8000;
+    return 30;
   default:
     return -1;
   }
 }
-std::unique_ptr<ExprNode>
-Parser::handleBinOpRHS(int8_t precedence, std::unique_ptr<ExprNode> LHS) {
+ExprNode *Parser::handleBinOpRHS(int32_t precedence, ExprNode *LHS) {
   while (true) {
 
     auto bin_op = getCurrentToken();
@@ -137,28 +167,76 @@ Parser::handleBinOpRHS(int8_t precedence, std::unique_ptr<ExprNode> LHS) {
 
     auto next_bin_op = getCurrentToken();
     if (!next_bin_op) {
-      return std::make_unique<BinaryExprNode>(bin_op->getType(), std::move(LHS),
-                                              std::move(RHS));
+      return arena_->make<BinaryExprNode>(bin_op->getType(), LHS, RHS);
     }
 
+    // a tighter operator after the rhs takes it as its own lhs
     int32_t next_bin_op_precedence = getBinOpPrecedence(*next_bin_op);
     if (bin_op_precedence < next_bin_op_precedence) {
-      RHS = handleBinOpRHS(next_bin_op_precedence + 1, std::move(RHS));
+      RHS = handleBinOpRHS(bin_op_precedence + 1, RHS);
     }
 
-    LHS = std::make_unique<BinaryExprNode>(bin_op->getType(), std::move(LHS),
-                                           std::move(RHS));
+    LHS = arena_->make<BinaryExprNode>(bin_op->getType(), LHS, RHS);
+  }
+}
+
+std::optional<ValueType> Parser::handleTypeAnnotation() {
+  auto token = getCurrentToken();
+  if (!token || token->getType() != tok_colon) {
+    return std::nullopt;
   }
+  auto name = getNextToken();
+  if (!name || name->getType() != tok_identifier) {
+    std::cout << "Expected a type after :" << std::endl;
+    exit(1);
+  }
+  auto type = typeFromName(tokens_.getIdentifier(*name));
+  if (!type) {
+    std::cout << "Unknown type " << tokens_.getIdentifier(*name)
+              << ", expected f64, f32, i64 or i32" << std::endl;
+    exit(1);
+  }
+  auto token_after = getNextToken();
+  if (token_after && token_after->getType() == tok_lsquare) {
+    expectedNextToken(tok_rsquare);
+    advance();
+    return sliceOf(*type);
+  }
+  return type;
 }
 
-std::unique_ptr<ExprNode> Parser::handleExpression() {
+ExprNode *Parser::handleExpression() {
   auto primary = handlePrimary();
-  return handleBinOpRHS(0, std::move(primary));
+  return handleBinOpRHS(0, primary);
 }
 
-std::unique_ptr<ConditionalNode> Parser::handleConditional() {
+BranchHint Parser::handleBranchHint() {
+  // only an identifier can't start the if body, so likely and unlikely don't
+  // need to be reserved words
+  auto token = getCurrentToken();
+  if (!token || token->getType() != tok_identifier) {
+    return branch_unknown;
+  }
+  auto name = tokens_.getIdentifier(*token);
+  BranchHint hint = branch_unknown;
+  if (name == "likely") {
+    hint = branch_likely;
+  } else if (name == "unlikely") {
+    hint = branch_unlikely;
+  } else {
+    std::cout << "Expected likely, unlikely or a left bracket after the "
+                 "condition but got "
+              << name << std::endl;
+    exit(1);
+  }
+  advance();
+  return hint;
+}
+
+ConditionalNode *Parser::handleConditional() {
   advance(); // skip if token
   auto if_expr = handleExpression();
+  BranchHint hint = handleBranchHint();
 
   advance(); // skip lbrak
   auto if_body = handleBody();
@@ -169,32 +247,146 @@ std::unique_ptr<ConditionalNode> Parser::handleConditional() {
       advance(); // skip lbrak
       auto else_body = handleBody();
       advance(); // skip rbrak
-      return std::make_unique<ConditionalNode>(
-          std::move(if_expr), std::move(if_body), std::move(else_body));
+      return arena_->make<ConditionalNode>(if_expr, if_body, else_body, hint);
     }
   }
 
-  return std::make_unique<ConditionalNode>(std::move(if_expr),
-                                           std::move(if_body));
+  return arena_->make<ConditionalNode>(if_expr, if_body, nullptr, hint);
+}
+
+uint16_t Parser::handleHintCount(std::string_view hint) {
+  expectedNextToken(tok_lpar);
+  auto count = getNextToken();
+  if (!count || count->getType() != tok_number ||
+      !tokens_.getNumberLiteral(*count).isInteger() ||
+      tokens_.getNumberLiteral(*count).integer < 1 ||
+      tokens_.getNumberLiteral(*count).integer > UINT16_MAX) {
+    std::cout << "Expected a count from 1 to " << UINT16_MAX << " in " << hint
+              << "(N)" << std::endl;
+    exit(1);
+  }
+  expectedNextToken(tok_rpar);
+  advance();
+  return tokens_.getNumberLiteral(*count).integer;
 }
 
-std::unique_ptr<ReturnNode> Parser::handleReturnStatement() {
+LoopHints Parser::handleLoopHints() {
+  // like branch hints, these aren't reserved words
+  LoopHints hints;
+  while (auto token = getCurrentToken()) {
+    if (token->getType() != tok_identifier) {
+      break;
+    }
+    auto name = tokens_.getIdentifier(*token);
+    bool has_count = peekToken(1) && peekToken(1)->getType() == tok_lpar;
+    if (name == "unroll" && has_count) {
+      hints.unroll_count = handleHintCount(name);
+    } else if (name == "vectorize") {
+      hints.vectorize = true;
+      if (!has_count) {
+        advance();
+        continue;
+      }
+      hints.vectorize_width = handleHintCount(name);
+      // LLVM ignores widths it can't use
+      if (hints.vectorize_width > 64 ||
+          (hints.vectorize_width & (hints.vectorize_width - 1))) {
+        std::cout << "vectorize(N) takes a power of two up to 64, got "
+                  << hints.vectorize_width << std::endl;
+        exit(1);
+      }
+    } else {
+      std::cout << "Expected vectorize, unroll(N) or a left bracket after the "
+                   "loop header but got "
+                << name << std::endl;
+      exit(1);
+    }
+  }
+  return hints;
+}
+
+WhileNode *Parser::handleWhile() {
+  advance(); // skip while token
+  auto condition = handleExpression();
+  LoopHints hints = handleLoopHints();
+  if (!getCurrentToken() || getCurrentToken()->getType() != tok_lbrak) {
+    std::cout << "Expected { after the condition of while" << std::endl;
+    exit(1);
+  }
+  advance(); // skip lbrak
+  auto body = handleBody();
+  advance(); // skip rbrak
+  return arena_->make<WhileNode>(condition, body, hints);
+}
+
+ForNode *Parser::handleFor() {
+  expectedNextToken(tok_lpar);
+  auto variable = expectedNextToken(tok_identifier);
+  expectedNextToken(tok_equals);
+  advance();
+  auto start = handleExpression();
+  if (!getCurrentToken() || getCurrentToken()->getType() != tok_comma) {
+    std::cout << "Expected , and the end of the range after the start of for"
+              << std::endl;
+    exit(1);
+  }
+  advance(); // skip comma
+  auto end = handleExpression();
+  ExprNode *step;
+  if (getCurrentToken() && getCurrentToken()->getType() == tok_comma) {
+    advance(); // skip comma
+    step = handleExpression();
+  } else {
+    // an unsuffixed 1 takes the type of the loop variable
+    step = arena_->make<NumberLiteralNode>(NumberLiteral{num_integer, 1, 1});
+  }
+  if (!getCurrentToken() || getCurrentToken()->getType() != tok_rpar) {
+    std::cout << "Expected ) after the range of for" << std::endl;
+    exit(1);
+  }
+  advance(); // skip rpar
+  LoopHints hints = handleLoopHints();
+  if (!getCurrentToken() || getCurrentToken()->getType() != tok_lbrak) {
+    std::cout << "Expected { after the range of for" << std::endl;
+    exit(1);
+  }
+  advance(); // skip lbrak
+  auto body = handleBody();
+  advance(); // skip rbrak
+  return arena_->make<ForNode>(tokens_.getIdentifier(variable), start, end,
+                               step, body, hints);
+}
+
+ReturnNode *Parser::handleReturnStatement() {
   //   expectedNextToken(tok_return);
   advance(); // skip return
-  return std::make_unique<ReturnNode>(std::move(handleExpression()));
+  return arena_->make<ReturnNode>(handleExpression());
 }
 
-std::unique_ptr<DefinitionNode> Parser::handleDefinition() {
+StoreNode *Parser::handleStore() {
+  auto slice = getCurrentToken();
+  advance();
+  auto index = handleIndex();
+  if (!getCurrentToken() || getCurrentToken()->getType() != tok_equals) {
+    std::cout << "Expected = after " << tokens_.getIdentifier(*slice) << "[...]"
+              << std::endl;
+    exit(1);
+  }
+  advance(); // skip equals
+  auto value = handleExpression();
+  return arena_->make<StoreNode>(tokens_.getIdentifier(*slice), index, value);
+}
+
+DefinitionNode *Parser::handleDefinition() {
   auto lvalue = getCurrentToken();
   expectedNextToken(tok_equals);
   advance();
   auto expr = handleExpression();
-  return std::make_unique<DefinitionNode>(lvalue->getIdentifier(),
-                                          std::move(expr));
+  return arena_->make<DefinitionNode>(tokens_.getIdentifier(*lvalue), expr);
 }
 
-std::unique_ptr<BodyNode> Parser::handleBody() {
-  std::vector<std::unique_ptr<BodySubNode>> blocks;
+BodyNode *Parser::handleBody() {
+  size_t blocks_start = block_scratch_.size();
   while (auto token = getCurrentToken()) {
     if (!token) {
       std::cout << "Expected another token in function body" << std::endl;
@@ -203,24 +395,38 @@ std::unique_ptr<BodyNode> Parser::handleBody() {
 
     switch (token->getType()) {
     case tok_if: {
-      blocks.push_back(handleConditional());
+      block_scratch_.push_back(handleConditional());
+      break;
+    }
+    case tok_while: {
+      block_scratch_.push_back(handleWhile());
+      break;
+    }
+    case tok_for: {
+      block_scratch_.push_back(handleFor());
       break;
     }
     case tok_return: {
-      blocks.push_back(handleReturnStatement());
+      block_scratch_.push_back(handleReturnStatement());
       break;
     }
     case tok_identifier: {
-      blocks.push_back(handleDefinition());
+      auto next = peekToken(1);
+      if (next && next->getType() == tok_lsquare) {
+        block_scratch_.push_back(handleStore());
+      } else {
+        block_scratch_.push_back(handleDefinition());
+      }
       break;
     }
     case tok_rbrak: {
-      return std::make_unique<BodyNode>(std::move(blocks));
+      return arena_->make<BodyNode>(popScratch(block_scratch_, blocks_start));
     }
     default: {
-      std::cout << "Expected conditional, return statemnet, or identifier in "
-                   "function body but got "
-                << token->toString() << " at " << token_idx_ << std::endl;
+      std::cout << "Expected conditional, loop, return statemnet, or "
+                   "identifier in function body but got "
+                << tokens_.toString(*token) << " at " << token_idx_
+                << std::endl;
       exit(1);
     }
     }
@@ -228,10 +434,10 @@ std::unique_ptr<BodyNode> Parser::handleBody() {
       break;
     }
   }
-  return std::make_unique<BodyNode>(std::move(blocks));
+  return arena_->make<BodyNode>(popScratch(block_scratch_, blocks_start));
 }
 
-std::unique_ptr<FunctionNode> Parser::handleFunction() {
+FunctionNode *Parser::handleFunction(bool is_extern) {
   // consume function name
   std::optional<Token> fnName = getNextToken();
   if (!fnName || (*fnName).getType() != tok_identifier) {
@@ -243,11 +449,16 @@ std::unique_ptr<FunctionNode> Parser::handleFunction() {
   expectedNextToken(tok_lpar);
 
   auto token = getNextToken();
-  std::vector<std::string> args;
+  size_t args_start = name_scratch_.size();
+  size_t types_start = type_scratch_.size();
+  bool typed_args = false;
   while (token && token->getType() != tok_rpar) {
     if (token->getType() == tok_identifier) {
-      args.push_back(token->getIdentifier());
+      name_scratch_.push_back(tokens_.getIdentifier(*token));
       advance();
+      auto type = handleTypeAnnotation();
+      type_scratch_.push_back(type.value_or(type_f64));
+      typed_args |= type && *type != type_f64;
 
       if (!getCurrentToken()) {
         std::cout << "Error when parsing function declaration, expected comma"
@@ -263,8 +474,16 @@ std::unique_ptr<FunctionNode> Parser::handleFunction() {
       if (token->getType() != tok_comma) {
         std::cout << "Error when parsing function declaration, expected comma"
                   << std::endl;
+        exit(1);
       }
       advance();
+      if (!getCurrentToken()) {
+        std::cout << "Error when parsing function declaration, expected "
+                     "identifier"
+                  << std::endl;
+        exit(1);
+      }
+      token.emplace(*getCurrentToken());
 
     } else {
       std::cout << "Error when parsing function declaration" << std::endl;
@@ -272,33 +491,156 @@ std::unique_ptr<FunctionNode> Parser::handleFunction() {
     }
   }
 
-  auto functionDeclaration = std::make_unique<FunctionDeclarationNode>(
-      fnName->getIdentifier(), std::move(args));
+  advance(); // skip rpar
+  ValueType return_type = handleTypeAnnotation().value_or(type_f64);
+  if (isSliceType(return_type)) {
+    std::cout << tokens_.getIdentifier(*fnName)
+              << " can't return a slice, only take one as an argument"
+              << std::endl;
+    exit(1);
+  }
+  // all f64 signatures are stored without types, the way they're parsed when
+  // nothing is annotated
+  ArenaArray<ValueType> arg_types;
+  if (typed_args) {
+    arg_types = popScratch(type_scratch_, types_start);
+  } else {
+    type_scratch_.resize(types_start);
+  }
+  auto functionDeclaration = arena_->make<FunctionDeclarationNode>(
+      tokens_.getIdentifier(*fnName), popScratch(name_scratch_, args_start),
+      arg_types, return_type, is_extern);
+  if (is_extern) {
+    if (getCurrentToken() && getCurrentToken()->getType() == tok_lbrak) {
+      std::cout << "extern " << tokens_.getIdentifier(*fnName)
+                << " can't have a body" << std::endl;
+      exit(1);
+    }
+    return arena_->make<FunctionNode>(functionDeclaration, nullptr);
+  }
 
-  expectedNextToken(tok_lbrak);
+  FloatMode float_mode = handleFloatMode(tokens_.getIdentifier(*fnName));
+  if (!getCurrentToken() || getCurrentToken()->getType() != tok_lbrak) {
+    std::cout << "Expected { after the declaration of "
+              << tokens_.getIdentifier(*fnName) << std::endl;
+    exit(1);
+  }
   advance(); // skip lbrak
   auto body = handleBody();
   advance(); // skip rbrak
-  return std::make_unique<FunctionNode>(std::move(functionDeclaration),
-                                        std::move(body));
+  return arena_->make<FunctionNode>(functionDeclaration, body, float_mode);
 }
 
-std::unique_ptr<Program> Parser::parse() {
-  std::vector<std::unique_ptr<FunctionNode>> functions;
-  while (auto token = getCurrentToken()) {
-    switch (token->getType()) {
-    case tok_eof:
-      return std::make_unique<Program>(std::move(functions));
-    case tok_def:
-      functions.push_back(std::move(handleFunction()));
-      break;
-    default:
-      std::cout << "Error: received invalid token type " << token->toString()
-                << std::endl;
+FloatMode Parser::handleFloatMode(std::string_view function) {
+  // like branch hints, these don't need to be reserved words
+  auto token = getCurrentToken();
+  if (!token || token->getType() != tok_identifier) {
+    return float_default;
+  }
+  auto name = tokens_.getIdentifier(*token);
+  FloatMode mode = float_default;
+  if (name == "strict") {
+    mode = float_strict;
+  } else if (name == "contract") {
+    mode = float_contract;
+  } else if (name == "fastmath") {
+    mode = float_fast;
+  } else {
+    std::cout << "Expected strict, contract, fastmath or { after the "
+                 "signature of "
+              << function << " but got " << name << std::endl;
+    exit(1);
+  }
+  advance();
+  return mode;
+}
+
+FunctionNode *Parser::parseFunction() {
+  auto token = getCurrentToken();
+  if (!token || token->getType() == tok_eof) {
+    return nullptr;
+  }
+  bool is_extern = token->getType() == tok_extern;
+  if (is_extern) {
+    advance(); // skip extern
+    token = getCurrentToken();
+    if (!token || token->getType() != tok_def) {
+      std::cout << "Expected def after extern" << std::endl;
       exit(1);
     }
   }
-  return std::make_unique<Program>(std::move(functions));
+  if (token->getType() != tok_def) {
+    std::cout << "Error: received invalid token type "
+              << tokens_.toString(*token) << std::endl;
+    exit(1);
+  }
+  FunctionNode *function = handleFunction(is_extern);
+  function_scratch_.push_back(function);
+  return function;
+}
+
+std::unique_ptr<Program> Parser::parse() {
+  while (parseFunction()) {
+  }
+  return makeProgram();
+}
+
+std::optional<ValueType> typeFromName(std::string_view name) {
+  if (name == "f64") {
+    return type_f64;
+  } else if (name == "f32") {
+    return type_f32;
+  } else if (name == "i64") {
+    return type_i64;
+  } else if (name == "i32") {
+    return type_i32;
+  }
+  return std::nullopt;
+}
+
+const char *typeName(ValueType type) {
+  switch (type) {
+  case type_f64:
+    return "f64";
+  case type_f32:
+    return "f32";
+  case type_i64:
+    return "i64";
+  case type_i32:
+    return "i32";
+  case type_f64_slice:
+    return "f64[]";
+  case type_f32_slice:
+    return "f32[]";
+  case type_i64_slice:
+    return "i64[]";
+  case type_i32_slice:
+    return "i32[]";
+  }
+  return "?";
+}
+
+std::unique_ptr<Program>
+Program::merge(std::vector<std::unique_ptr<Program>> programs) {
+  std::vector<FunctionNode *> functions;
+  for (const auto &program : programs) {
+    functions.insert(functions.end(), program->functions_.begin(),
+                     program->functions_.end());
+  }
+  auto arena = std::make_unique<Arena>();
+  auto function_array = arena->copyArray(functions.data(), functions.size());
+  auto merged = std::make_unique<Program>(std::move(arena), function_array);
+  for (auto &program : programs) {
+    for (auto &program_arena : program->arenas_) {
+      merged->arenas_.push_back(std::move(program_arena));
+    }
+  }
+  return merged;
+}
+
+std::unique_ptr<Program> Parser::makeProgram() {
+  auto functions = popScratch(function_scratch_, 0);
+  return std::make_unique<Program>(std::move(arena_), functions);
 }
 
 void FunctionDeclarationNode::accept(Visitor *v) {
@@ -312,9 +654,13 @@ void IdentifierExprNode::accept(Visitor *v) {
 void FunctionCallExprNode::accept(Visitor *v) {
   v->visitFunctionCallExprNode(this);
 }
+void IndexExprNode::accept(Visitor *v) { v->visitIndexExprNode(this); }
 void BodyNode::accept(Visitor *v) { v->visitBodyNode(this); }
 void ConditionalNode::accept(Visitor *v) { v->visitConditionalNode(this); }
+void WhileNode::accept(Visitor *v) { v->visitWhileNode(this); }
+void ForNode::accept(Visitor *v) { v->visitForNode(this); }
 void DefinitionNode::accept(Visitor *v) { v->visitDefinitionNode(this); }
+void StoreNode::accept(Visitor *v) { v->visitStoreNode(this); }
 void ReturnNode::accept(Visitor *v) { v->visitReturnNode(this); }
 void FunctionNode::accept(Visitor *v) { v->visitFunctionNode(this); }
 void Program::accept(Visitor *v) { v->visitProgramNode(this); }
\ No newline at end of file
@@ -1,4 +1,9 @@
+#pragma once
+
+#include "arena.h"
 #include "scanner.h"
+#include <memory>
+#include <string_view>
 #include <vector>
 
 class Visitor;
@@ -8,101 +13,196 @@ public:
   virtual void accept(Visitor *v) = 0;
 };
 
+// The type of a value. Anything that isn't annotated or inferred otherwise is
+// an f64.
+enum ValueType : uint8_t {
+  type_f64,
+  type_f32,
+  type_i64,
+  type_i32,
+  // contiguous arrays of the above, e.g. f64[]. they can only be passed to a
+  // function as an argument, which takes a pointer and a length.
+  type_f64_slice,
+  type_f32_slice,
+  type_i64_slice,
+  type_i32_slice,
+};
+
+// the type named by an annotation or conversion, e.g. i64
+std::optional<ValueType> typeFromName(std::string_view name);
+const char *typeName(ValueType type);
+inline bool isIntegerType(ValueType type) {
+  return type == type_i64 || type == type_i32;
+}
+inline bool isSliceType(ValueType type) { return type >= type_f64_slice; }
+inline ValueType sliceOf(ValueType element) {
+  return ValueType(element + type_f64_slice);
+}
+inline ValueType elementType(ValueType slice) {
+  return ValueType(slice - type_f64_slice);
+}
+
 class FunctionDeclarationNode : public Visitable {
 public:
-  FunctionDeclarationNode(const std::string &name,
-                          std::vector<std::string> args)
-      : name_(name), args_(std::move(args)) {}
-  const std::string &getName() const { return name_; }
-  const std::vector<std::string> &getArgs() const { return args_; }
+  // arg_types is either empty, when every argument is an f64, or has one
+  // entry per argument
+  FunctionDeclarationNode(std::string_view name,
+                          ArenaArray<std::string_view> args,
+                          ArenaArray<ValueType> arg_types = {},
+                          ValueType return_type = type_f64,
+                          bool is_extern = false)
+      : name_(name), args_(args), arg_types_(arg_types),
+        return_type_(return_type), is_extern_(is_extern) {}
+  std::string_view getName() const { return name_; }
+  const ArenaArray<std::string_view> &getArgs() const { return args_; }
+  const ArenaArray<ValueType> &getArgTypes() const { return arg_types_; }
+  ValueType getArgType(size_t idx) const {
+    return arg_types_.empty() ? type_f64 : arg_types_[idx];
+  }
+  ValueType getReturnType() const { return return_type_; }
+  // whether anything in the signature isn't an f64
+  bool isTyped() const {
+    return !arg_types_.empty() || return_type_ != type_f64;
+  }
+  // slices can't be boxed in a double, so functions taking them can only be
+  // called from compiled code
+  bool takesSlices() const {
+    for (ValueType type : arg_types_) {
+      if (isSliceType(type)) {
+        return true;
+      }
+    }
+    return false;
+  }
+  // declared with `extern def`, a C function linked in from elsewhere
+  bool isExtern() const { return is_extern_; }
   void accept(Visitor *v) override;
 
 private:
-  std::string name_;
-  std::vector<std::string> args_;
+  std::string_view name_;
+  ArenaArray<std::string_view> args_;
+  ArenaArray<ValueType> arg_types_;
+  ValueType return_type_;
+  bool is_extern_;
 };
 
 class ExprNode : public Visitable {
 public:
-  virtual ~ExprNode() = default;
   enum ExprNodeType {
     BinaryExprNode,
     NumberLiteralNode,
     IdentifierExprNode,
     FunctionCallExprNode,
+    IndexExprNode,
   };
   ExprNode(ExprNodeType node_type) : node_type_(node_type) {}
-  ExprNodeType getExprNodeType() { return node_type_; }
+  ExprNodeType getExprNodeType() const { return node_type_; }
+  // filled in by the TypeChecker, f64 until the function has been checked
+  ValueType getType() const { return type_; }
+  void setType(ValueType type) { type_ = type; }
 
 protected:
   ExprNodeType node_type_;
+  ValueType type_ = type_f64;
 };
 
 class BinaryExprNode : public ExprNode {
 public:
-  BinaryExprNode(TokenType op, std::unique_ptr<ExprNode> LHS,
-                 std::unique_ptr<ExprNode> RHS)
-      : operator_(op), lhs_(std::move(LHS)), rhs_(std::move(RHS)),
+  BinaryExprNode(TokenType op, ExprNode *LHS, ExprNode *RHS)
+      : operator_(op), lhs_(LHS), rhs_(RHS),
         ExprNode(ExprNodeType::BinaryExprNode) {}
 
-  ExprNode *getLHS() const { return lhs_.get(); }
-  ExprNode *getRHS() const { return rhs_.get(); }
+  ExprNode *getLHS() const { return lhs_; }
+  ExprNode *getRHS() const { return rhs_; }
   TokenType getOperator() const { return operator_; }
   void accept(Visitor *v) override;
 
 private:
-  std::unique_ptr<ExprNode> lhs_;
+  ExprNode *lhs_;
   TokenType operator_;
-  std::unique_ptr<ExprNode> rhs_;
+  ExprNode *rhs_;
 };
 
 class NumberLiteralNode : public ExprNode {
 public:
+  NumberLiteralNode(const NumberLiteral &literal)
+      : literal_(literal), ExprNode(ExprNodeType::NumberLiteralNode) {}
   NumberLiteralNode(double value)
-      : value_(value), ExprNode(ExprNodeType::NumberLiteralNode) {}
-  double getValue() const { return value_; }
+      : NumberLiteralNode(NumberLiteral{num_float, value, 0}) {}
+  double getValue() const { return literal_.value; }
+  const NumberLiteral &getLiteral() const { return literal_; }
   void accept(Visitor *v) override;
 
 private:
-  double value_;
+  NumberLiteral literal_;
 };
 
 class IdentifierExprNode : public ExprNode {
 public:
-  IdentifierExprNode(const std::string &name)
+  IdentifierExprNode(std::string_view name)
       : name_(name), ExprNode(ExprNodeType::IdentifierExprNode) {}
-  const std::string &getName() const { return name_; }
+  std::string_view getName() const { return name_; }
   void accept(Visitor *v) override;
 
 private:
-  std::string name_;
+  std::string_view name_;
+};
+
+// what a call turned out to be, decided by the TypeChecker
+enum CallKind : uint8_t {
+  call_function,
+  // i64(x) and friends
+  call_conversion,
+  // len(xs), the number of elements of a slice
+  call_length,
+  // a call to a function declared with `extern def`
+  call_extern,
 };
 
 class FunctionCallExprNode : public ExprNode {
 public:
-  FunctionCallExprNode(const std::string &name,
-                       std::vector<std::unique_ptr<ExprNode>> args)
-      : name_(name), args_(std::move(args)),
+  FunctionCallExprNode(std::string_view name, ArenaArray<ExprNode *> args)
+      : name_(name), args_(args),
         ExprNode(ExprNodeType::FunctionCallExprNode) {}
-  const std::string &getName() { return name_; }
-  std::vector<std::unique_ptr<ExprNode>> &getArgs() { return args_; }
+  std::string_view getName() const { return name_; }
+  const ArenaArray<ExprNode *> &getArgs() const { return args_; }
+  CallKind getCallKind() const { return kind_; }
+  void setCallKind(CallKind kind) { kind_ = kind; }
+  bool isConversion() const { return kind_ == call_conversion; }
+  void accept(Visitor *v) override;
+
+private:
+  std::string_view name_;
+  ArenaArray<ExprNode *> args_;
+  CallKind kind_ = call_function;
+};
+
+// xs[i], the element of the slice argument xs at the i64 index i
+class IndexExprNode : public ExprNode {
+public:
+  IndexExprNode(std::string_view slice, ExprNode *index)
+      : slice_(slice), index_(index), ExprNode(ExprNodeType::IndexExprNode) {}
+  std::string_view getSlice() const { return slice_; }
+  ExprNode *getIndex() const { return index_; }
   void accept(Visitor *v) override;
 
 private:
-  std::string name_;
-  std::vector<std::unique_ptr<ExprNode>> args_;
+  std::string_view slice_;
+  ExprNode *index_;
 };
 
 class BodySubNode : public Visitable {
 public:
-  virtual ~BodySubNode() = default;
   enum BodyNodeType {
     ConditionalNode,
     ReturnStatementNode,
     DefinitionNode,
+    WhileNode,
+    ForNode,
+    StoreNode,
   };
   BodySubNode(BodyNodeType node_type) : node_type_(node_type) {}
-  BodyNodeType getBodyNodeType() { return node_type_; }
+  BodyNodeType getBodyNodeType() const { return node_type_; }
 
 protected:
   BodyNodeType node_type_;
@@ -110,116 +210,287 @@ protected:
 
 class BodyNode : public Visitable {
 public:
-  BodyNode(std::vector<std::unique_ptr<BodySubNode>> blocks)
-      : blocks_(std::move(blocks)) {}
-  const std::vector<std::unique_ptr<BodySubNode>> &getBlocks() const {
-    return blocks_;
-  }
+  BodyNode(ArenaArray<BodySubNode *> blocks) : blocks_(blocks) {}
+  const ArenaArray<BodySubNode *> &getBlocks() const { return blocks_; }
   void accept(Visitor *v) override;
 
 private:
-  std::vector<std::unique_ptr<BodySubNode>> blocks_;
+  ArenaArray<BodySubNode *> blocks_;
+};
+
+// how likely the if body of a conditional is to run, from a `likely` or
+// `unlikely` annotation after the condition
+enum BranchHint : uint8_t {
+  branch_unknown,
+  branch_likely,
+  branch_unlikely,
 };
 
 class ConditionalNode : public BodySubNode {
 public:
-  ConditionalNode(std::unique_ptr<ExprNode> if_expr,
-                  std::unique_ptr<BodyNode> if_body,
-                  std::unique_ptr<BodyNode> else_body = nullptr)
-      : if_expr_(std::move(if_expr)), if_body_(std::move(if_body)),
-        else_body_(std::move(else_body)),
-        BodySubNode(BodyNodeType::ConditionalNode) {}
-  ExprNode *getIfExpr() { return if_expr_.get(); }
-  BodyNode *getIfBody() { return if_body_.get(); }
-  BodyNode *getElseBody() { return else_body_.get(); }
+  ConditionalNode(ExprNode *if_expr, BodyNode *if_body,
+                  BodyNode *else_body = nullptr,
+                  BranchHint hint = branch_unknown)
+      : if_expr_(if_expr), if_body_(if_body), else_body_(else_body),
+        hint_(hint), BodySubNode(BodyNodeType::ConditionalNode) {}
+  ExprNode *getIfExpr() const { return if_expr_; }
+  BodyNode *getIfBody() const { return if_body_; }
+  BodyNode *getElseBody() const { return else_body_; }
+  BranchHint getHint() const { return hint_; }
   void accept(Visitor *v) override;
 
 private:
-  std::unique_ptr<ExprNode> if_expr_;
-  std::unique_ptr<BodyNode> if_body_;
-  std::unique_ptr<BodyNode> else_body_;
+  ExprNode *if_expr_;
+  BodyNode *if_body_;
+  BodyNode *else_body_;
+  BranchHint hint_;
+};
+
+// how a loop should be vectorized and unrolled, from `vectorize`,
+// `vectorize(N)` and `unroll(N)` annotations after the loop header. they're
+// passed on to LLVM and don't change what the program does, except that a
+// vectorized loop may add up floats in a different order.
+struct LoopHints {
+  bool vectorize = false;
+  // 0 leaves the width to the vectorizer
+  uint16_t vectorize_width = 0;
+  // 0 leaves the count to the unroller, 1 turns unrolling off
+  uint16_t unroll_count = 0;
+
+  bool empty() const { return !vectorize && unroll_count == 0; }
+  // the hints in a single word, for the flat and serialized forms
+  uint32_t pack() const {
+    return uint32_t(vectorize) | uint32_t(vectorize_width) << 1 |
+           uint32_t(unroll_count) << 16;
+  }
+  static LoopHints unpack(uint32_t word) {
+    return {bool(word & 1), uint16_t((word >> 1) & 0x7fff),
+            uint16_t(word >> 16)};
+  }
+};
+
+class WhileNode : public BodySubNode {
+public:
+  WhileNode(ExprNode *condition, BodyNode *body, LoopHints hints = {})
+      : condition_(condition), body_(body), hints_(hints),
+        BodySubNode(BodyNodeType::WhileNode) {}
+  ExprNode *getCondition() const { return condition_; }
+  BodyNode *getBody() const { return body_; }
+  const LoopHints &getHints() const { return hints_; }
+  void accept(Visitor *v) override;
+
+private:
+  ExprNode *condition_;
+  BodyNode *body_;
+  LoopHints hints_;
+};
+
+// `for (i = start, end, step) { ... }` runs the body for i = start,
+// start + step, ... while i < end. i = start is a definition like any other,
+// so i is declared in the loop's scope unless it's already visible. end and
+// step are evaluated once, right after it.
+class ForNode : public BodySubNode {
+public:
+  ForNode(std::string_view variable, ExprNode *start, ExprNode *end,
+          ExprNode *step, BodyNode *body, LoopHints hints = {})
+      : variable_(variable), start_(start), end_(end), step_(step),
+        body_(body), hints_(hints), BodySubNode(BodyNodeType::ForNode) {}
+  std::string_view getVariable() const { return variable_; }
+  ExprNode *getStart() const { return start_; }
+  ExprNode *getEnd() const { return end_; }
+  ExprNode *getStep() const { return step_; }
+  BodyNode *getBody() const { return body_; }
+  const LoopHints &getHints() const { return hints_; }
+  void accept(Visitor *v) override;
+
+private:
+  std::string_view variable_;
+  ExprNode *start_;
+  ExprNode *end_;
+  ExprNode *step_;
+  BodyNode *body_;
+  LoopHints hints_;
 };
 
 class DefinitionNode : public BodySubNode {
 public:
-  DefinitionNode(std::string lvalue, std::unique_ptr<ExprNode> rhs)
-      : lvalue_(lvalue), rhs_(std::move(rhs)),
-        BodySubNode(BodyNodeType::DefinitionNode) {}
-  const std::string &getLValue() const { return lvalue_; }
-  ExprNode *getRHS() const { return rhs_.get(); }
+  DefinitionNode(std::string_view lvalue, ExprNode *rhs)
+      : lvalue_(lvalue), rhs_(rhs), BodySubNode(BodyNodeType::DefinitionNode) {}
+  std::string_view getLValue() const { return lvalue_; }
+  ExprNode *getRHS() const { return rhs_; }
   void accept(Visitor *v) override;
 
 private:
-  std::string lvalue_;
-  std::unique_ptr<ExprNode> rhs_;
+  std::string_view lvalue_;
+  ExprNode *rhs_;
+};
+
+// xs[i] = value
+class StoreNode : public BodySubNode {
+public:
+  StoreNode(std::string_view slice, ExprNode *index, ExprNode *value)
+      : slice_(slice), index_(index), value_(value),
+        BodySubNode(BodyNodeType::StoreNode) {}
+  std::string_view getSlice() const { return slice_; }
+  ExprNode *getIndex() const { return index_; }
+  ExprNode *getValue() const { return value_; }
+  void accept(Visitor *v) override;
+
+private:
+  std::string_view slice_;
+  ExprNode *index_;
+  ExprNode *value_;
 };
 
 class ReturnNode : public BodySubNode {
 public:
-  ReturnNode(std::unique_ptr<ExprNode> expr)
-      : expr_(std::move(expr)), BodySubNode(BodyNodeType::ReturnStatementNode) {
-  }
-  ExprNode *getExpr() const { return expr_.get(); }
+  ReturnNode(ExprNode *expr)
+      : expr_(expr), BodySubNode(BodyNodeType::ReturnStatementNode) {}
+  ExprNode *getExpr() const { return expr_; }
   void accept(Visitor *v) override;
 
 private:
-  std::unique_ptr<ExprNode> expr_;
+  ExprNode *expr_;
+};
+
+// which floating point rewrites compiled code may make, from a `strict`,
+// `contract` or `fastmath` annotation after the signature of a def. without
+// one the module's default applies, which is strict unless the command line
+// says otherwise.
+enum FloatMode : uint8_t {
+  float_default,
+  // IEEE results, every operation rounded as written
+  float_strict,
+  // a * b + c may be fused into one operation, rounded once
+  float_contract,
+  // anything goes, as with -ffast-math: operations may be reassociated and
+  // NaNs, infinities and the sign of zero are assumed not to matter
+  float_fast,
 };
 
 class FunctionNode : public Visitable {
 public:
-  FunctionNode(std::unique_ptr<FunctionDeclarationNode> declaration,
-               std::unique_ptr<BodyNode> body)
-      : declaration_(std::move(declaration)), body_(std::move(body)) {}
-  BodyNode *getBody() const { return body_.get(); }
+  // extern functions have no body
+  FunctionNode(FunctionDeclarationNode *declaration, BodyNode *body,
+               FloatMode float_mode = float_default)
+      : declaration_(declaration), body_(body), float_mode_(float_mode) {}
+  BodyNode *getBody() const { return body_; }
+  FloatMode getFloatMode() const { return float_mode_; }
+  bool isExtern() const { return declaration_->isExtern(); }
   FunctionDeclarationNode *getFunctionDeclaration() const {
-    return declaration_.get();
+    return declaration_;
   }
   void accept(Visitor *v) override;
 
 private:
-  std::unique_ptr<FunctionDeclarationNode> declaration_;
-  std::unique_ptr<BodyNode> body_;
+  FunctionDeclarationNode *declaration_;
+  BodyNode *body_;
+  FloatMode float_mode_;
 };
 
+// Owns the arenas every node of the program was allocated from, the whole
+// tree is freed in one go with the program. Names in the tree are views into
+// the source, which has to outlive the program.
 class Program : public Visitable {
 public:
-  Program(std::vector<std::unique_ptr<FunctionNode>> functions)
-      : functions_(std::move(functions)) {}
-  const std::vector<std::unique_ptr<FunctionNode>> &getFunctions() const {
-    return functions_;
+  Program(std::unique_ptr<Arena> arena, ArenaArray<FunctionNode *> functions)
+      : functions_(functions) {
+    arenas_.push_back(std::move(arena));
   }
+  // Concatenates the functions of the programs in order, taking over their
+  // arenas.
+  static std::unique_ptr<Program>
+  merge(std::vector<std::unique_ptr<Program>> programs);
+
+  const ArenaArray<FunctionNode *> &getFunctions() const { return functions_; }
+  // the arena the function list lives in
+  Arena &getArena() const { return *arenas_.front(); }
   void accept(Visitor *v) override;
 
 private:
-  std::vector<std::unique_ptr<FunctionNode>> functions_;
+  std::vector<std::unique_ptr<Arena>> arenas_;
+  ArenaArray<FunctionNode *> functions_;
 };
 
 class Parser {
 public:
-  Parser(std::vector<Token> tokens) : tokens_(std::move(tokens)) {}
+  // Pulls tokens from the scanner as they are needed, so only the lookahead
+  // window is ever held. The scanner must outlive the parser.
+  Parser(Scanner &scanner)
+      : scanner_(&scanner), tokens_(scanner.tokens()),
+        arena_(std::make_unique<Arena>()) {}
+  // Replays an already scanned token stream, which isn't copied and must
+  // outlive the parser.
+  Parser(const TokenStream &tokens)
+      : tokens_(tokens), arena_(std::make_unique<Arena>()) {}
+
+  // Parses the next function or extern declaration, or returns nullptr at the
+  // end of the input. The node lives in the parser's arena until parse()
+  // hands it over with the rest of the program.
+  FunctionNode *parseFunction();
+  // Parses whatever is left and returns every function parsed so far.
   std::unique_ptr<Program> parse();
 
 private:
   std::optional<Token> getCurrentToken();
   std::optional<Token> getNextToken();
+  // looks offset tokens past the current one, offset < kLookahead
+  std::optional<Token> peekToken(size_t offset);
+  std::optional<Token> pullToken();
   Token expectedNextToken(TokenType type);
   void advance();
 
-  std::unique_ptr<FunctionNode> handleFunction();
-
-  std::unique_ptr<BodyNode> handleBody();
+  FunctionNode *handleFunction(bool is_extern);
+  FloatMode handleFloatMode(std::string_view function);
+  std::unique_ptr<Program> makeProgram();
+
+  BodyNode *handleBody();
+
+  ConditionalNode *handleConditional();
+  BranchHint handleBranchHint();
+  WhileNode *handleWhile();
+  ForNode *handleFor();
+  LoopHints handleLoopHints();
+  // the N of an annotation like unroll(N)
+  uint16_t handleHintCount(std::string_view hint);
+  ReturnNode *handleReturnStatement();
+  DefinitionNode *handleDefinition();
+  StoreNode *handleStore();
+
+  ExprNode *handleExpression();
+  ExprNode *handlePrimary();
+  // the i in xs[i], starting at the left bracket
+  ExprNode *handleIndex();
+  ExprNode *handleBinOpRHS(int32_t precedence, ExprNode *LHS);
+  // the type after a colon, or nullopt if there's no annotation
+  std::optional<ValueType> handleTypeAnnotation();
+  int32_t getBinOpPrecedence(Token bin_op);
 
-  std::unique_ptr<ConditionalNode> handleConditional();
-  std::unique_ptr<ReturnNode> handleReturnStatement();
-  std::unique_ptr<DefinitionNode> handleDefinition();
+  // copies scratch[start:] into the arena and pops it off the scratch stack
+  template <typename T>
+  ArenaArray<T> popScratch(std::vector<T> &scratch, size_t start) {
+    auto array =
+        arena_->copyArray(scratch.data() + start, scratch.size() - start);
+    scratch.resize(start);
+    return array;
+  }
 
-  std::unique_ptr<ExprNode> handleExpression();
-  std::unique_ptr<ExprNode> handlePrimary();
-  std::unique_ptr<ExprNode> handleBinOpRHS(int8_t precedence,
-                                           std::unique_ptr<ExprNode> LHS);
-  int32_t getBinOpPrecedence(Token bin_op);
+  static constexpr size_t kLookahead = 4;
 
+  // tokens [token_idx_, fetched_) are held in the ring buffer
+  std::optional<Token> lookahead_[kLookahead];
   size_t token_idx_ = 0;
-  std::vector<Token> tokens_;
+  size_t fetched_ = 0;
+  Scanner *scanner_ = nullptr;
+  // the replayed stream, or the scanner's identifier and number tables
+  const TokenStream &tokens_;
+  std::unique_ptr<Arena> arena_;
+  // children are collected on these stacks while a node is being parsed, so
+  // building the tree doesn't allocate a vector per node. nested nodes push
+  // on top and pop back off before their parent finishes.
+  std::vector<FunctionNode *> function_scratch_;
+  std::vector<BodySubNode *> block_scratch_;
+  std::vector<ExprNode *> arg_scratch_;
+  std::vector<std::string_view> name_scratch_;
+  std::vector<ValueType> type_scratch_;
 };
\ No newline at end of file
@@ -1,133 +1,513 @@
 #include "scanner.h"
+#include <charconv>
+#include <cstdlib>
 #include <iostream>
 #include <optional>
+#include <cstring>
 #include <stdexcept>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
 
-char Scanner::getChar() const { return source_.at(current_idx_); }
+namespace {
 
-bool Scanner::isAtEnd() const { return current_idx_ >= source_.length(); }
+enum CharClass : uint8_t {
+  cc_invalid,
+  cc_space,
+  cc_alpha,
+  cc_digit,
+  cc_comment,
+  // a token on its own, see CharTables::tokens
+  cc_single,
+  // < or >, which may be followed by =
+  cc_compare,
+};
 
-bool Scanner::isSpace() const { return getChar() == ' '; }
+struct CharTables {
+  CharClass classes[256];
+  TokenType tokens[256];
+};
 
-bool Scanner::isNewLine() const { return getChar() == '\n'; }
+constexpr CharTables makeCharTables() {
+  CharTables tables{};
+  for (int c = 0; c < 256; c++) {
+    tables.classes[c] = cc_invalid;
+    tables.tokens[c] = tok_eof;
+  }
+  for (int c : {' ', '\t', '\n', '\v', '\f', '\r'}) {
+    tables.classes[c] = cc_space;
+  }
+  for (int c = 'a'; c <= 'z'; c++) {
+    tables.classes[c] = cc_alpha;
+    tables.classes[c - 'a' + 'A'] = cc_alpha;
+  }
+  for (int c = '0'; c <= '9'; c++) {
+    tables.classes[c] = cc_digit;
+  }
+  tables.classes['#'] = cc_comment;
 
-std::optional<Token> Scanner::getToken() {
-  skipSpaces();
+  const std::pair<char, TokenType> singles[] = {
+      {'(', tok_lpar}, {')', tok_rpar}, {'{', tok_lbrak}, {'}', tok_rbrak},
+      {'+', tok_add},  {'-', tok_sub},  {'*', tok_mul},   {'/', tok_div},
+      {'%', tok_mod},  {',', tok_comma}, {'=', tok_equals},
+      {':', tok_colon}, {'[', tok_lsquare}, {']', tok_rsquare},
+  };
+  for (const auto &[c, type] : singles) {
+    tables.classes[static_cast<unsigned char>(c)] = cc_single;
+    tables.tokens[static_cast<unsigned char>(c)] = type;
+  }
+  tables.classes['<'] = cc_compare;
+  tables.tokens['<'] = tok_lt;
+  tables.classes['>'] = cc_compare;
+  tables.tokens['>'] = tok_gt;
+  return tables;
+}
 
-  if (isAtEnd()) {
-    return std::nullopt;
+constexpr CharTables kCharTables = makeCharTables();
+
+CharClass classOf(char c) {
+  return kCharTables.classes[static_cast<unsigned char>(c)];
+}
+
+struct Keyword {
+  std::string_view text;
+  TokenType type;
+};
+
+constexpr Keyword kKeywords[] = {
+    {"def", tok_def},   {"extern", tok_extern}, {"if", tok_if},
+    {"else", tok_else}, {"return", tok_return}, {"while", tok_while},
+    {"for", tok_for},
+};
+
+// keywords are looked up through a perfect hash: one slot computation and at
+// most one string compare per identifier. adding a keyword that collides will
+// trip the static_assert below, in which case tweak the hash.
+constexpr size_t kKeywordSlots = 16;
+
+constexpr size_t keywordSlot(std::string_view word) {
+  return (static_cast<unsigned char>(word.front()) +
+          3 * static_cast<unsigned char>(word.back()) + word.size()) %
+         kKeywordSlots;
+}
+
+struct KeywordTable {
+  // index into kKeywords plus one, zero for empty slots
+  uint8_t slots[kKeywordSlots];
+  bool perfect;
+};
+
+constexpr KeywordTable makeKeywordTable() {
+  KeywordTable table{};
+  table.perfect = true;
+  for (size_t i = 0; i < sizeof(kKeywords) / sizeof(kKeywords[0]); i++) {
+    size_t slot = keywordSlot(kKeywords[i].text);
+    if (table.slots[slot] != 0) {
+      table.perfect = false;
+    }
+    table.slots[slot] = static_cast<uint8_t>(i + 1);
+  }
+  return table;
+}
+
+constexpr KeywordTable kKeywordTable = makeKeywordTable();
+static_assert(kKeywordTable.perfect, "keyword hash has collisions");
+
+std::optional<TokenType> lookupKeyword(std::string_view word) {
+  uint8_t entry = kKeywordTable.slots[keywordSlot(word)];
+  if (entry != 0 && kKeywords[entry - 1].text == word) {
+    return kKeywords[entry - 1].type;
   }
+  return std::nullopt;
+}
+
+// The skip* helpers return the first character in [p, end) that isn't part of
+// the run. They go 16 bytes at a time where SIMD is available and finish the
+// tail through the class table.
+#if defined(__SSE2__)
+inline __m128i inRange(__m128i chars, char lo, char hi) {
+  __m128i offset = _mm_sub_epi8(chars, _mm_set1_epi8(lo));
+  __m128i span = _mm_set1_epi8(static_cast<char>(hi - lo));
+  return _mm_cmpeq_epi8(_mm_min_epu8(offset, span), offset);
+}
+
+inline int firstMiss(__m128i matches) {
+  unsigned mask = ~static_cast<unsigned>(_mm_movemask_epi8(matches)) & 0xffff;
+  return mask == 0 ? -1 : __builtin_ctz(mask);
+}
+
+inline int firstNonAlnum(const char *p) {
+  __m128i chars = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+  __m128i lower = _mm_or_si128(chars, _mm_set1_epi8(0x20));
+  return firstMiss(
+      _mm_or_si128(inRange(lower, 'a', 'z'), inRange(chars, '0', '9')));
+}
+
+inline int firstNonSpace(const char *p) {
+  __m128i chars = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+  return firstMiss(_mm_or_si128(inRange(chars, '\t', '\r'),
+                                _mm_cmpeq_epi8(chars, _mm_set1_epi8(' '))));
+}
+#elif defined(__ARM_NEON)
+inline uint8x16_t inRange(uint8x16_t chars, char lo, char hi) {
+  uint8x16_t offset = vsubq_u8(chars, vdupq_n_u8(static_cast<uint8_t>(lo)));
+  return vcleq_u8(offset, vdupq_n_u8(static_cast<uint8_t>(hi - lo)));
+}
+
+inline int firstMiss(uint8x16_t matches) {
+  // narrow each byte of the mask to a nibble, there's no movemask on NEON
+  uint8x8_t nibbles = vshrn_n_u16(vreinterpretq_u16_u8(vmvnq_u8(matches)), 4);
+  uint64_t mask = vget_lane_u64(vreinterpret_u64_u8(nibbles), 0);
+  return mask == 0 ? -1 : __builtin_ctzll(mask) / 4;
+}
+
+inline int firstNonAlnum(const char *p) {
+  uint8x16_t chars = vld1q_u8(reinterpret_cast<const uint8_t *>(p));
+  uint8x16_t lower = vorrq_u8(chars, vdupq_n_u8(0x20));
+  return firstMiss(
+      vorrq_u8(inRange(lower, 'a', 'z'), inRange(chars, '0', '9')));
+}
 
-  if (isalpha(getChar())) {
-    std::string identifier_string;
-    identifier_string += getChar();
-    current_idx_ += 1;
-    while (!isAtEnd() && isalnum(getChar())) {
-      identifier_string += getChar();
-      current_idx_ += 1;
+inline int firstNonSpace(const char *p) {
+  uint8x16_t chars = vld1q_u8(reinterpret_cast<const uint8_t *>(p));
+  return firstMiss(vorrq_u8(inRange(chars, '\t', '\r'),
+                            vceqq_u8(chars, vdupq_n_u8(' '))));
+}
+#endif
+
+const char *skipAlnum(const char *p, const char *end) {
+#if defined(__SSE2__) || defined(__ARM_NEON)
+  while (end - p >= 16) {
+    int miss = firstNonAlnum(p);
+    if (miss >= 0) {
+      return p + miss;
     }
+    p += 16;
+  }
+#endif
+  while (p < end && (classOf(*p) == cc_alpha || classOf(*p) == cc_digit)) {
+    p++;
+  }
+  return p;
+}
 
-    if (identifier_string == "def") {
-      return Token(TokenType::tok_def);
-    } else if (identifier_string == "extern") {
-      return Token(TokenType::tok_extern);
-    } else if (identifier_string == "if") {
-      return Token(TokenType::tok_if);
-    } else if (identifier_string == "else") {
-      return Token(TokenType::tok_else);
-    } else if (identifier_string == "return") {
-      return Token(TokenType::tok_return);
+const char *skipSpace(const char *p, const char *end) {
+#if defined(__SSE2__) || defined(__ARM_NEON)
+  while (end - p >= 16) {
+    int miss = firstNonSpace(p);
+    if (miss >= 0) {
+      return p + miss;
     }
-    return Token(TokenType::tok_identifier, identifier_string);
-  } else if (isdigit(getChar())) {
-    std::string number_string;
-    number_string += getChar();
-    current_idx_ += 1;
-    while (!isAtEnd() && isdigit(getChar())) {
-      number_string += getChar();
-      current_idx_ += 1;
+    p += 16;
+  }
+#endif
+  while (p < end && classOf(*p) == cc_space) {
+    p++;
+  }
+  return p;
+}
+
+const char *skipDigits(const char *p, const char *end) {
+  while (p < end && classOf(*p) == cc_digit) {
+    p++;
+  }
+  return p;
+}
+
+double parseDouble(const char *first, const char *last) {
+#if defined(__cpp_lib_to_chars)
+  double value = 0;
+  auto result = std::from_chars(first, last, value);
+  if (result.ec != std::errc() || result.ptr != last) {
+    throw std::runtime_error("Malformed number literal");
+  }
+  return value;
+#else
+  // no floating point from_chars in this standard library. most literals have
+  // few enough digits that mantissa * 10^exponent is exact in a double, the
+  // rest go through strtod
+  static const double powers_of_ten[] = {
+      1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+      1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+  uint64_t mantissa = 0;
+  int digits = 0;
+  int exponent = 0;
+  const char *p = first;
+  for (; p < last && classOf(*p) == cc_digit; p++, digits++) {
+    mantissa = mantissa * 10 + (*p - '0');
+  }
+  if (p < last && *p == '.') {
+    for (p++; p < last && classOf(*p) == cc_digit; p++, digits++) {
+      mantissa = mantissa * 10 + (*p - '0');
+      exponent--;
     }
+  }
+  if (p < last) {
+    int explicit_exponent = 0;
+    std::from_chars(p[1] == '+' ? p + 2 : p + 1, last, explicit_exponent);
+    exponent += explicit_exponent;
+  }
+  if (digits <= 15 && exponent >= -22 && exponent <= 22) {
+    double value = static_cast<double>(mantissa);
+    return exponent < 0 ? value / powers_of_ten[-exponent]
+                        : value * powers_of_ten[exponent];
+  }
+  char buffer[128];
+  std::string long_literal;
+  const char *terminated = buffer;
+  if (last - first < static_cast<ptrdiff_t>(sizeof(buffer))) {
+    std::memcpy(buffer, first, last - first);
+    buffer[last - first] = '\0';
+  } else {
+    long_literal.assign(first, last);
+    terminated = long_literal.c_str();
+  }
+  return std::strtod(terminated, nullptr);
+#endif
+}
+
+const char *skipLine(const char *p, const char *end) {
+  // libc's memchr is already vectorized
+  const void *newline = std::memchr(p, '\n', end - p);
+  return newline ? static_cast<const char *>(newline) : end;
+}
 
-    if (getChar() == '.') {
-      number_string += getChar();
-      current_idx_ += 1;
-      while (!isAtEnd() && isdigit(getChar())) {
-        number_string += getChar();
-        current_idx_ += 1;
+} // namespace
+
+namespace {
+
+uint32_t hashIdentifier(std::string_view name) {
+  // FNV-1a, identifiers are short
+  uint32_t hash = 2166136261u;
+  for (char c : name) {
+    hash = (hash ^ static_cast<unsigned char>(c)) * 16777619u;
+  }
+  return hash;
+}
+
+} // namespace
+
+uint32_t IdentifierTable::intern(std::string_view name) {
+  uint32_t hash = hashIdentifier(name);
+  size_t mask = slots_.size() - 1;
+  for (size_t slot = hash & mask;; slot = (slot + 1) & mask) {
+    uint32_t entry = slots_[slot];
+    if (entry == 0) {
+      uint32_t id = static_cast<uint32_t>(names_.size());
+      slots_[slot] = id + 1;
+      names_.push_back(name);
+      hashes_.push_back(hash);
+      if (names_.size() * 2 > slots_.size()) {
+        grow();
       }
+      return id;
+    }
+    if (hashes_[entry - 1] == hash && names_[entry - 1] == name) {
+      return entry - 1;
+    }
+  }
+}
+
+void IdentifierTable::grow() {
+  std::vector<uint32_t> slots(slots_.size() * 2, 0);
+  size_t mask = slots.size() - 1;
+  for (uint32_t id = 0; id < names_.size(); id++) {
+    size_t slot = hashes_[id] & mask;
+    while (slots[slot] != 0) {
+      slot = (slot + 1) & mask;
+    }
+    slots[slot] = id + 1;
+  }
+  slots_ = std::move(slots);
+}
+
+Token TokenStream::makeNumber(const NumberLiteral &literal) {
+  NumberKey key{literal.kind, static_cast<uint64_t>(literal.integer)};
+  if (!literal.isInteger()) {
+    std::memcpy(&key.bits, &literal.value, sizeof(key.bits));
+  }
+  auto [it, inserted] =
+      number_ids_.emplace(key, static_cast<uint32_t>(numbers_.size()));
+  if (inserted) {
+    numbers_.push_back(literal);
+  }
+  return Token(tok_number, it->second);
+}
+
+std::string TokenStream::toString(Token token) const {
+  if (token.getType() == tok_identifier) {
+    return std::string(getIdentifier(token));
+  } else if (token.getType() == tok_number) {
+    return std::to_string(getNumber(token));
+  }
+  std::string type = "";
+  switch (token.getType()) {
+  case tok_lt:
+    type = "less than";
+    break;
+  case tok_gt:
+    type = "greater than";
+    break;
+  case tok_lte:
+    type = "less than equal";
+    break;
+  case tok_lbrak:
+    type = "left bracket";
+    break;
+  case tok_lpar:
+    type = "left paren";
+    break;
+  case tok_if:
+    type = "if";
+    break;
+  default:
+    break;
+  }
+  if (type.size() == 0) {
+    return "Token: " + std::to_string(token.getType());
+  }
+  return "Token: " + type;
+}
+
+void Scanner::skipSpacesAndComments() {
+  while (true) {
+    current_ = skipSpace(current_, end_);
+    if (isAtEnd() || classOf(*current_) != cc_comment) {
+      return;
+    }
+    current_ = skipLine(current_, end_);
+  }
+}
+
+Token Scanner::scanIdentifier() {
+  const char *start = current_;
+  current_ = skipAlnum(current_ + 1, end_);
+  std::string_view identifier(start, current_ - start);
+  if (auto keyword = lookupKeyword(identifier)) {
+    return Token(*keyword);
+  }
+  return tokens_.makeIdentifier(identifier);
+}
+
+NumberKind Scanner::scanNumberSuffix(bool is_integer) {
+  const char *start = current_;
+  current_ = skipAlnum(current_, end_);
+  std::string_view suffix(start, current_ - start);
+  if (suffix.empty()) {
+    return is_integer ? num_integer : num_float;
+  } else if (suffix == "f32") {
+    return num_f32;
+  } else if (suffix == "f64") {
+    return num_f64;
+  } else if (is_integer && suffix == "i32") {
+    return num_i32;
+  } else if (is_integer && suffix == "i64") {
+    return num_i64;
+  }
+  throw std::runtime_error("Invalid suffix on number literal");
+}
+
+Token Scanner::scanNumber() {
+  const char *start = current_;
+  NumberLiteral literal{};
+
+  bool is_hex = end_ - current_ > 2 && current_[0] == '0' &&
+                (current_[1] == 'x' || current_[1] == 'X');
+  if (is_hex) {
+    uint64_t value = 0;
+    auto result = std::from_chars(current_ + 2, end_, value, 16);
+    if (result.ec != std::errc()) {
+      throw std::runtime_error("Malformed hex literal");
     }
+    current_ = result.ptr;
+    literal.kind = scanNumberSuffix(/*is_integer=*/true);
+    if (!literal.isInteger()) {
+      throw std::runtime_error("Hex literals are integers");
+    }
+    literal.integer = static_cast<int64_t>(value);
+    literal.value = static_cast<double>(value);
+    return tokens_.makeNumber(literal);
+  }
 
-    return Token(TokenType::tok_number, std::stod(number_string));
-  } else if (getChar() == '#') {
-    // TODO(kunal): make a helper method to skip line
-    current_idx_ += 1;
-    while (!isAtEnd() && !isNewLine()) {
-      current_idx_ += 1;
+  bool is_integer = true;
+  current_ = skipDigits(current_, end_);
+  if (current_ < end_ && *current_ == '.') {
+    is_integer = false;
+    current_ = skipDigits(current_ + 1, end_);
+  }
+  if (current_ < end_ && (*current_ == 'e' || *current_ == 'E')) {
+    is_integer = false;
+    const char *exponent = current_ + 1;
+    if (exponent < end_ && (*exponent == '+' || *exponent == '-')) {
+      exponent++;
     }
-    return getToken();
-  } else if (getChar() == '(') {
-    current_idx_ += 1;
-    return Token(TokenType::tok_lpar);
-  } else if (getChar() == ')') {
-    current_idx_ += 1;
-    return Token(TokenType::tok_rpar);
-  } else if (getChar() == '{') {
-    current_idx_ += 1;
-    return Token(TokenType::tok_lbrak);
-  } else if (getChar() == '}') {
-    current_idx_ += 1;
-    return Token(TokenType::tok_rbrak);
-  } else if (getChar() == '<') {
-    current_idx_ += 1;
-    if (!isAtEnd() && getChar() == '=') {
-      current_idx_ += 1;
-      return Token(TokenType::tok_lte);
+    current_ = skipDigits(exponent, end_);
+    if (current_ == exponent) {
+      throw std::runtime_error("Missing exponent in number literal");
     }
-    return Token(TokenType::tok_lt);
-  } else if (getChar() == '>') {
-    current_idx_ += 1;
-    if (!isAtEnd() && getChar() == '=') {
-      current_idx_ += 1;
-      return Token(TokenType::tok_gte);
+  }
+  const char *digits_end = current_;
+
+  literal.kind = scanNumberSuffix(is_integer);
+  if (literal.isInteger()) {
+    auto result = std::from_chars(start, digits_end, literal.integer);
+    if (result.ec != std::errc()) {
+      throw std::runtime_error("Integer literal out of range");
     }
-    return Token(TokenType::tok_gt);
-  } else if (getChar() == '+') {
-    current_idx_ += 1;
-    return Token(TokenType::tok_add);
-  } else if (getChar() == '-') {
-    current_idx_ += 1;
-    return Token(TokenType::tok_sub);
-  } else if (getChar() == '*') {
-    current_idx_ += 1;
-    return Token(TokenType::tok_mul);
-  } else if (getChar() == '/') {
-    current_idx_ += 1;
-    return Token(TokenType::tok_div);
-  } else if (getChar() == '%') {
-    current_idx_ += 1;
-    return Token(TokenType::tok_div);
-  } else if (getChar() == ',') {
-    current_idx_ += 1;
-    return Token(TokenType::tok_comma);
-  } else if (getChar() == '=') {
-    current_idx_ += 1;
-    return Token(TokenType::tok_equals);
-  }
-  throw std::runtime_error("Unidentified char");
-}
-
-void Scanner::skipSpaces() {
-  while (!isAtEnd() && isspace(source_.at(current_idx_))) {
-    current_idx_ += 1;
+    literal.value = static_cast<double>(literal.integer);
+  } else {
+    literal.value = parseDouble(start, digits_end);
   }
+  return tokens_.makeNumber(literal);
 }
 
-void Scanner::scanTokens() {
-  while (!isAtEnd()) {
-    auto token = getToken();
-    if (token) {
-      tokens_.push_back(*token);
+std::optional<Token> Scanner::getToken() {
+  skipSpacesAndComments();
+
+  if (isAtEnd()) {
+    return std::nullopt;
+  }
+
+  char c = *current_;
+  switch (classOf(c)) {
+  case cc_alpha:
+    return scanIdentifier();
+  case cc_digit:
+    return scanNumber();
+  case cc_single:
+    current_++;
+    return Token(kCharTables.tokens[static_cast<unsigned char>(c)]);
+  case cc_compare: {
+    current_++;
+    bool or_equal = current_ < end_ && *current_ == '=';
+    if (or_equal) {
+      current_++;
+    }
+    if (c == '<') {
+      return Token(or_equal ? tok_lte : tok_lt);
     }
+    return Token(or_equal ? tok_gte : tok_gt);
+  }
+  default:
+    throw std::runtime_error("Unidentified char");
+  }
+}
+
+std::optional<Token> Scanner::nextToken() {
+  if (auto token = getToken()) {
+    return token;
+  }
+  if (eof_scanned_) {
+    return std::nullopt;
+  }
+  eof_scanned_ = true;
+  return Token(TokenType::tok_eof);
+}
+
+void Scanner::scanTokens() {
+  while (auto token = nextToken()) {
+    tokens_.push_back(*token);
   }
-  tokens_.push_back(Token(TokenType::tok_eof));
 }
@@ -1,8 +1,11 @@
 #pragma once
 
+#include <cstdint>
 #include <iostream>
 #include <optional>
 #include <string>
+#include <string_view>
+#include <unordered_map>
 #include <vector>
 
 enum TokenType {
@@ -13,6 +16,8 @@ enum TokenType {
   tok_if,
   tok_else,
   tok_return,
+  tok_while,
+  tok_for,
 
   // variables
   tok_identifier,
@@ -25,7 +30,10 @@ enum TokenType {
   tok_lpar,
   tok_rbrak,
   tok_lbrak,
+  tok_rsquare,
+  tok_lsquare,
   tok_comma,
+  tok_colon,
 
   // assignment
   tok_equals,
@@ -44,91 +52,150 @@ enum TokenType {
   tok_mod,
 };
 
+enum NumberKind {
+  // unsuffixed literals
+  num_float,   // has a fraction or an exponent, e.g. 1.5 or 1e3
+  num_integer, // plain decimal or hex digits, e.g. 42 or 0x2a
+  // suffixed literals, e.g. 42i64 or 1.5f32
+  num_i32,
+  num_i64,
+  num_f32,
+  num_f64,
+};
+
+struct NumberLiteral {
+  NumberKind kind;
+  double value;
+  // exact value for integer kinds, which may not be representable as a double
+  int64_t integer;
+
+  bool isInteger() const {
+    return kind == num_integer || kind == num_i32 || kind == num_i64;
+  }
+};
+
+// Tokens are packed into 8 bytes: the type plus a 32 bit payload. For
+// tok_identifier the payload is the interned identifier's id, for tok_number
+// it's the index of the value in the number table, so comparing two tokens
+// from the same stream never touches the source text.
 class Token {
 
 public:
-  Token(TokenType type) : type_(type) {}
-  Token(TokenType type, std::string identifier)
-      : type_(type), identifier_(identifier) {}
-  Token(TokenType type, double number) : type_(type), number_(number) {}
+  Token(TokenType type, uint32_t payload = 0)
+      : type_(type), payload_(payload) {}
 
   bool operator!=(const Token &other) const { return !this->equals(other); }
   bool operator==(const Token &other) const { return this->equals(other); }
 
-  const bool equals(const Token &other) const {
-    if (other.getType() != getType()) {
-      return false;
-    }
+  bool equals(const Token &other) const {
+    return other.getType() == getType() && other.getPayload() == getPayload();
+  }
+  TokenType getType() const { return type_; }
+  uint32_t getPayload() const { return payload_; }
 
-    TokenType type = getType();
-    if (getType() == tok_identifier) {
-      return other.getIdentifier() == getIdentifier();
-    } else if (getType() == tok_number) {
-      return other.getNumber() == getNumber();
-    }
-    return true;
+private:
+  TokenType type_;
+  uint32_t payload_;
+};
+static_assert(sizeof(Token) == 8, "tokens should stay packed");
+
+// Maps every distinct identifier to a dense id. The names are views into the
+// scanned source, nothing is copied. Interning happens once per identifier
+// token, so this is an open addressing table rather than a node based map.
+class IdentifierTable {
+public:
+  uint32_t intern(std::string_view name);
+  std::string_view get(uint32_t id) const { return names_[id]; }
+  size_t size() const { return names_.size(); }
+
+private:
+  void grow();
+
+  // id + 1 of the identifier in each slot, zero for empty slots
+  std::vector<uint32_t> slots_ = std::vector<uint32_t>(64, 0);
+  std::vector<std::string_view> names_;
+  std::vector<uint32_t> hashes_;
+};
+
+// Columnar storage for a scanned file: one byte of type and four bytes of
+// payload per token, with identifiers and number literals in side tables.
+class TokenStream {
+public:
+  void push_back(Token token) {
+    types_.push_back(static_cast<uint8_t>(token.getType()));
+    payloads_.push_back(token.getPayload());
   }
-  const TokenType getType() const { return type_; }
-  const std::string getIdentifier() const { return identifier_; }
-  const double getNumber() const { return number_; }
-  const std::string toString() const {
-    if (getType() == tok_identifier) {
-      return getIdentifier();
-    } else if (getType() == tok_number) {
-      return std::to_string(getNumber());
-    }
-    std::string type = "";
-    switch (getType()) {
-    case tok_lt:
-      type = "less than";
-      break;
-    case tok_gt:
-      type = "greater than";
-      break;
-    case tok_lte:
-      type = "less than equal";
-      break;
-    case tok_lbrak:
-      type = "left bracket";
-      break;
-    case tok_lpar:
-      type = "left paren";
-      break;
-    case tok_if:
-      type = "if";
-      break;
-    default:
-      break;
-    }
-    if (type.size() == 0) {
-      return "Token: " + std::to_string(getType());
-    }
-    return "Token: " + type;
+  Token operator[](size_t idx) const {
+    return Token(static_cast<TokenType>(types_[idx]), payloads_[idx]);
+  }
+  size_t size() const { return types_.size(); }
+
+  Token makeIdentifier(std::string_view name) {
+    return Token(tok_identifier, identifiers_.intern(name));
+  }
+  Token makeNumber(const NumberLiteral &literal);
+
+  std::string_view getIdentifier(Token token) const {
+    return identifiers_.get(token.getPayload());
+  }
+  double getNumber(Token token) const {
+    return numbers_[token.getPayload()].value;
   }
+  const NumberLiteral &getNumberLiteral(Token token) const {
+    return numbers_[token.getPayload()];
+  }
+  const IdentifierTable &identifiers() const { return identifiers_; }
+
+  std::string toString(Token token) const;
 
 private:
-  const TokenType type_;
-  const std::string identifier_ = ""; // filled in if type tok_identifier
-  const double number_ = 0;           // filled in if type tok_number
+  std::vector<uint8_t> types_;
+  std::vector<uint32_t> payloads_;
+  IdentifierTable identifiers_;
+  struct NumberKey {
+    NumberKind kind;
+    uint64_t bits;
+    bool operator==(const NumberKey &other) const {
+      return kind == other.kind && bits == other.bits;
+    }
+  };
+  struct NumberKeyHash {
+    size_t operator()(const NumberKey &key) const {
+      return std::hash<uint64_t>()(key.bits) ^ key.kind;
+    }
+  };
+
+  std::vector<NumberLiteral> numbers_;
+  // keyed by kind and bit pattern so equal literals share a payload
+  std::unordered_map<NumberKey, uint32_t, NumberKeyHash> number_ids_;
 };
 
 class Scanner {
 public:
-  Scanner(std::string source) : source_(source) {}
+  // the scanner doesn't copy the source, it must outlive the scanner and the
+  // tokens it produces
+  Scanner(std::string_view source)
+      : source_(source), current_(source.data()),
+        end_(source.data() + source.size()) {}
   void scanTokens();
-  const std::vector<Token> &tokens() { return tokens_; }
+  // Scans a single token without appending it to tokens(), whose identifier
+  // and number tables are still used to resolve its payload. Returns tok_eof
+  // once at the end of the source and nothing after that.
+  std::optional<Token> nextToken();
+  const TokenStream &tokens() const { return tokens_; }
 
 private:
-  void skipSpaces();
+  void skipSpacesAndComments();
   std::optional<Token> getToken();
+  Token scanIdentifier();
+  Token scanNumber();
+  NumberKind scanNumberSuffix(bool is_integer);
 
-  char getChar() const;
-
-  bool isSpace() const;
-  bool isAtEnd() const;
-  bool isNewLine() const;
+  bool isAtEnd() const { return current_ >= end_; }
 
-  const std::string source_;
-  uint32_t current_idx_ = 0;
-  std::vector<Token> tokens_;
+  const std::string_view source_;
+  const char *current_;
+  const char *end_;
+  bool eof_scanned_ = false;
+  TokenStream tokens_;
 };
\ No newline at end of file
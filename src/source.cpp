@@ -0,0 +1,45 @@
+#include "source.h"
+
+#include <fcntl.h>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+SourceFile::SourceFile(void *mapping, size_t size)
+    : mapping_(mapping), size_(size),
+      contents_(static_cast<const char *>(mapping), size) {}
+
+SourceFile::~SourceFile() {
+  if (mapping_) {
+    munmap(mapping_, size_);
+  }
+}
+
+std::unique_ptr<SourceFile> SourceFile::open(const std::string &path) {
+  int fd = ::open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    throw std::runtime_error("Could not open " + path);
+  }
+
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    ::close(fd);
+    throw std::runtime_error("Could not stat " + path);
+  }
+
+  size_t size = static_cast<size_t>(st.st_size);
+  void *mapping = nullptr;
+  // mmap rejects zero-length mappings, an empty file is just an empty view
+  if (size > 0) {
+    mapping = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (mapping == MAP_FAILED) {
+      ::close(fd);
+      throw std::runtime_error("Could not map " + path);
+    }
+    madvise(mapping, size, MADV_SEQUENTIAL);
+  }
+  ::close(fd);
+
+  return std::unique_ptr<SourceFile>(new SourceFile(mapping, size));
+}
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <string_view>
+
+// Read-only memory mapping of a source file. The scanner works directly on
+// the mapped bytes, and identifier tokens point into the mapping, so it must
+// outlive the scanner and anything built from its tokens.
+class SourceFile {
+public:
+  static std::unique_ptr<SourceFile> open(const std::string &path);
+  ~SourceFile();
+
+  SourceFile(const SourceFile &) = delete;
+  SourceFile &operator=(const SourceFile &) = delete;
+
+  std::string_view contents() const { return contents_; }
+
+private:
+  SourceFile(void *mapping, size_t size);
+
+  void *mapping_;
+  size_t size_;
+  std::string_view contents_;
+};
@@ -0,0 +1,109 @@
+#include "ssa.h"
+#include "llvm/IR/CFG.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/IRBuilder.h"
+
+llvm::Value *SsaBuilder::readVariable(Variable variable,
+                                      llvm::BasicBlock *block) {
+  auto def = current_defs_.find({variable, block});
+  if (def != current_defs_.end() && def->second) {
+    return def->second;
+  }
+  return readVariableRecursive(variable, block);
+}
+
+llvm::Value *SsaBuilder::readVariableRecursive(Variable variable,
+                                               llvm::BasicBlock *block) {
+  llvm::Value *value;
+  if (!sealed_blocks_.count(block)) {
+    // not all predecessors are known yet, the operands are added on sealing
+    llvm::PHINode *phi = createPhi(variable, block);
+    incomplete_phis_[block].push_back({variable, phi});
+    value = phi;
+  } else if (llvm::BasicBlock *predecessor = block->getSinglePredecessor()) {
+    // no phi needed
+    value = readVariable(variable, predecessor);
+  } else if (llvm::pred_empty(block)) {
+    // the entry block, the variable isn't defined on this path
+    value = llvm::UndefValue::get(types_[variable]);
+  } else {
+    // the phi is recorded before its operands are read, which ends the
+    // recursion around loops
+    llvm::PHINode *phi = createPhi(variable, block);
+    writeVariable(variable, block, phi);
+    value = addPhiOperands(variable, phi);
+  }
+  writeVariable(variable, block, value);
+  return value;
+}
+
+llvm::PHINode *SsaBuilder::createPhi(Variable variable,
+                                     llvm::BasicBlock *block) {
+  llvm::IRBuilder<> builder(block, block->begin());
+  return builder.CreatePHI(types_[variable], 0);
+}
+
+llvm::Value *SsaBuilder::addPhiOperands(Variable variable,
+                                        llvm::PHINode *phi) {
+  for (llvm::BasicBlock *predecessor : llvm::predecessors(phi->getParent())) {
+    phi->addIncoming(readVariable(variable, predecessor), predecessor);
+  }
+  return tryRemoveTrivialPhi(phi);
+}
+
+llvm::Value *SsaBuilder::tryRemoveTrivialPhi(llvm::PHINode *phi) {
+  llvm::Value *same = nullptr;
+  for (llvm::Value *operand : phi->incoming_values()) {
+    if (operand == same || operand == phi) {
+      continue;
+    }
+    if (same) {
+      // merges at least two values
+      return phi;
+    }
+    same = operand;
+  }
+  if (!same) {
+    // unreachable, or only reachable from itself
+    same = llvm::UndefValue::get(phi->getType());
+  }
+
+  llvm::SmallVector<llvm::WeakVH, 8> users;
+  for (llvm::User *user : phi->users()) {
+    if (user != phi && llvm::isa<llvm::PHINode>(user)) {
+      users.push_back(user);
+    }
+  }
+  phi->replaceAllUsesWith(same);
+  phi->eraseFromParent();
+
+  // users that were phis may have become trivial now, and removing them may
+  // in turn replace same itself, which the tracking handle follows
+  llvm::WeakTrackingVH result(same);
+  for (llvm::WeakVH &user : users) {
+    if (auto *user_phi = llvm::dyn_cast_or_null<llvm::PHINode>(user)) {
+      tryRemoveTrivialPhi(user_phi);
+    }
+  }
+  return result;
+}
+
+void SsaBuilder::sealBlock(llvm::BasicBlock *block) {
+  sealed_blocks_.insert(block);
+  auto incomplete = incomplete_phis_.find(block);
+  if (incomplete == incomplete_phis_.end()) {
+    return;
+  }
+  auto phis = std::move(incomplete->second);
+  incomplete_phis_.erase(incomplete);
+  for (auto [variable, phi] : phis) {
+    addPhiOperands(variable, phi);
+  }
+}
+
+void SsaBuilder::clear() {
+  types_.clear();
+  current_defs_.clear();
+  incomplete_phis_.clear();
+  sealed_blocks_.clear();
+}
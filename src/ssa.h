@@ -0,0 +1,63 @@
+#pragma once
+
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/IR/BasicBlock.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/ValueHandle.h"
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+// Builds SSA form directly while code is generated, following "Simple and
+// Efficient Construction of Static Single Assignment Form" (Braun et al.).
+// Every write to a variable is recorded as the variable's current value in
+// the block it happens in. A read looks the value up in the current block
+// and otherwise walks up the predecessors, placing phis at joins on the way.
+//
+// A block is sealed once all of its predecessors have been emitted. Reads in
+// a block that isn't sealed yet, e.g. a loop header before its back edge
+// exists, get an operandless phi that is filled in when the block is sealed.
+// Phis that turn out to merge only one value are removed again.
+class SsaBuilder {
+public:
+  using Variable = uint32_t;
+
+  Variable addVariable(llvm::Type *type) {
+    types_.push_back(type);
+    return types_.size() - 1;
+  }
+  // variables are numbered in the order they were added
+  size_t variableCount() const { return types_.size(); }
+
+  void writeVariable(Variable variable, llvm::BasicBlock *block,
+                     llvm::Value *value) {
+    current_defs_[{variable, block}] = value;
+  }
+  llvm::Value *readVariable(Variable variable, llvm::BasicBlock *block);
+
+  // all predecessors of the block are known from here on
+  void sealBlock(llvm::BasicBlock *block);
+
+  // forgets everything, e.g. before the next function
+  void clear();
+
+private:
+  llvm::Value *readVariableRecursive(Variable variable,
+                                     llvm::BasicBlock *block);
+  llvm::PHINode *createPhi(Variable variable, llvm::BasicBlock *block);
+  llvm::Value *addPhiOperands(Variable variable, llvm::PHINode *phi);
+  llvm::Value *tryRemoveTrivialPhi(llvm::PHINode *phi);
+
+  std::vector<llvm::Type *> types_;
+  // tracking handles, so values that removed phis are replaced with are
+  // picked up
+  llvm::DenseMap<std::pair<Variable, llvm::BasicBlock *>,
+                 llvm::WeakTrackingVH>
+      current_defs_;
+  llvm::DenseMap<llvm::BasicBlock *,
+                 llvm::SmallVector<std::pair<Variable, llvm::PHINode *>, 4>>
+      incomplete_phis_;
+  llvm::SmallPtrSet<llvm::BasicBlock *, 16> sealed_blocks_;
+};
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <utility>
+#include <vector>
+
+// Names visible at the current point of a function, keyed by interned name
+// ids. Every name id maps straight to its innermost declaration, so a lookup
+// sees through all enclosing scopes with a single index. Declaring a name
+// pushes whatever it shadowed onto one undo log shared by all scopes, and
+// leaving a scope rolls the log back to where the scope started. Scopes
+// themselves are just a position in the log and don't allocate.
+template <typename T> class SymbolTable {
+public:
+  void pushScope() { scope_starts_.push_back(shadowed_.size()); }
+
+  void popScope() {
+    size_t start = scope_starts_.back();
+    scope_starts_.pop_back();
+    while (shadowed_.size() > start) {
+      auto &[id, previous] = shadowed_.back();
+      bindings_[id] = previous;
+      shadowed_.pop_back();
+    }
+  }
+
+  // binds the name in the innermost scope, shadowing any outer binding
+  void declare(uint32_t id, T value) {
+    if (id >= bindings_.size()) {
+      bindings_.resize(id + 1);
+    }
+    shadowed_.emplace_back(id, bindings_[id]);
+    bindings_[id] = value;
+  }
+
+  // the innermost binding of the name, or nullptr if it isn't visible
+  const T *lookup(uint32_t id) const {
+    if (id >= bindings_.size() || !bindings_[id]) {
+      return nullptr;
+    }
+    return &*bindings_[id];
+  }
+
+  size_t depth() const { return scope_starts_.size(); }
+
+private:
+  std::vector<std::optional<T>> bindings_;
+  // name id and the binding it had before each declaration, in order
+  std::vector<std::pair<uint32_t, std::optional<T>>> shadowed_;
+  std::vector<size_t> scope_starts_;
+};
@@ -0,0 +1,80 @@
+#include "target.h"
+#include "llvm/Config/llvm-config.h"
+#include "llvm/MC/TargetRegistry.h"
+#include "llvm/Support/TargetSelect.h"
+#include <iostream>
+#include <mutex>
+#if LLVM_VERSION_MAJOR >= 17
+#include "llvm/TargetParser/Host.h"
+#else
+#include "llvm/Support/Host.h"
+#endif
+
+namespace {
+
+std::string hostFeatures() {
+#if LLVM_VERSION_MAJOR >= 19
+  auto features = llvm::sys::getHostCPUFeatures();
+#else
+  llvm::StringMap<bool> features;
+  llvm::sys::getHostCPUFeatures(features);
+#endif
+  std::string feature_string;
+  for (const auto &feature : features) {
+    if (!feature_string.empty()) {
+      feature_string += ",";
+    }
+    feature_string += (feature.getValue() ? "+" : "-");
+    feature_string += feature.getKey().str();
+  }
+  return feature_string;
+}
+
+} // namespace
+
+std::unique_ptr<llvm::TargetMachine> createHostTargetMachine() {
+  // target machines get created on compile threads, registering the target
+  // isn't thread safe
+  static std::once_flag initialized;
+  std::call_once(initialized, [] {
+    llvm::InitializeNativeTarget();
+    llvm::InitializeNativeTargetAsmPrinter();
+    llvm::InitializeNativeTargetAsmParser();
+  });
+
+  std::string triple = llvm::sys::getProcessTriple();
+  std::string error;
+  const llvm::Target *target =
+      llvm::TargetRegistry::lookupTarget(triple, error);
+  if (!target) {
+    std::cout << "Could not find target for " << triple << ": " << error
+              << std::endl;
+    exit(1);
+  }
+
+#if LLVM_VERSION_MAJOR >= 18
+  auto opt_level = llvm::CodeGenOptLevel::Aggressive;
+#else
+  auto opt_level = llvm::CodeGenOpt::Aggressive;
+#endif
+  llvm::TargetOptions options;
+  // PIC so that the same object can go into a shared library
+  return std::unique_ptr<llvm::TargetMachine>(target->createTargetMachine(
+#if LLVM_VERSION_MAJOR >= 21
+      llvm::Triple(triple),
+#else
+      triple,
+#endif
+      llvm::sys::getHostCPUName(), hostFeatures(), options, llvm::Reloc::PIC_,
+      {}, opt_level));
+}
+
+void configureModuleForTarget(llvm::Module &module,
+                              const llvm::TargetMachine &target_machine) {
+#if LLVM_VERSION_MAJOR >= 21
+  module.setTargetTriple(target_machine.getTargetTriple());
+#else
+  module.setTargetTriple(target_machine.getTargetTriple().str());
+#endif
+  module.setDataLayout(target_machine.createDataLayout());
+}
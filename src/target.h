@@ -0,0 +1,14 @@
+#pragma once
+
+#include "llvm/IR/Module.h"
+#include "llvm/Target/TargetMachine.h"
+#include <memory>
+
+// Target machine for the host, with the host CPU's name and feature set
+// (the equivalent of -march=native).
+std::unique_ptr<llvm::TargetMachine> createHostTargetMachine();
+
+// Stamps the module with the target's triple and data layout so that the
+// optimizer can use target-aware cost models.
+void configureModuleForTarget(llvm::Module &module,
+                              const llvm::TargetMachine &target_machine);
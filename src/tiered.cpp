@@ -0,0 +1,258 @@
+#include "tiered.h"
+#include "numeric.h"
+
+#include <iostream>
+#include <string>
+
+namespace {
+
+// whether codegen can lower everything in the expression or body. the names
+// of the functions it calls are added to callees, compiled code calls their
+// compiled code so they have to be lowerable too.
+bool isLowerable(const ExprNode *expr,
+                 std::vector<std::string_view> &callees) {
+  switch (expr->getExprNodeType()) {
+  case ExprNode::BinaryExprNode: {
+    const auto *binary = static_cast<const BinaryExprNode *>(expr);
+    switch (binary->getOperator()) {
+    case tok_add:
+    case tok_sub:
+    case tok_mul:
+    case tok_div:
+    case tok_mod:
+    case tok_lt:
+    case tok_gt:
+    case tok_lte:
+    case tok_gte:
+      return isLowerable(binary->getLHS(), callees) &&
+             isLowerable(binary->getRHS(), callees);
+    default:
+      return false;
+    }
+  }
+  case ExprNode::NumberLiteralNode:
+  case ExprNode::IdentifierExprNode:
+    return true;
+  case ExprNode::FunctionCallExprNode: {
+    const auto *call = static_cast<const FunctionCallExprNode *>(expr);
+    if (call->getCallKind() == call_length) {
+      // only functions taking slices have any
+      return false;
+    }
+    if (!call->isConversion()) {
+      callees.push_back(call->getName());
+    }
+    for (const auto *arg : call->getArgs()) {
+      if (!isLowerable(arg, callees)) {
+        return false;
+      }
+    }
+    return true;
+  }
+  case ExprNode::IndexExprNode:
+    // functions taking slices can't be called through the all f64 entry,
+    // they never run in the engine
+    return false;
+  }
+  return false;
+}
+
+bool isLowerable(const BodyNode *body,
+                 std::vector<std::string_view> &callees) {
+  for (const auto *block : body->getBlocks()) {
+    switch (block->getBodyNodeType()) {
+    case BodySubNode::ConditionalNode: {
+      const auto *conditional = static_cast<const ConditionalNode *>(block);
+      if (!isLowerable(conditional->getIfExpr(), callees) ||
+          !isLowerable(conditional->getIfBody(), callees) ||
+          (conditional->getElseBody() &&
+           !isLowerable(conditional->getElseBody(), callees))) {
+        return false;
+      }
+      break;
+    }
+    case BodySubNode::WhileNode: {
+      const auto *loop = static_cast<const WhileNode *>(block);
+      if (!isLowerable(loop->getCondition(), callees) ||
+          !isLowerable(loop->getBody(), callees)) {
+        return false;
+      }
+      break;
+    }
+    case BodySubNode::ForNode: {
+      const auto *loop = static_cast<const ForNode *>(block);
+      if (!isLowerable(loop->getStart(), callees) ||
+          !isLowerable(loop->getEnd(), callees) ||
+          !isLowerable(loop->getStep(), callees) ||
+          !isLowerable(loop->getBody(), callees)) {
+        return false;
+      }
+      break;
+    }
+    case BodySubNode::ReturnStatementNode:
+      if (!isLowerable(static_cast<const ReturnNode *>(block)->getExpr(),
+                       callees)) {
+        return false;
+      }
+      break;
+    case BodySubNode::DefinitionNode:
+      if (!isLowerable(static_cast<const DefinitionNode *>(block)->getRHS(),
+                       callees)) {
+        return false;
+      }
+      break;
+    case BodySubNode::StoreNode:
+      return false;
+    }
+  }
+  return true;
+}
+
+} // namespace
+
+TieredEngine::TieredEngine(std::unique_ptr<Program> program,
+                           uint32_t threshold, const CodegenOptions &options)
+    : threshold_(threshold),
+      interpreter_(
+          [this](std::string_view name, const std::vector<double> &args) {
+            return call(find(name), args);
+          },
+          [this](const FunctionNode *node, uint32_t count) {
+            Function &function =
+                find(node->getFunctionDeclaration()->getName());
+            if (function.compilable && !function.queued &&
+                (function.back_edges += count) >=
+                    uint64_t(threshold_) * kBackEdgesPerCall) {
+              promote(function);
+            }
+          }),
+      jit_(nullptr, options) {
+  std::vector<std::vector<std::string_view>> callees;
+  for (auto *node : program->getFunctions()) {
+    auto function = std::make_unique<Function>();
+    function->node = node;
+    callees.emplace_back();
+    // extern functions are called through the JIT instead, see call()
+    function->compilable =
+        !node->isExtern() && isLowerable(node->getBody(), callees.back());
+    functions_by_name_[node->getFunctionDeclaration()->getName()] =
+        function.get();
+    functions_.push_back(std::move(function));
+  }
+  // functions calling one that has to stay interpreted stay interpreted too,
+  // until nothing changes
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    for (size_t i = 0; i < functions_.size(); i++) {
+      if (!functions_[i]->compilable) {
+        continue;
+      }
+      for (auto name : callees[i]) {
+        auto callee = functions_by_name_.find(name);
+        if (callee == functions_by_name_.end() ||
+            (!callee->second->compilable &&
+             !callee->second->node->isExtern())) {
+          functions_[i]->compilable = false;
+          changed = true;
+          break;
+        }
+      }
+    }
+  }
+  // the JIT only gets stubs here, nothing is compiled until promotion
+  jit_.addLazyProgram(std::move(program));
+  compiler_ = std::thread([this] { compileLoop(); });
+}
+
+TieredEngine::~TieredEngine() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stopping_ = true;
+  }
+  queue_changed_.notify_all();
+  compiler_.join();
+}
+
+TieredEngine::Function &TieredEngine::find(std::string_view name) const {
+  auto function = functions_by_name_.find(name);
+  if (function == functions_by_name_.end()) {
+    std::cout << "No function named " << name << std::endl;
+    exit(1);
+  }
+  return *function->second;
+}
+
+double TieredEngine::call(std::string_view name,
+                          const std::vector<double> &args) {
+  return call(find(name), args);
+}
+
+double TieredEngine::call(Function &function,
+                          const std::vector<double> &args) {
+  const auto *declaration = function.node->getFunctionDeclaration();
+  void *native = function.native.load(std::memory_order_acquire);
+  if (!native && function.node->isExtern() && !declaration->takesSlices()) {
+    // the C function, or its all f64 entry, is only looked up once it's
+    // called so missing ones only fail the calls that need them
+    native = jit_.compile(std::string(declaration->getName()));
+    function.native.store(native, std::memory_order_release);
+  }
+  if (native) {
+    double result = JIT::callAddress(native, args);
+    // an i64 result past 2^53 was rounded on its way out of compiled code
+    if (declaration->getReturnType() == type_i64) {
+      holdInteger(saturatingCast<int64_t>(result));
+    }
+    return result;
+  }
+  if (function.compilable && function.calls++ + 1 == threshold_) {
+    promote(function);
+  }
+  return interpreter_.run(function.node, args);
+}
+
+void TieredEngine::promote(Function &function) {
+  if (function.queued.exchange(true)) {
+    return;
+  }
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    queue_.push_back(&function);
+  }
+  queue_changed_.notify_all();
+}
+
+bool TieredEngine::isCompiled(std::string_view name) const {
+  return find(name).native.load(std::memory_order_acquire) != nullptr;
+}
+
+void TieredEngine::waitForCompiles() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  queue_changed_.wait(lock, [this] { return queue_.empty() && !compiling_; });
+}
+
+void TieredEngine::compileLoop() {
+  while (true) {
+    Function *function;
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      queue_changed_.wait(lock,
+                          [this] { return stopping_ || !queue_.empty(); });
+      if (stopping_) {
+        return;
+      }
+      function = queue_.front();
+      queue_.pop_front();
+      compiling_++;
+    }
+    auto name = function->node->getFunctionDeclaration()->getName();
+    void *native = jit_.compile(std::string(name));
+    function->native.store(native, std::memory_order_release);
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      compiling_--;
+    }
+    queue_changed_.notify_all();
+  }
+}
@@ -0,0 +1,70 @@
+#pragma once
+
+#include "interpreter.h"
+#include "jit.h"
+#include "parser.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+// Runs a program in two tiers. Every function starts out interpreted, so
+// nothing waits for LLVM. Once a function has been called `threshold` times,
+// or its loops have gone around kBackEdgesPerCall times as often, it's queued
+// for a background thread, which compiles it through CodegenVisitor and the
+// O3 pipeline. The native code is then swapped in, and later calls (including
+// those made by interpreted code) go straight to it. A call that's already
+// running finishes in the interpreter.
+// Functions the backend can't lower, and those calling them, stay in the
+// interpreter. Extern functions are called through the JIT from the start.
+class TieredEngine {
+public:
+  // a loop iteration is worth this much less than a call
+  static constexpr uint32_t kBackEdgesPerCall = 100;
+
+  // functions are compiled with the options
+  TieredEngine(std::unique_ptr<Program> program, uint32_t threshold = 1000,
+               const CodegenOptions &options = {});
+  ~TieredEngine();
+
+  double call(std::string_view name, const std::vector<double> &args);
+  bool isCompiled(std::string_view name) const;
+  // blocks until every function queued for compilation has been swapped in
+  void waitForCompiles();
+
+private:
+  struct Function {
+    FunctionNode *node;
+    bool compilable;
+    std::atomic<uint32_t> calls{0};
+    std::atomic<uint32_t> back_edges{0};
+    std::atomic<bool> queued{false};
+    std::atomic<void *> native{nullptr};
+  };
+
+  Function &find(std::string_view name) const;
+  double call(Function &function, const std::vector<double> &args);
+  // queues the function for compilation, unless it is already
+  void promote(Function &function);
+  void compileLoop();
+
+  const uint32_t threshold_;
+  std::vector<std::unique_ptr<Function>> functions_;
+  std::unordered_map<std::string_view, Function *> functions_by_name_;
+  Interpreter interpreter_;
+  JIT jit_;
+
+  std::mutex mutex_;
+  std::condition_variable queue_changed_;
+  std::deque<Function *> queue_;
+  // functions taken off the queue but not swapped in yet
+  size_t compiling_ = 0;
+  bool stopping_ = false;
+  std::thread compiler_;
+};
@@ -0,0 +1,433 @@
+#include "types.h"
+
+#include <algorithm>
+#include <iostream>
+#include <string>
+
+namespace {
+
+std::optional<ValueType> literalType(NumberKind kind) {
+  switch (kind) {
+  case num_i32:
+    return type_i32;
+  case num_i64:
+    return type_i64;
+  case num_f32:
+    return type_f32;
+  case num_f64:
+    return type_f64;
+  default:
+    return std::nullopt;
+  }
+}
+
+} // namespace
+
+void TypeChecker::error(const std::string &message) {
+  std::cout << "Type error";
+  if (function_) {
+    std::cout << " in " << function_->getName();
+  }
+  std::cout << ": " << message << std::endl;
+  for (auto name : undeclared_calls_) {
+    std::cout << "note: " << name
+              << " is called before it's declared, so it's assumed to take "
+                 "and return f64s"
+              << std::endl;
+  }
+  exit(1);
+}
+
+void TypeChecker::declare(const FunctionDeclarationNode *declaration) {
+  if (builtins_.count(declaration->getName())) {
+    error(std::string(declaration->getName()) +
+          " was used as a builtin before it was defined as a function");
+  }
+  auto [entry, inserted] = functions_.try_emplace(
+      declaration->getName(), Signature{declaration, false});
+  if (inserted) {
+    return;
+  }
+  // a C function and a slice function of the same name would clash when
+  // linked
+  if (!entry->second.assumed &&
+      (declaration->isExtern() || entry->second.declaration->isExtern())) {
+    error(std::string(declaration->getName()) +
+          " is declared extern, it can't be declared again");
+  }
+  if (entry->second.assumed && declaration->isTyped()) {
+    error(std::string(declaration->getName()) +
+          " was called before its declaration, which has to be all f64");
+  }
+  entry->second = {declaration, false};
+}
+
+void TypeChecker::check(FunctionNode *function) {
+  const auto *declaration = function->getFunctionDeclaration();
+  auto known = functions_.find(declaration->getName());
+  if (known == functions_.end() ||
+      known->second.declaration != declaration) {
+    declare(declaration);
+  }
+  if (function->isExtern()) {
+    return;
+  }
+  function_ = declaration;
+  variables_.clear();
+  pending_reads_.clear();
+  undeclared_calls_.clear();
+  scopes_.pushScope();
+  const auto &args = declaration->getArgs();
+  for (size_t i = 0; i < args.size(); i++) {
+    scopes_.declare(names_.intern(args[i]), variables_.size());
+    variables_.push_back({args[i], declaration->getArgType(i), {}});
+  }
+  checkBody(function->getBody());
+  scopes_.popScope();
+  // whatever nothing gave a type to is f64
+  for (uint32_t variable = 0; variable < variables_.size(); variable++) {
+    if (!variables_[variable].type) {
+      bind(variable, type_f64);
+    }
+  }
+  function_ = nullptr;
+  undeclared_calls_.clear();
+}
+
+void TypeChecker::bind(uint32_t variable, ValueType type) {
+  auto &info = variables_[variable];
+  if (info.type) {
+    if (*info.type != type) {
+      error(std::string(info.name) + " is an " + typeName(*info.type) +
+            " but is used as an " + typeName(type));
+    }
+    return;
+  }
+  info.type = type;
+  auto pending = std::move(info.pending);
+  for (auto *value : pending) {
+    resolve(value, type);
+  }
+}
+
+void TypeChecker::checkBody(BodyNode *body) {
+  for (auto *block : body->getBlocks()) {
+    switch (block->getBodyNodeType()) {
+    case BodySubNode::ConditionalNode: {
+      auto *conditional = static_cast<ConditionalNode *>(block);
+      // any number can be a condition, it's true unless it's 0
+      checkExpr(conditional->getIfExpr());
+      scopes_.pushScope();
+      checkBody(conditional->getIfBody());
+      scopes_.popScope();
+      if (conditional->getElseBody()) {
+        scopes_.pushScope();
+        checkBody(conditional->getElseBody());
+        scopes_.popScope();
+      }
+      break;
+    }
+    case BodySubNode::WhileNode: {
+      auto *loop = static_cast<WhileNode *>(block);
+      checkExpr(loop->getCondition());
+      scopes_.pushScope();
+      checkBody(loop->getBody());
+      scopes_.popScope();
+      break;
+    }
+    case BodySubNode::ForNode: {
+      auto *loop = static_cast<ForNode *>(block);
+      scopes_.pushScope();
+      checkRange(loop);
+      checkBody(loop->getBody());
+      scopes_.popScope();
+      break;
+    }
+    case BodySubNode::ReturnStatementNode:
+      expect(static_cast<ReturnNode *>(block)->getExpr(),
+             function_->getReturnType(), "the return value");
+      break;
+    case BodySubNode::StoreNode: {
+      auto *store = static_cast<StoreNode *>(block);
+      ValueType slice = lookupSlice(store->getSlice());
+      expect(store->getIndex(), type_i64, "an index");
+      expect(store->getValue(), elementType(slice),
+             ("an element of " + std::string(store->getSlice())).c_str());
+      break;
+    }
+    case BodySubNode::DefinitionNode: {
+      auto *definition = static_cast<DefinitionNode *>(block);
+      uint32_t name = names_.intern(definition->getLValue());
+      const auto *existing = scopes_.lookup(name);
+      if (existing) {
+        checkAssignable(*existing);
+      }
+      if (existing && variables_[*existing].type) {
+        expect(definition->getRHS(), *variables_[*existing].type,
+               std::string(definition->getLValue()).c_str());
+        break;
+      }
+      auto type = inferNumber(definition->getRHS());
+      if (!existing) {
+        scopes_.declare(name, variables_.size());
+        variables_.push_back({definition->getLValue(), std::nullopt, {}});
+      }
+      uint32_t variable = existing ? *existing : variables_.size() - 1;
+      if (type) {
+        bind(variable, *type);
+      } else {
+        variables_[variable].pending.push_back(definition->getRHS());
+      }
+      break;
+    }
+    }
+  }
+}
+
+void TypeChecker::checkRange(ForNode *loop) {
+  // the start, end and step all have the type of the loop variable, which
+  // is defined by the start like by any other definition
+  uint32_t name = names_.intern(loop->getVariable());
+  const auto *existing = scopes_.lookup(name);
+  std::optional<ValueType> type;
+  if (existing) {
+    checkAssignable(*existing);
+    type = variables_[*existing].type;
+  }
+  ExprNode *range[] = {loop->getStart(), loop->getEnd(), loop->getStep()};
+  std::optional<ValueType> types[3];
+  for (size_t i = 0; i < 3; i++) {
+    types[i] = inferNumber(range[i]);
+    if (types[i] && type && *types[i] != *type) {
+      error(std::string("mismatched types ") + typeName(*type) + " and " +
+            typeName(*types[i]) + " in the range of " +
+            std::string(loop->getVariable()));
+    }
+    if (types[i]) {
+      type = types[i];
+    }
+  }
+  if (!existing) {
+    scopes_.declare(name, variables_.size());
+    variables_.push_back({loop->getVariable(), std::nullopt, {}});
+  }
+  uint32_t variable = existing ? *existing : variables_.size() - 1;
+  for (size_t i = 0; i < 3; i++) {
+    if (types[i]) {
+      continue;
+    }
+    if (type) {
+      resolve(range[i], *type);
+    } else {
+      variables_[variable].pending.push_back(range[i]);
+    }
+  }
+  if (type) {
+    bind(variable, *type);
+  }
+}
+
+void TypeChecker::checkAssignable(uint32_t variable) {
+  const auto &info = variables_[variable];
+  if (info.type && isSliceType(*info.type)) {
+    error(std::string(info.name) + " is a slice, which can't be assigned");
+  }
+}
+
+ValueType TypeChecker::lookupSlice(std::string_view name) {
+  const auto *variable = scopes_.lookup(names_.intern(name));
+  if (!variable) {
+    error("did not find identifier " + std::string(name));
+  }
+  auto type = variables_[*variable].type;
+  if (!type || !isSliceType(*type)) {
+    error(std::string(name) + " is indexed but isn't a slice");
+  }
+  return *type;
+}
+
+std::optional<ValueType> TypeChecker::inferNumber(ExprNode *expr) {
+  auto type = infer(expr);
+  if (type && isSliceType(*type)) {
+    error("a slice can only be indexed, passed to len or passed on to a "
+          "function");
+  }
+  return type;
+}
+
+ValueType TypeChecker::checkExpr(ExprNode *expr) {
+  auto type = inferNumber(expr);
+  if (!type) {
+    resolve(expr, type_f64);
+    return type_f64;
+  }
+  return *type;
+}
+
+void TypeChecker::expect(ExprNode *expr, ValueType type, const char *context) {
+  auto inferred = infer(expr);
+  if (!inferred && isSliceType(type)) {
+    error(std::string("expected ") + typeName(type) + " for " + context +
+          ", got a number");
+  } else if (!inferred) {
+    resolve(expr, type);
+  } else if (*inferred != type) {
+    error(std::string("expected ") + typeName(type) + " for " + context +
+          ", got " + typeName(*inferred));
+  }
+}
+
+void TypeChecker::resolve(ExprNode *expr, ValueType type) {
+  expr->setType(type);
+  if (expr->getExprNodeType() == ExprNode::IdentifierExprNode) {
+    auto read = pending_reads_.find(expr);
+    if (read != pending_reads_.end()) {
+      bind(read->second, type);
+    }
+  } else if (expr->getExprNodeType() == ExprNode::BinaryExprNode) {
+    auto *binary = static_cast<BinaryExprNode *>(expr);
+    resolve(binary->getLHS(), type);
+    resolve(binary->getRHS(), type);
+  } else if (expr->getExprNodeType() == ExprNode::NumberLiteralNode) {
+    const auto &literal =
+        static_cast<NumberLiteralNode *>(expr)->getLiteral();
+    if (isIntegerType(type) && !literal.isInteger()) {
+      error("the literal " + std::to_string(literal.value) +
+            " has a fraction and can't be an " + typeName(type));
+    }
+  }
+}
+
+std::optional<ValueType> TypeChecker::infer(ExprNode *expr) {
+  switch (expr->getExprNodeType()) {
+  case ExprNode::NumberLiteralNode: {
+    auto type =
+        literalType(static_cast<NumberLiteralNode *>(expr)->getLiteral().kind);
+    if (type) {
+      expr->setType(*type);
+    }
+    return type;
+  }
+  case ExprNode::IdentifierExprNode: {
+    auto name = static_cast<IdentifierExprNode *>(expr)->getName();
+    const auto *variable = scopes_.lookup(names_.intern(name));
+    if (!variable) {
+      error("did not find identifier " + std::string(name));
+    }
+    // a variable without a type yet is like a literal
+    auto type = variables_[*variable].type;
+    if (type) {
+      expr->setType(*type);
+    } else {
+      pending_reads_[expr] = *variable;
+    }
+    return type;
+  }
+  case ExprNode::BinaryExprNode: {
+    auto *binary = static_cast<BinaryExprNode *>(expr);
+    auto lhs = inferNumber(binary->getLHS());
+    auto rhs = inferNumber(binary->getRHS());
+    if (!lhs && !rhs) {
+      return std::nullopt;
+    }
+    if (lhs && rhs && *lhs != *rhs) {
+      error(std::string("mismatched operand types ") + typeName(*lhs) +
+            " and " + typeName(*rhs));
+    }
+    ValueType type = lhs ? *lhs : *rhs;
+    if (!lhs) {
+      resolve(binary->getLHS(), type);
+    } else if (!rhs) {
+      resolve(binary->getRHS(), type);
+    }
+    expr->setType(type);
+    return type;
+  }
+  case ExprNode::FunctionCallExprNode: {
+    auto *call = static_cast<FunctionCallExprNode *>(expr);
+    checkCall(call);
+    return call->getType();
+  }
+  case ExprNode::IndexExprNode: {
+    auto *index = static_cast<IndexExprNode *>(expr);
+    ValueType slice = lookupSlice(index->getSlice());
+    expect(index->getIndex(), type_i64, "an index");
+    expr->setType(elementType(slice));
+    return elementType(slice);
+  }
+  }
+  return std::nullopt;
+}
+
+void TypeChecker::checkCall(FunctionCallExprNode *call) {
+  std::string name(call->getName());
+  const auto &args = call->getArgs();
+  auto conversion = typeFromName(call->getName());
+  auto callee_entry = functions_.find(call->getName());
+  bool is_builtin = callee_entry == functions_.end() ||
+                    !callee_entry->second.declaration;
+  if (conversion && is_builtin) {
+    builtins_.insert(call->getName());
+    call->setCallKind(call_conversion);
+    if (args.size() != 1) {
+      error(name + " converts a single value, got " +
+            std::to_string(args.size()) + " arguments");
+    }
+    checkExpr(args[0]);
+    call->setType(*conversion);
+    return;
+  }
+  if (call->getName() == "len" && is_builtin) {
+    builtins_.insert(call->getName());
+    call->setCallKind(call_length);
+    auto type = args.size() == 1 ? infer(args[0]) : std::nullopt;
+    if (!type || !isSliceType(*type)) {
+      error("len takes a single slice");
+    }
+    call->setType(type_i64);
+    return;
+  }
+
+  auto [entry, inserted] =
+      functions_.try_emplace(call->getName(), Signature{nullptr, true});
+  const auto *callee = entry->second.declaration;
+  if (!callee) {
+    if (std::find(undeclared_calls_.begin(), undeclared_calls_.end(),
+                  call->getName()) == undeclared_calls_.end()) {
+      undeclared_calls_.push_back(call->getName());
+    }
+    for (auto *arg : args) {
+      expect(arg, type_f64, ("an argument of " + name).c_str());
+    }
+    call->setType(type_f64);
+    return;
+  }
+  if (callee->getArgs().size() != args.size()) {
+    error(name + " takes " + std::to_string(callee->getArgs().size()) +
+          " arguments, got " + std::to_string(args.size()));
+  }
+  for (size_t i = 0; i < args.size(); i++) {
+    expect(args[i], callee->getArgType(i),
+           (std::string(callee->getArgs()[i]) + " of " + name).c_str());
+  }
+  if (callee->isExtern()) {
+    call->setCallKind(call_extern);
+  }
+  call->setType(callee->getReturnType());
+}
+
+void checkTypes(const Program &program) {
+  TypeChecker checker;
+  // functions named like a builtin only replace it from where they're
+  // defined on
+  for (auto *function : program.getFunctions()) {
+    const auto *declaration = function->getFunctionDeclaration();
+    if (!typeFromName(declaration->getName()) &&
+        declaration->getName() != "len") {
+      checker.declare(declaration);
+    }
+  }
+  for (auto *function : program.getFunctions()) {
+    checker.check(function);
+  }
+}
@@ -0,0 +1,98 @@
+#pragma once
+
+#include "parser.h"
+#include "scanner.h"
+#include "symbol_table.h"
+
+#include <optional>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+// Infers the type of every expression of a function and records it on the
+// nodes, where codegen, the interpreter and the VM pick it up. Types flow
+// from annotated arguments, suffixed literals and the return types of
+// callees:
+//
+//   - both operands of an operator have the same type, and so does the
+//     result. comparisons yield 1 or 0 in that type as well.
+//   - unsuffixed literals take the type of the other operand or whatever
+//     they're assigned to, and are f64 otherwise. literals with a fraction
+//     or exponent can't become integers.
+//   - a variable has the type of the value it's first defined with, later
+//     assignments have to match it. a variable defined with unsuffixed
+//     literals only is like one of those literals, it takes its type from
+//     the first use that needs one and is f64 if nothing does.
+//   - the start, end and step of a for loop have the type of its variable.
+//   - i64(x), i32(x), f32(x) and f64(x) convert between types, unless a
+//     function of that name was defined before.
+//   - slices are only ever arguments. they can be indexed with an i64, passed
+//     to len(xs), which is an i64, and passed on to functions, but not
+//     assigned or computed with.
+//
+// There are no implicit conversions, any mismatch is an error.
+class TypeChecker {
+public:
+  // Makes the signature known to calls checked from here on. A function that
+  // was called before it was declared is assumed to take and return f64s,
+  // and declaring it with any other signature afterwards is an error.
+  void declare(const FunctionDeclarationNode *declaration);
+  // Declares the function if it hasn't been yet and checks its body, extern
+  // functions only have a declaration.
+  void check(FunctionNode *function);
+
+private:
+  // Checks the expression bottom up. Returns its type, or nullopt when it's
+  // made of unsuffixed literals only and takes its type from the context.
+  std::optional<ValueType> infer(ExprNode *expr);
+  // infer, for where a slice can't be used
+  std::optional<ValueType> inferNumber(ExprNode *expr);
+  // Checks the expression and gives it the expected type, which it must
+  // either already have or be able to take.
+  void expect(ExprNode *expr, ValueType type, const char *context);
+  // Gives every node of a literal only expression the type, along with the
+  // variables it reads that don't have one yet.
+  void resolve(ExprNode *expr, ValueType type);
+  void bind(uint32_t variable, ValueType type);
+  // The type of a whole expression, literal only ones default to f64.
+  ValueType checkExpr(ExprNode *expr);
+  void checkBody(BodyNode *body);
+  // declares or assigns the variable of a for loop
+  void checkRange(ForNode *loop);
+  void checkAssignable(uint32_t variable);
+  // the type of the slice argument of that name
+  ValueType lookupSlice(std::string_view name);
+  void checkCall(FunctionCallExprNode *call);
+  [[noreturn]] void error(const std::string &message);
+
+  struct Signature {
+    const FunctionDeclarationNode *declaration;
+    // called before it was declared, with f64 arguments and result
+    bool assumed;
+  };
+  struct Variable {
+    std::string_view name;
+    std::optional<ValueType> type;
+    // the literal only values it was assigned while it had no type yet
+    std::vector<ExprNode *> pending;
+  };
+  std::unordered_map<std::string_view, Signature> functions_;
+  IdentifierTable names_;
+  // indices into variables_ of the function being checked
+  SymbolTable<uint32_t> scopes_;
+  std::vector<Variable> variables_;
+  // reads of variables that had no type yet, which get one when the
+  // expression around them is resolved
+  std::unordered_map<const ExprNode *, uint32_t> pending_reads_;
+  const FunctionDeclarationNode *function_ = nullptr;
+  // conversions and len, once used, can't be defined as functions anymore
+  std::unordered_set<std::string_view> builtins_;
+  // functions the current one calls before they're declared, which explain
+  // a mismatch with the f64 signature assumed for them
+  std::vector<std::string_view> undeclared_calls_;
+};
+
+// Declares every function up front and then checks them in order, so calls
+// can go to typed functions further down, unlike while streaming.
+void checkTypes(const Program &program);
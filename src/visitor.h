@@ -1,11 +1,17 @@
+#pragma once
+
 class FunctionDeclarationNode;
 class BinaryExprNode;
 class NumberLiteralNode;
 class IdentifierExprNode;
 class FunctionCallExprNode;
+class IndexExprNode;
 class BodyNode;
 class ConditionalNode;
+class WhileNode;
+class ForNode;
 class DefinitionNode;
+class StoreNode;
 class ReturnNode;
 class FunctionNode;
 class Program;
@@ -18,9 +24,13 @@ public:
   virtual void visitNumberLiteralNode(const NumberLiteralNode *node) = 0;
   virtual void visitIdentifierExprNode(const IdentifierExprNode *node) = 0;
   virtual void visitFunctionCallExprNode(const FunctionCallExprNode *node) = 0;
+  virtual void visitIndexExprNode(const IndexExprNode *node) = 0;
   virtual void visitBodyNode(const BodyNode *node) = 0;
   virtual void visitConditionalNode(const ConditionalNode *node) = 0;
+  virtual void visitWhileNode(const WhileNode *node) = 0;
+  virtual void visitForNode(const ForNode *node) = 0;
   virtual void visitDefinitionNode(const DefinitionNode *node) = 0;
+  virtual void visitStoreNode(const StoreNode *node) = 0;
   virtual void visitReturnNode(const ReturnNode *node) = 0;
   virtual void visitFunctionNode(const FunctionNode *node) = 0;
   virtual void visitProgramNode(const Program *node) = 0;
@@ -0,0 +1,298 @@
+#include "vm.h"
+#include "native.h"
+#include "numeric.h"
+
+#include <cmath>
+#include <iostream>
+
+#if defined(__GNUC__) || defined(__clang__)
+#define VM_COMPUTED_GOTO 1
+#endif
+
+VM::VM(const BytecodeProgram &program)
+    : program_(program), registers_(new double[kRegisters]) {
+  frames_.reserve(256);
+}
+
+double VM::call(std::string_view name, const std::vector<double> &args) {
+  int32_t function = program_.find(name);
+  if (function < 0) {
+    std::cout << "No function named " << name << std::endl;
+    exit(1);
+  }
+  if (program_.functions[function].arity != args.size()) {
+    std::cout << name << " takes " << program_.functions[function].arity
+              << " arguments, got " << args.size() << std::endl;
+    exit(1);
+  }
+  if (program_.functions[function].is_extern) {
+    if (!program_.functions[function].native) {
+      std::cout << name << " is an extern function only compiled code can call"
+                << std::endl;
+      exit(1);
+    }
+    return callNative(program_.functions[function].native, args.data(),
+                      args.size());
+  }
+  if (program_.functions[function].native_only) {
+    std::cout << name << " takes slices, which only compiled code can pass"
+              << std::endl;
+    exit(1);
+  }
+  // arguments come in as doubles and are converted the way the all f64 entry
+  // of a compiled function converts them
+  const auto &arg_types = program_.functions[function].arg_types;
+  for (size_t i = 0; i < args.size(); i++) {
+    registers_[i] = arg_types.empty()
+                        ? args[i]
+                        : convertValue(args[i], type_f64, arg_types[i]);
+  }
+  return run(program_.functions[function]);
+}
+
+double VM::run(const BytecodeFunction &function) {
+  if (function.frame_size > kRegisters) {
+    std::cout << "VM register file overflow" << std::endl;
+    exit(1);
+  }
+  const BytecodeFunction *functions = program_.functions.data();
+  const double *registers_end = registers_.get() + kRegisters;
+  const Instruction *code = function.code.data();
+  const Instruction *pc = code;
+  double *r = registers_.get();
+  const double *k = function.constants.data();
+  frames_.clear();
+
+#ifdef VM_COMPUTED_GOTO
+  // indexed by opcode
+  static const void *const labels[] = {
+      &&label_op_const,
+      &&label_op_move,
+      &&label_op_add,
+      &&label_op_sub,
+      &&label_op_mul,
+      &&label_op_div,
+      &&label_op_mod,
+      &&label_op_iadd,
+      &&label_op_isub,
+      &&label_op_imul,
+      &&label_op_idiv,
+      &&label_op_imod,
+      &&label_op_imul_i32,
+      &&label_op_wrap_i32,
+      &&label_op_round_f32,
+      &&label_op_to_i64,
+      &&label_op_to_i32,
+      &&label_op_lt,
+      &&label_op_lte,
+      &&label_op_gt,
+      &&label_op_gte,
+      &&label_op_jump,
+      &&label_op_jump_if_false,
+      &&label_op_jump_unless_lt,
+      &&label_op_jump_unless_lte,
+      &&label_op_jump_unless_gt,
+      &&label_op_jump_unless_gte,
+      &&label_op_call,
+      &&label_op_call_native,
+      &&label_op_return,
+  };
+  static_assert(sizeof(labels) / sizeof(labels[0]) == op_return + 1,
+                "every opcode needs a label");
+  // each handler jumps straight to the next one, the switch is only entered
+  // for the first instruction
+#define VM_CASE(op)                                                            \
+  label_##op:                                                                  \
+  case op:
+#define VM_DISPATCH() goto *labels[pc->op]
+#else
+#define VM_CASE(op) case op:
+#define VM_DISPATCH() goto dispatch
+dispatch:
+#endif
+
+  switch (pc->op) {
+  VM_CASE(op_const) {
+    r[pc->a] = k[pc->b];
+    pc++;
+    VM_DISPATCH();
+  }
+  VM_CASE(op_move) {
+    r[pc->a] = r[pc->b];
+    pc++;
+    VM_DISPATCH();
+  }
+  VM_CASE(op_add) {
+    r[pc->a] = r[pc->b] + r[pc->c];
+    pc++;
+    VM_DISPATCH();
+  }
+  VM_CASE(op_sub) {
+    r[pc->a] = r[pc->b] - r[pc->c];
+    pc++;
+    VM_DISPATCH();
+  }
+  VM_CASE(op_mul) {
+    r[pc->a] = r[pc->b] * r[pc->c];
+    pc++;
+    VM_DISPATCH();
+  }
+  VM_CASE(op_div) {
+    r[pc->a] = r[pc->b] / r[pc->c];
+    pc++;
+    VM_DISPATCH();
+  }
+  VM_CASE(op_mod) {
+    r[pc->a] = std::fmod(r[pc->b], r[pc->c]);
+    pc++;
+    VM_DISPATCH();
+  }
+  VM_CASE(op_iadd) {
+    r[pc->a] = integerArithmetic(tok_add, r[pc->b], r[pc->c]);
+    pc++;
+    VM_DISPATCH();
+  }
+  VM_CASE(op_isub) {
+    r[pc->a] = integerArithmetic(tok_sub, r[pc->b], r[pc->c]);
+    pc++;
+    VM_DISPATCH();
+  }
+  VM_CASE(op_imul) {
+    r[pc->a] = integerArithmetic(tok_mul, r[pc->b], r[pc->c]);
+    pc++;
+    VM_DISPATCH();
+  }
+  VM_CASE(op_idiv) {
+    if (r[pc->c] == 0) {
+      std::cout << "Integer division by zero" << std::endl;
+      exit(1);
+    }
+    r[pc->a] = integerArithmetic(tok_div, r[pc->b], r[pc->c]);
+    pc++;
+    VM_DISPATCH();
+  }
+  VM_CASE(op_imod) {
+    if (r[pc->c] == 0) {
+      std::cout << "Integer division by zero" << std::endl;
+      exit(1);
+    }
+    r[pc->a] = integerArithmetic(tok_mod, r[pc->b], r[pc->c]);
+    pc++;
+    VM_DISPATCH();
+  }
+  VM_CASE(op_imul_i32) {
+    r[pc->a] = multiplyI32(r[pc->b], r[pc->c]);
+    pc++;
+    VM_DISPATCH();
+  }
+  VM_CASE(op_wrap_i32) {
+    r[pc->a] = roundToType(r[pc->b], type_i32);
+    pc++;
+    VM_DISPATCH();
+  }
+  VM_CASE(op_round_f32) {
+    r[pc->a] = roundToType(r[pc->b], type_f32);
+    pc++;
+    VM_DISPATCH();
+  }
+  VM_CASE(op_to_i64) {
+    r[pc->a] = holdInteger(saturatingCast<int64_t>(r[pc->b]));
+    pc++;
+    VM_DISPATCH();
+  }
+  VM_CASE(op_to_i32) {
+    r[pc->a] = saturatingCast<int32_t>(r[pc->b]);
+    pc++;
+    VM_DISPATCH();
+  }
+  VM_CASE(op_lt) {
+    r[pc->a] = r[pc->b] < r[pc->c];
+    pc++;
+    VM_DISPATCH();
+  }
+  VM_CASE(op_lte) {
+    r[pc->a] = r[pc->b] <= r[pc->c];
+    pc++;
+    VM_DISPATCH();
+  }
+  VM_CASE(op_gt) {
+    r[pc->a] = r[pc->b] > r[pc->c];
+    pc++;
+    VM_DISPATCH();
+  }
+  VM_CASE(op_gte) {
+    r[pc->a] = r[pc->b] >= r[pc->c];
+    pc++;
+    VM_DISPATCH();
+  }
+  VM_CASE(op_jump) {
+    pc = code + pc->c;
+    VM_DISPATCH();
+  }
+  VM_CASE(op_jump_if_false) {
+    pc = r[pc->a] == 0 ? code + pc->c : pc + 1;
+    VM_DISPATCH();
+  }
+  VM_CASE(op_jump_unless_lt) {
+    pc = r[pc->a] < r[pc->b] ? pc + 1 : code + pc->c;
+    VM_DISPATCH();
+  }
+  VM_CASE(op_jump_unless_lte) {
+    pc = r[pc->a] <= r[pc->b] ? pc + 1 : code + pc->c;
+    VM_DISPATCH();
+  }
+  VM_CASE(op_jump_unless_gt) {
+    pc = r[pc->a] > r[pc->b] ? pc + 1 : code + pc->c;
+    VM_DISPATCH();
+  }
+  VM_CASE(op_jump_unless_gte) {
+    pc = r[pc->a] >= r[pc->b] ? pc + 1 : code + pc->c;
+    VM_DISPATCH();
+  }
+  VM_CASE(op_call) {
+    const BytecodeFunction &callee = functions[pc->b];
+    double *callee_registers = r + pc->c;
+    if (callee_registers + callee.frame_size > registers_end) {
+      std::cout << "VM register file overflow" << std::endl;
+      exit(1);
+    }
+    frames_.push_back({pc + 1, code, r, k});
+    code = callee.code.data();
+    pc = code;
+    r = callee_registers;
+    k = callee.constants.data();
+    VM_DISPATCH();
+  }
+  VM_CASE(op_call_native) {
+    const BytecodeFunction &callee = functions[pc->b];
+    if (!callee.native) {
+      std::cout << callee.name
+                << " is an extern function only compiled code can call"
+                << std::endl;
+      exit(1);
+    }
+    r[pc->a] = callNative(callee.native, r + pc->c, callee.arity);
+    pc++;
+    VM_DISPATCH();
+  }
+  VM_CASE(op_return) {
+    double value = r[pc->a];
+    if (frames_.empty()) {
+      return value;
+    }
+    const Frame &caller = frames_.back();
+    pc = caller.return_pc;
+    code = caller.code;
+    r = caller.registers;
+    k = caller.constants;
+    frames_.pop_back();
+    // the call instruction names the register that receives the result
+    r[(pc - 1)->a] = value;
+    VM_DISPATCH();
+  }
+  }
+#undef VM_CASE
+#undef VM_DISPATCH
+  std::cout << "VM hit an unknown opcode" << std::endl;
+  exit(1);
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include "bytecode.h"
+
+#include <memory>
+#include <string_view>
+#include <vector>
+
+// Runs register bytecode. Doubles live unboxed in one register file that all
+// frames share: a callee's frame starts at the caller's argument registers,
+// so calls copy nothing. Dispatch uses computed goto where the compiler
+// supports it and a switch otherwise.
+class VM {
+public:
+  // the program isn't copied, it must outlive the VM
+  explicit VM(const BytecodeProgram &program);
+
+  double call(std::string_view name, const std::vector<double> &args);
+
+private:
+  double run(const BytecodeFunction &function);
+
+  // what a return restores for the caller
+  struct Frame {
+    const Instruction *return_pc;
+    const Instruction *code;
+    double *registers;
+    const double *constants;
+  };
+
+  static constexpr size_t kRegisters = 1 << 20;
+
+  const BytecodeProgram &program_;
+  std::unique_ptr<double[]> registers_;
+  std::vector<Frame> frames_;
+};
@@ -1,9 +1,15 @@
+#include "basic.h"
 #include <iostream>
-extern "C" {
-double fib(double);
-}
 
 int main() {
   std::cout << "FIB " << fib(10.0) << std::endl;
+  const double xs[] = {1.0, 2.0, 3.0, 4.0};
+  double out[4];
+  fib_batch(xs, out, 4);
+  std::cout << "FIB_BATCH";
+  for (double x : out) {
+    std::cout << " " << x;
+  }
+  std::cout << std::endl;
   return 0;
-}
\ No newline at end of file
+}
@@ -1,6 +1,25 @@
+#include "../src/ast_file.h"
+#include "../src/bytecode.h"
+#include "../src/cache.h"
+#include "../src/codegen.h"
+#include "../src/flat_ast.h"
+#include "../src/frontend.h"
+#include "../src/interpreter.h"
+#include "../src/jit.h"
+#include "../src/parallel_codegen.h"
+#include "../src/tiered.h"
+#include "../src/types.h"
+#include "../src/vm.h"
 #include "../src/parser.h"
+#include "../src/ssa.h"
+#include "../src/symbol_table.h"
+#include "llvm/ADT/SmallString.h"
+#include "llvm/IR/Verifier.h"
+#include "llvm/Support/DynamicLibrary.h"
+#include "llvm/Support/FileSystem.h"
 
 #include <assert.h>
+#include <cmath>
 #include <iostream>
 #include <string>
 
@@ -15,60 +34,7 @@ const std::string basic = "# Compute the x'th fibonacci number.\n"
                           "}\n"
                           "# This expression will compute the 40th number.\n";
 
-void runBasicTest() {
-  Scanner scanner(basic);
-  scanner.scanTokens();
-  const std::vector<Token> expected = {
-      Token(TokenType::tok_def),
-      Token(TokenType::tok_identifier, "fib"),
-      Token(TokenType::tok_lpar),
-      Token(TokenType::tok_identifier, "x"),
-      Token(TokenType::tok_rpar),
-      Token(TokenType::tok_lbrak),
-      Token(TokenType::tok_identifier, "a"),
-      Token(TokenType::tok_equals),
-      Token(TokenType::tok_number, 1),
-      Token(TokenType::tok_if),
-      Token(TokenType::tok_lpar),
-      Token(TokenType::tok_identifier, "x"),
-      Token(TokenType::tok_lt),
-      Token(TokenType::tok_number, 3),
-      Token(TokenType::tok_rpar),
-      Token(TokenType::tok_lbrak),
-      Token(TokenType::tok_return),
-      Token(TokenType::tok_number, 1),
-      Token(TokenType::tok_rbrak),
-      Token(TokenType::tok_else),
-      Token(TokenType::tok_lbrak),
-      Token(TokenType::tok_return),
-      Token(TokenType::tok_identifier, "fib"),
-      Token(TokenType::tok_lpar),
-      Token(TokenType::tok_identifier, "x"),
-      Token(TokenType::tok_sub),
-      Token(TokenType::tok_number, 1),
-      Token(TokenType::tok_rpar),
-      Token(TokenType::tok_add),
-      Token(TokenType::tok_identifier, "fib"),
-      Token(TokenType::tok_lpar),
-      Token(TokenType::tok_identifier, "x"),
-      Token(TokenType::tok_sub),
-      Token(TokenType::tok_number, 2),
-      Token(TokenType::tok_rpar),
-      Token(TokenType::tok_rbrak),
-      Token(TokenType::tok_rbrak),
-  };
-  std::vector<Token> actual = scanner.tokens();
-  for (size_t i = 0; i < expected.size(); i++) {
-    Token actual_token = actual[i];
-    Token expected_token = expected[i];
-    if (actual_token != expected_token) {
-      std::cout << "Expected " << expected[i].toString() << ", got "
-                << scanner.tokens()[i].toString() << std::endl;
-      throw std::runtime_error("Test failed");
-    }
-  }
-  Parser parser = Parser(actual);
-  std::unique_ptr<Program> program = parser.parse();
+void checkBasicProgram(const Program *program) {
   const auto &functions = program->getFunctions();
   assert(functions.size() == 1);
   const auto &function = program->getFunctions()[0];
@@ -79,17 +45,17 @@ void runBasicTest() {
   const auto &func_body = function->getBody();
   const auto &blocks = func_body->getBlocks();
   assert(blocks.size() == 2);
-  assert(blocks[0].get()->getBodyNodeType() ==
+  assert(blocks[0]->getBodyNodeType() ==
          BodySubNode::BodyNodeType::DefinitionNode);
-  const auto &def_block = static_cast<DefinitionNode *>(blocks[0].get());
+  const auto &def_block = static_cast<DefinitionNode *>(blocks[0]);
   const auto &lvalue = def_block->getLValue();
   assert(lvalue == "a");
   const auto &rhs = static_cast<NumberLiteralNode *>(def_block->getRHS());
   assert(rhs->getExprNodeType() == ExprNode::ExprNodeType::NumberLiteralNode);
   assert(rhs->getValue() == 1);
-  assert(blocks[1].get()->getBodyNodeType() ==
+  assert(blocks[1]->getBodyNodeType() ==
          BodySubNode::BodyNodeType::ConditionalNode);
-  const auto &if_block = static_cast<ConditionalNode *>(blocks[1].get());
+  const auto &if_block = static_cast<ConditionalNode *>(blocks[1]);
   assert(if_block->getIfExpr()->getExprNodeType() == ExprNode::BinaryExprNode);
   const auto &if_expr = static_cast<BinaryExprNode *>(if_block->getIfExpr());
   assert(if_expr->getOperator() == tok_lt);
@@ -104,7 +70,7 @@ void runBasicTest() {
   assert(if_body_blocks.size() == 1);
   assert(if_body_blocks[0]->getBodyNodeType() ==
          BodySubNode::BodyNodeType::ReturnStatementNode);
-  const auto &return_block = static_cast<ReturnNode *>(if_body_blocks[0].get());
+  const auto &return_block = static_cast<ReturnNode *>(if_body_blocks[0]);
   assert(return_block->getExpr()->getExprNodeType() ==
          ExprNode::ExprNodeType::NumberLiteralNode);
   const auto &return_block_expr =
@@ -117,7 +83,7 @@ void runBasicTest() {
   assert(else_body_blocks[0]->getBodyNodeType() ==
          BodySubNode::BodyNodeType::ReturnStatementNode);
   const auto &else_return_block =
-      static_cast<ReturnNode *>(else_body_blocks[0].get());
+      static_cast<ReturnNode *>(else_body_blocks[0]);
   assert(else_return_block->getExpr()->getExprNodeType() ==
          ExprNode::BinaryExprNode);
   const auto &else_return_expr =
@@ -129,7 +95,7 @@ void runBasicTest() {
   assert(else_return_lhs->getName() == "fib");
   assert(else_return_lhs->getArgs().size() == 1);
   const auto &first_arg =
-      static_cast<BinaryExprNode *>(else_return_lhs->getArgs()[0].get());
+      static_cast<BinaryExprNode *>(else_return_lhs->getArgs()[0]);
   assert(first_arg->getExprNodeType() == ExprNode::BinaryExprNode);
   assert(first_arg->getOperator() == tok_sub);
   assert(first_arg->getLHS()->getExprNodeType() ==
@@ -147,7 +113,7 @@ void runBasicTest() {
   assert(else_return_rhs->getName() == "fib");
   assert(else_return_rhs->getArgs().size() == 1);
   const auto &first_arg_rhs =
-      static_cast<BinaryExprNode *>(else_return_rhs->getArgs()[0].get());
+      static_cast<BinaryExprNode *>(else_return_rhs->getArgs()[0]);
   assert(first_arg_rhs->getExprNodeType() == ExprNode::BinaryExprNode);
   assert(first_arg_rhs->getOperator() == tok_sub);
   assert(first_arg_rhs->getLHS()->getExprNodeType() ==
@@ -162,8 +128,1438 @@ void runBasicTest() {
       2);
 }
 
+void runBasicTest() {
+  Scanner scanner(basic);
+  scanner.scanTokens();
+  struct ExpectedToken {
+    TokenType type;
+    std::string_view identifier;
+    double number;
+  };
+  const std::vector<ExpectedToken> expected = {
+      {TokenType::tok_def},
+      {TokenType::tok_identifier, "fib"},
+      {TokenType::tok_lpar},
+      {TokenType::tok_identifier, "x"},
+      {TokenType::tok_rpar},
+      {TokenType::tok_lbrak},
+      {TokenType::tok_identifier, "a"},
+      {TokenType::tok_equals},
+      {TokenType::tok_number, {}, 1},
+      {TokenType::tok_if},
+      {TokenType::tok_lpar},
+      {TokenType::tok_identifier, "x"},
+      {TokenType::tok_lt},
+      {TokenType::tok_number, {}, 3},
+      {TokenType::tok_rpar},
+      {TokenType::tok_lbrak},
+      {TokenType::tok_return},
+      {TokenType::tok_number, {}, 1},
+      {TokenType::tok_rbrak},
+      {TokenType::tok_else},
+      {TokenType::tok_lbrak},
+      {TokenType::tok_return},
+      {TokenType::tok_identifier, "fib"},
+      {TokenType::tok_lpar},
+      {TokenType::tok_identifier, "x"},
+      {TokenType::tok_sub},
+      {TokenType::tok_number, {}, 1},
+      {TokenType::tok_rpar},
+      {TokenType::tok_add},
+      {TokenType::tok_identifier, "fib"},
+      {TokenType::tok_lpar},
+      {TokenType::tok_identifier, "x"},
+      {TokenType::tok_sub},
+      {TokenType::tok_number, {}, 2},
+      {TokenType::tok_rpar},
+      {TokenType::tok_rbrak},
+      {TokenType::tok_rbrak},
+  };
+  const TokenStream &actual = scanner.tokens();
+  for (size_t i = 0; i < expected.size(); i++) {
+    Token actual_token = actual[i];
+    bool matches = actual_token.getType() == expected[i].type;
+    if (matches && actual_token.getType() == tok_identifier) {
+      matches = actual.getIdentifier(actual_token) == expected[i].identifier;
+    } else if (matches && actual_token.getType() == tok_number) {
+      matches = actual.getNumber(actual_token) == expected[i].number;
+    }
+    if (!matches) {
+      std::cout << "Expected token type " << expected[i].type << ", got "
+                << actual.toString(actual_token) << std::endl;
+      throw std::runtime_error("Test failed");
+    }
+  }
+  // identifiers are interned, so every "x" shares one payload
+  assert(actual[3] == actual[11]);
+  assert(actual[3] != actual[1]);
+  assert(actual.identifiers().size() == 3);
+  Parser parser = Parser(actual);
+  std::unique_ptr<Program> program = parser.parse();
+  checkBasicProgram(program.get());
+}
+
+void runStreamingParseTest() {
+  // pulling tokens straight from the scanner builds the same tree, without
+  // materializing the token stream
+  Scanner scanner(basic);
+  Parser parser(scanner);
+  std::unique_ptr<Program> program = parser.parse();
+  checkBasicProgram(program.get());
+  assert(scanner.tokens().size() == 0);
+
+  // a function is handed over as soon as its closing brace is parsed, before
+  // anything after it has been scanned
+  const std::string source = "def f(x) {\n"
+                             "return x\n"
+                             "}\n"
+                             "def g(x) { return @ }\n";
+  Scanner scanner2(source);
+  Parser parser2(scanner2);
+  FunctionNode *f = parser2.parseFunction();
+  assert(f && f->getFunctionDeclaration()->getName() == "f");
+  bool threw = false;
+  try {
+    parser2.parseFunction();
+  } catch (const std::runtime_error &) {
+    threw = true;
+  }
+  assert(threw);
+}
+
+void runParallelParseTest() {
+  std::string source;
+  for (int i = 0; i < 64; i++) {
+    std::string n = std::to_string(i);
+    // defs in comments and inside identifiers aren't function boundaries
+    source += "# def in a comment\n";
+    source += "def f" + n + "(undefined) { return undefined + " + n + " }\n";
+  }
+  auto slices = splitAtFunctions(source, 8);
+  assert(slices.size() == 8);
+  size_t covered = 0;
+  for (size_t i = 0; i < slices.size(); i++) {
+    assert(slices[i].data() == source.data() + covered);
+    assert(i == 0 || slices[i].substr(0, 4) == "def ");
+    covered += slices[i].size();
+  }
+  assert(covered == source.size());
+  // more parts than functions leaves one slice per function at most
+  assert(splitAtFunctions(basic, 4).size() == 1);
+
+  std::unique_ptr<Program> program = parseParallel(source, 8);
+  assert(program->getFunctions().size() == 64);
+  for (int i = 0; i < 64; i++) {
+    assert(program->getFunctions()[i]->getFunctionDeclaration()->getName() ==
+           "f" + std::to_string(i));
+  }
+  checkBasicProgram(parseParallel(basic, 4).get());
+}
+
+void runNumberLiteralTest() {
+  const std::string source = "0x1F 1e3 2.5e-2 7 7i64 3i32 1.5f32 0.1 7";
+  Scanner scanner(source);
+  scanner.scanTokens();
+  const TokenStream &tokens = scanner.tokens();
+  assert(tokens.size() == 10);
+  const std::vector<std::pair<NumberKind, double>> expected = {
+      {num_integer, 31}, {num_float, 1000}, {num_float, 0.025},
+      {num_integer, 7},  {num_i64, 7},      {num_i32, 3},
+      {num_f32, 1.5},    {num_float, 0.1},  {num_integer, 7},
+  };
+  for (size_t i = 0; i < expected.size(); i++) {
+    assert(tokens[i].getType() == tok_number);
+    const auto &literal = tokens.getNumberLiteral(tokens[i]);
+    assert(literal.kind == expected[i].first);
+    assert(literal.value == expected[i].second);
+  }
+  // same value and kind share a table entry, different kinds don't
+  assert(tokens[3] == tokens[8]);
+  assert(tokens[3] != tokens[4]);
+}
+
+void runFlatAstTest() {
+  Scanner scanner(basic);
+  scanner.scanTokens();
+  Parser parser(scanner.tokens());
+  std::unique_ptr<Program> program = parser.parse();
+
+  // the flat form round trips through the Visitor facing tree
+  FlatAst flat = FlatAst::fromProgram(*program);
+  checkBasicProgram(flat.toProgram().get());
+
+  const std::string source = "def f(x) {\n"
+                             "a = 2 * 3 + 1\n"
+                             "return g(x) + a\n"
+                             "}\n"
+                             "def g(x) {\n"
+                             "return x\n"
+                             "}\n"
+                             "def unused(x) {\n"
+                             "return f(x)\n"
+                             "}\n";
+  Scanner scanner2(source);
+  scanner2.scanTokens();
+  Parser parser2(scanner2.tokens());
+  FlatAst flat2 = FlatAst::fromProgram(*parser2.parse());
+  flat2.foldConstants();
+  auto live = flat2.liveFunctions({"f"});
+  assert(live.size() == 3 && live[0] && live[1] && !live[2]);
+  flat2.removeDeadFunctions({"f"});
+
+  auto folded = flat2.toProgram();
+  assert(folded->getFunctions().size() == 2);
+  const auto *definition = static_cast<DefinitionNode *>(
+      folded->getFunctions()[0]->getBody()->getBlocks()[0]);
+  assert(definition->getRHS()->getExprNodeType() ==
+         ExprNode::NumberLiteralNode);
+  assert(static_cast<NumberLiteralNode *>(definition->getRHS())->getValue() ==
+         7);
+}
+
+void runJitTest() {
+  const std::string source = "def scale(x, y) {\n"
+                             "z = x + y\n"
+                             "return z * 2\n"
+                             "}\n";
+  Scanner scanner(source);
+  scanner.scanTokens();
+  Parser parser(scanner.tokens());
+  std::unique_ptr<Program> program = parser.parse();
+
+  CodegenVisitor visitor;
+  visitor.visitProgramNode(program.get());
+  visitor.optimize();
+
+  std::string header;
+  llvm::raw_string_ostream header_out(header);
+  visitor.writeHeader(header_out);
+  assert(header_out.str().find("double scale(double x, double y);") !=
+         std::string::npos);
+
+  JIT jit;
+  jit.addModule(visitor.takeModule());
+  assert(jit.call("scale", {1, 2}) == 6);
+  assert(jit.call("scale", {-1.5, 0.5}) == -2);
+}
+
+void runParallelCodegenTest() {
+  std::string source;
+  for (int i = 0; i < 8; i++) {
+    std::string n = std::to_string(i);
+    source += "def f" + n + "(x) { return x * " + n + " }\n";
+  }
+  std::unique_ptr<Program> program = parseParallel(source, 3);
+
+  ParallelCodegen codegen(*program, 3);
+  std::string header;
+  llvm::raw_string_ostream header_out(header);
+  codegen.writeHeader(header_out);
+  for (int i = 0; i < 8; i++) {
+    assert(header_out.str().find("double f" + std::to_string(i) +
+                                 "(double x);") != std::string::npos);
+  }
+
+  // functions from every partition end up callable side by side
+  JIT jit;
+  codegen.addToJIT(jit);
+  assert(jit.call("f0", {2}) == 0);
+  assert(jit.call("f5", {2}) == 10);
+  assert(jit.call("f7", {2}) == 14);
+
+  ParallelCodegen linked(*program, 3);
+  std::string ir;
+  llvm::raw_string_ostream ir_out(ir);
+  linked.linkPartitions().dump(ir_out);
+  for (int i = 0; i < 8; i++) {
+    assert(ir_out.str().find("@f" + std::to_string(i) + "(") !=
+           std::string::npos);
+  }
+}
+
+void runLazyJitTest() {
+  std::string source;
+  for (int i = 0; i < 10; i++) {
+    std::string n = std::to_string(i);
+    source += "def f" + n + "(x) { return x + " + n + " }\n";
+  }
+  Scanner scanner(source);
+  JIT jit;
+  jit.addLazyProgram(Parser(scanner).parse());
+  assert(jit.compiledFunctions() == 0);
+
+  // only what gets called is compiled, and only once
+  assert(jit.call("f3", {1}) == 4);
+  assert(jit.compiledFunctions() == 1);
+  assert(jit.call("f3", {2}) == 5);
+  assert(jit.call("f9", {1}) == 10);
+  assert(jit.compiledFunctions() == 2);
+}
+
+void runTieredTest() {
+  const std::string source = "def square(x) {\n"
+                             "return x * x\n"
+                             "}\n"
+                             "def spin(n) {\n"
+                             "s = 0\n"
+                             "for (i = 0, n) {\n"
+                             "s = s + i\n"
+                             "}\n"
+                             "return s\n"
+                             "}\n" +
+                             basic;
+  Scanner scanner(source);
+  TieredEngine engine(Parser(scanner).parse(), 10);
+
+  // the recursive calls alone get fib over the threshold
+  assert(engine.call("fib", {10}) == 55);
+  assert(!engine.isCompiled("square"));
+
+  for (int i = 0; i < 10; i++) {
+    assert(engine.call("square", {double(i)}) == i * i);
+  }
+  engine.waitForCompiles();
+  assert(engine.isCompiled("square"));
+  assert(engine.call("square", {3}) == 9);
+  assert(engine.isCompiled("fib"));
+  assert(engine.call("fib", {20}) == 6765);
+
+  // a single call that loops long enough is hot too
+  assert(engine.call("spin", {5000}) == 12497500);
+  engine.waitForCompiles();
+  assert(engine.isCompiled("spin"));
+  assert(engine.call("spin", {10}) == 45);
+}
+
+void runVmTest() {
+  const std::string source = "def square(x) {\n"
+                             "return x * x\n"
+                             "}\n"
+                             "def sum(a, b) {\n"
+                             "c = square(a)\n"
+                             "c = c + square(b)\n"
+                             "if (c >= 10) {\n"
+                             "return c - 10\n"
+                             "}\n"
+                             "}\n" +
+                             basic;
+  Scanner scanner(source);
+  std::unique_ptr<Program> program = Parser(scanner).parse();
+  BytecodeProgram bytecode = BytecodeCompiler::compile(*program);
+  VM vm(bytecode);
+  assert(vm.call("square", {3}) == 9);
+  assert(vm.call("sum", {1, 3}) == 0);
+  // falls off the end
+  assert(vm.call("sum", {1, 2}) == 0);
+  assert(vm.call("sum", {4, 3}) == 15);
+  assert(vm.call("fib", {20}) == 6765);
+
+  // names are resolved to registers, arguments come first
+  const auto &square = bytecode.functions[bytecode.find("square")];
+  assert(square.arity == 1);
+  assert(square.code[0].op == op_mul && square.code[0].b == 0 &&
+         square.code[0].c == 0);
+  // comparisons feeding a branch don't materialize 1 or 0
+  const auto &fib = bytecode.functions[bytecode.find("fib")];
+  bool fused = false;
+  for (const auto &instruction : fib.code) {
+    assert(instruction.op != op_lt);
+    fused |= instruction.op == op_jump_unless_lt;
+  }
+  assert(fused);
+
+  // conversions that are no instruction leave the value in their argument's
+  // register, which the other operand mustn't take over
+  const std::string conversions = "def noop(x) {\n"
+                                  "return f64(i32(x)) + 1\n"
+                                  "}\n"
+                                  "def nested(x) {\n"
+                                  "return f64(i32(x)) + f64(i64(x * 2))\n"
+                                  "}\n";
+  Scanner scanner2(conversions);
+  std::unique_ptr<Program> program2 = Parser(scanner2).parse();
+  checkTypes(*program2);
+  BytecodeProgram bytecode2 = BytecodeCompiler::compile(*program2);
+  VM vm2(bytecode2);
+  assert(vm2.call("noop", {3.7}) == 4);
+  assert(vm2.call("nested", {3.7}) == 10);
+}
+
+void runCacheTest() {
+  llvm::SmallString<128> directory;
+  auto ec = llvm::sys::fs::createUniqueDirectory("lang-cache", directory);
+  assert(!ec);
+  CompileCache cache(std::string(directory.str()));
+
+  std::string source;
+  for (int i = 0; i < 40; i++) {
+    std::string n = std::to_string(i);
+    source += "def f" + n + "(x) { return x * " + n + " }\n";
+  }
+  Scanner scanner(source);
+  std::unique_ptr<Program> program = Parser(scanner).parse();
+
+  ParallelCodegen cold(*program, 2, &cache);
+  assert(cold.cacheHits() == 0);
+  std::string cold_header;
+  llvm::raw_string_ostream cold_out(cold_header);
+  cold.writeHeader(cold_out);
+
+  // a second build of the same program compiles nothing
+  ParallelCodegen warm(*program, 2, &cache);
+  assert(warm.cacheHits() > 0);
+  std::string warm_header;
+  llvm::raw_string_ostream warm_out(warm_header);
+  warm.writeHeader(warm_out);
+  assert(warm_out.str() == cold_out.str());
+
+  JIT jit;
+  warm.addToJIT(jit);
+  assert(jit.call("f0", {2}) == 0);
+  assert(jit.call("f39", {2}) == 78);
+
+  // lazily compiled functions are cached one by one
+  Scanner lazy_cold_scanner(source);
+  JIT lazy_cold(&cache);
+  lazy_cold.addLazyProgram(Parser(lazy_cold_scanner).parse());
+  assert(lazy_cold.call("f7", {3}) == 21);
+  assert(lazy_cold.compiledFunctions() == 1);
+  Scanner lazy_warm_scanner(source);
+  JIT lazy_warm(&cache);
+  lazy_warm.addLazyProgram(Parser(lazy_warm_scanner).parse());
+  assert(lazy_warm.call("f7", {3}) == 21);
+  assert(lazy_warm.compiledFunctions() == 0);
+
+  llvm::sys::fs::remove_directories(directory);
+}
+
+void runAstFileTest() {
+  Scanner scanner(basic);
+  std::string serialized = serializeProgram(*Parser(scanner).parse());
+  assert(isSerializedProgram(serialized));
+  assert(!isSerializedProgram(basic));
+
+  // names point into the serialized bytes, not the source
+  std::unique_ptr<Program> loaded = loadProgram(serialized);
+  checkBasicProgram(loaded.get());
+  assert(serializeProgram(*loaded) == serialized);
+
+  const std::string source = "def scale(x, y) {\n"
+                             "z = x + y\n"
+                             "return z * 0.25\n"
+                             "}\n";
+  Scanner scanner2(source);
+  std::string serialized2 = serializeProgram(*Parser(scanner2).parse());
+  JIT jit;
+  ParallelCodegen(*loadProgram(serialized2), 1).addToJIT(jit);
+  assert(jit.call("scale", {1, 2}) == 0.75);
+}
+
+void runSsaTest() {
+  llvm::LLVMContext context;
+  llvm::Module module("ssa", context);
+  llvm::Type *type = llvm::Type::getDoubleTy(context);
+  auto *function_type = llvm::FunctionType::get(type, {type, type}, false);
+  auto *function = llvm::Function::Create(
+      function_type, llvm::Function::ExternalLinkage, "f", module);
+  llvm::Value *x = function->getArg(0);
+  llvm::Value *y = function->getArg(1);
+  auto *entry = llvm::BasicBlock::Create(context, "entry", function);
+  auto *then = llvm::BasicBlock::Create(context, "then", function);
+  auto *join = llvm::BasicBlock::Create(context, "join", function);
+  auto *header = llvm::BasicBlock::Create(context, "header", function);
+  auto *body = llvm::BasicBlock::Create(context, "body", function);
+  auto *exit = llvm::BasicBlock::Create(context, "exit", function);
+  llvm::IRBuilder<> builder(entry);
+  SsaBuilder ssa;
+  auto a = ssa.addVariable(type);
+  auto b = ssa.addVariable(type);
+
+  // a = x, b = y; if (x < y) { a = y }
+  ssa.sealBlock(entry);
+  ssa.writeVariable(a, entry, x);
+  ssa.writeVariable(b, entry, y);
+  builder.CreateCondBr(builder.CreateFCmpOLT(x, y), then, join);
+  ssa.sealBlock(then);
+  builder.SetInsertPoint(then);
+  ssa.writeVariable(a, then, y);
+  builder.CreateBr(join);
+
+  // only a is merged at the join, b is the same on both paths
+  ssa.sealBlock(join);
+  builder.SetInsertPoint(join);
+  auto *merged = llvm::dyn_cast<llvm::PHINode>(ssa.readVariable(a, join));
+  assert(merged && merged->getNumIncomingValues() == 2);
+  assert(ssa.readVariable(b, join) == y);
+  builder.CreateBr(header);
+
+  // while (...) { a = a + 1 }, the header isn't sealed until the back edge
+  // exists
+  builder.SetInsertPoint(header);
+  llvm::Value *a_in_header = ssa.readVariable(a, header);
+  llvm::Value *b_in_header = ssa.readVariable(b, header);
+  builder.CreateCondBr(builder.CreateFCmpOLT(a_in_header, b_in_header), body,
+                       exit);
+  ssa.sealBlock(body);
+  builder.SetInsertPoint(body);
+  ssa.writeVariable(a, body,
+                    builder.CreateFAdd(ssa.readVariable(a, body),
+                                       llvm::ConstantFP::get(type, 1.0)));
+  builder.CreateBr(header);
+  ssa.sealBlock(header);
+  ssa.sealBlock(exit);
+  builder.SetInsertPoint(exit);
+  builder.CreateRet(builder.CreateFAdd(ssa.readVariable(a, exit),
+                                       ssa.readVariable(b, exit)));
+  assert(!llvm::verifyFunction(*function, &llvm::errs()));
+
+  // a needs a phi in the loop header, b is loop invariant and doesn't
+  size_t header_phis = 0;
+  for (auto &phi : header->phis()) {
+    header_phis++;
+    for (llvm::Value *incoming : phi.incoming_values()) {
+      assert(incoming != y);
+    }
+  }
+  assert(header_phis == 1);
+  for (auto &block : *function) {
+    for (auto &instruction : block) {
+      assert(!llvm::isa<llvm::AllocaInst>(instruction));
+    }
+  }
+
+  // codegen reads and writes variables the same way, before any optimization
+  const std::string source = "def f(x, y) {\n"
+                             "z = x + y\n"
+                             "z = z * z\n"
+                             "return z - x\n"
+                             "}\n";
+  Scanner scanner(source);
+  CodegenVisitor visitor;
+  visitor.visitProgramNode(Parser(scanner).parse().get());
+  std::string ir;
+  llvm::raw_string_ostream ir_out(ir);
+  visitor.dump(ir_out);
+  assert(ir_out.str().find("alloca") == std::string::npos);
+  assert(ir_out.str().find("load") == std::string::npos);
+}
+
+void runSymbolTableTest() {
+  SymbolTable<int> symbols;
+  symbols.pushScope();
+  symbols.declare(0, 10);
+  symbols.declare(1, 11);
+
+  // inner scopes see outer names and can shadow them
+  symbols.pushScope();
+  assert(*symbols.lookup(0) == 10);
+  symbols.declare(1, 21);
+  symbols.declare(2, 22);
+  assert(*symbols.lookup(1) == 21);
+  assert(*symbols.lookup(2) == 22);
+  assert(symbols.depth() == 2);
+
+  // leaving it restores what was shadowed and drops what it declared
+  symbols.popScope();
+  assert(*symbols.lookup(1) == 11);
+  assert(symbols.lookup(2) == nullptr);
+  assert(symbols.lookup(100) == nullptr);
+  symbols.popScope();
+  assert(symbols.lookup(0) == nullptr);
+  assert(symbols.depth() == 0);
+}
+
+void runConditionalTest() {
+  const std::string source = "def clamp(x, lo, hi) {\n"
+                             "if (x < lo) {\n"
+                             "return lo\n"
+                             "}\n"
+                             "if (x > hi) {\n"
+                             "return hi\n"
+                             "}\n"
+                             "return x\n"
+                             "}\n"
+                             "def sign(x) {\n"
+                             "s = 0\n"
+                             "if (x > 0) {\n"
+                             "s = 1\n"
+                             "} else {\n"
+                             "s = 0 - 1\n"
+                             "}\n"
+                             "return s\n"
+                             "}\n"
+                             "def hot(x) {\n"
+                             "y = x * 2\n"
+                             "if (x >= 100) unlikely {\n"
+                             "y = x % 7\n"
+                             "}\n"
+                             "return y\n"
+                             "}\n"
+                             "def steps(x) {\n"
+                             "if (x <= 1 + 1 * 2) {\n"
+                             "if (x) {\n"
+                             "return 1 + 2 * 3 - 4 / 2\n"
+                             "}\n"
+                             "} else {\n"
+                             "return x < 10\n"
+                             "}\n"
+                             "}\n";
+  Scanner scanner(source);
+  std::unique_ptr<Program> program = Parser(scanner).parse();
+
+  // sign's bodies are small enough to be computed without branching, hot's
+  // annotated branch stays a branch with weights on it
+  CodegenVisitor visitor;
+  visitor.visitProgramNode(program.get());
+  std::string ir;
+  llvm::raw_string_ostream ir_out(ir);
+  visitor.dump(ir_out);
+  size_t sign = ir_out.str().find("define double @sign");
+  size_t hot = ir_out.str().find("define double @hot");
+  assert(ir_out.str().find("select", sign) < hot);
+  assert(ir_out.str().find("br i1", sign) > hot);
+  assert(ir_out.str().find("!{!\"branch_weights\", i32 1, i32 2000}") !=
+         std::string::npos);
+
+  JIT jit;
+  visitor.optimize();
+  jit.addModule(visitor.takeModule());
+  Interpreter interpreter(
+      [](std::string_view, const std::vector<double> &) { return 0.0; });
+  const std::pair<std::string_view, std::vector<double>> calls[] = {
+      {"clamp", {-5, 0, 10}}, {"clamp", {5, 0, 10}}, {"clamp", {50, 0, 10}},
+      {"sign", {3}},          {"sign", {-3}},        {"hot", {5}},
+      {"hot", {200}},         {"steps", {0}},        {"steps", {2}},
+      {"steps", {5}},         {"steps", {20}},
+  };
+  const double expected[] = {0, 5, 10, 1, -1, 10, 4, 0, 5, 1, 0};
+  for (size_t i = 0; i < std::size(calls); i++) {
+    const auto &[name, args] = calls[i];
+    assert(jit.call(std::string(name), args) == expected[i]);
+    const FunctionNode *function = nullptr;
+    for (const auto *candidate : program->getFunctions()) {
+      if (candidate->getFunctionDeclaration()->getName() == name) {
+        function = candidate;
+      }
+    }
+    assert(interpreter.run(function, args) == expected[i]);
+  }
+}
+
+void runTypesTest() {
+  const std::string source = "def sum(n: i64): i64 {\n"
+                             "s = 0\n"
+                             "if (n > 3) {\n"
+                             "s = n * 2 + 1\n"
+                             "} else {\n"
+                             "s = n / 2\n"
+                             "}\n"
+                             "return s % 7\n"
+                             "}\n"
+                             "def half(x: i32): i32 {\n"
+                             "return x / 2 - 1\n"
+                             "}\n"
+                             "def scale(x: f32, y: f32): f32 {\n"
+                             "return x * y + 0.5\n"
+                             "}\n"
+                             "def conv(x) {\n"
+                             "a = i64(x)\n"
+                             "b = i32(a * 3)\n"
+                             "return f64(b) + f64(f32(x))\n"
+                             "}\n"
+                             "def square(x: i32): i32 {\n"
+                             "return x * x\n"
+                             "}\n"
+                             "def wrapped(): i32 {\n"
+                             "return 2147483647 + 1\n"
+                             "}\n";
+  const std::pair<std::string, std::vector<double>> calls[] = {
+      {"sum", {10}},      {"sum", {3}},       {"half", {7}},
+      {"half", {-7}},     {"scale", {1.1, 3}}, {"conv", {2.75}},
+      {"square", {100000}}, {"wrapped", {}}, {"square", {2147483647}},
+  };
+  // scale computes in float, from its arguments rounded to float
+  const double expected[] = {
+      0, 1, 2, -4, 1.1f * 3 + 0.5f, 8.75, 1410065408, -2147483648.0, 1};
+
+  Scanner scanner(source);
+  std::unique_ptr<Program> program = Parser(scanner).parse();
+  checkTypes(*program);
+  const auto *sum = program->getFunctions()[0]->getFunctionDeclaration();
+  assert(sum->isTyped() && sum->getArgType(0) == type_i64 &&
+         sum->getReturnType() == type_i64);
+
+  // typed functions keep their types in C, and get an all f64 entry the JIT
+  // calls through
+  CodegenVisitor visitor;
+  visitor.visitProgramNode(program.get());
+  std::string header;
+  llvm::raw_string_ostream header_out(header);
+  visitor.writeHeader(header_out);
+  assert(header_out.str().find("int64_t sum(int64_t n);") !=
+         std::string::npos);
+  assert(header_out.str().find("float scale(float x, float y);") !=
+         std::string::npos);
+  assert(header_out.str().find(kBoxedSuffix) == std::string::npos);
+  JIT jit;
+  visitor.optimize();
+  jit.addModule(visitor.takeModule());
+
+  BytecodeProgram bytecode = BytecodeCompiler::compile(*program);
+  VM vm(bytecode);
+  Interpreter interpreter(
+      [](std::string_view, const std::vector<double> &) { return 0.0; });
+  for (size_t i = 0; i < std::size(calls); i++) {
+    const auto &[name, args] = calls[i];
+    assert(jit.call(name, args) == expected[i]);
+    assert(vm.call(name, args) == expected[i]);
+    const FunctionNode *function = nullptr;
+    for (const auto *candidate : program->getFunctions()) {
+      if (candidate->getFunctionDeclaration()->getName() == name) {
+        function = candidate;
+      }
+    }
+    assert(interpreter.run(function, args) == expected[i]);
+  }
+
+  // folding wraps like the generated code
+  FlatAst flat = FlatAst::fromProgram(*program);
+  flat.foldConstants();
+  auto folded = flat.toProgram();
+  const auto *wrapped = static_cast<ReturnNode *>(
+      folded->getFunctions()[5]->getBody()->getBlocks()[0]);
+  assert(wrapped->getExpr()->getExprNodeType() == ExprNode::NumberLiteralNode);
+  assert(static_cast<NumberLiteralNode *>(wrapped->getExpr())->getValue() ==
+         -2147483648.0);
+
+  // the tiered engine runs typed functions in both tiers
+  Scanner scanner2(source);
+  std::unique_ptr<Program> program2 = Parser(scanner2).parse();
+  checkTypes(*program2);
+  TieredEngine engine(std::move(program2), 2);
+  for (int i = 0; i < 2; i++) {
+    assert(engine.call("half", {7}) == 2);
+  }
+  engine.waitForCompiles();
+  assert(engine.isCompiled("half"));
+  assert(engine.call("half", {-7}) == -4);
+
+  // division by -1 wraps like the interpreter, and a divisor that isn't a
+  // nonzero constant is checked
+  const std::string division = "def idiv(a: i64, b: i64): i64 {\n"
+                               "return a / b\n"
+                               "}\n"
+                               "def imod(a: i64, b: i64): i64 {\n"
+                               "return a % b\n"
+                               "}\n"
+                               "def halve(a: i64): i64 {\n"
+                               "return a / 2\n"
+                               "}\n";
+  Scanner scanner4(division);
+  std::unique_ptr<Program> program4 = Parser(scanner4).parse();
+  checkTypes(*program4);
+  CodegenVisitor visitor4;
+  visitor4.visitProgramNode(program4.get());
+  std::string ir;
+  llvm::raw_string_ostream ir_out(ir);
+  visitor4.dump(ir_out);
+  const size_t halve = ir_out.str().find("@halve(");
+  assert(ir_out.str().find("divisionbyzero") < halve);
+  assert(ir_out.str().find("divisionbyzero", halve) == std::string::npos);
+  JIT jit4;
+  jit4.addModule(visitor4.takeModule());
+  const double min = -9223372036854775808.0;
+  assert(jit4.call("idiv", {min, -1}) == min);
+  assert(jit4.call("imod", {min, -1}) == 0);
+  assert(jit4.call("idiv", {-7, 2}) == -3);
+  assert(jit4.call("imod", {-7, 2}) == -1);
+  assert(jit4.call("halve", {9}) == 4);
+
+  // a function defined before it's used shadows the conversion of that name
+  const std::string shadowed = "def f32(a, b) {\n"
+                               "return a + b\n"
+                               "}\n"
+                               "def g(x) {\n"
+                               "return f32(x, 1)\n"
+                               "}\n";
+  Scanner scanner3(shadowed);
+  std::unique_ptr<Program> program3 = Parser(scanner3).parse();
+  checkTypes(*program3);
+  const auto *call = static_cast<FunctionCallExprNode *>(
+      static_cast<ReturnNode *>(
+          program3->getFunctions()[1]->getBody()->getBlocks()[0])
+          ->getExpr());
+  assert(!call->isConversion());
+  BytecodeProgram bytecode3 = BytecodeCompiler::compile(*program3);
+  assert(VM(bytecode3).call("g", {2}) == 3);
+
+  // the whole program is declared before it's checked, so typed functions
+  // can be called from above
+  const std::string forward = "def g(x: i64): i64 {\n"
+                              "return h(x) + 1\n"
+                              "}\n"
+                              "def h(x: i64): i64 {\n"
+                              "return x * 2\n"
+                              "}\n";
+  Scanner scanner5(forward);
+  std::unique_ptr<Program> program5 = Parser(scanner5).parse();
+  checkTypes(*program5);
+  const auto *forward_call = static_cast<FunctionCallExprNode *>(
+      static_cast<BinaryExprNode *>(
+          static_cast<ReturnNode *>(
+              program5->getFunctions()[0]->getBody()->getBlocks()[0])
+              ->getExpr())
+          ->getLHS());
+  assert(forward_call->getType() == type_i64);
+  CodegenVisitor visitor5;
+  visitor5.visitProgramNode(program5.get());
+  JIT jit5;
+  jit5.addModule(visitor5.takeModule());
+  assert(jit5.call("g", {20}) == 41);
+  BytecodeProgram bytecode5 = BytecodeCompiler::compile(*program5);
+  assert(VM(bytecode5).call("g", {20}) == 41);
+}
+
+void runLoopTest() {
+  const std::string source = "def count(n: i64): i64 {\n"
+                             "s = 0\n"
+                             "for (i = 0, n) unroll(4) {\n"
+                             "s = s + i % 7\n"
+                             "}\n"
+                             "return s\n"
+                             "}\n"
+                             "def halvings(x) {\n"
+                             "n = 0\n"
+                             "while (x > 1) {\n"
+                             "x = x / 2\n"
+                             "n = n + 1\n"
+                             "}\n"
+                             "return n\n"
+                             "}\n"
+                             "def hinted(n: i64) {\n"
+                             "s = 0\n"
+                             "for (i = 0, n) vectorize {\n"
+                             "s = s + f64(i) * 0.5\n"
+                             "}\n"
+                             "return s\n"
+                             "}\n"
+                             "def plain(n: i64) {\n"
+                             "s = 0\n"
+                             "for (i = 0, n) {\n"
+                             "s = s + f64(i) * 0.5\n"
+                             "}\n"
+                             "return s\n"
+                             "}\n"
+                             "def early(n: i32): i32 {\n"
+                             "c = 0\n"
+                             "for (i = 1, n, 3) unroll(1) {\n"
+                             "if (i > 10) {\n"
+                             "return c\n"
+                             "}\n"
+                             "c = c + i\n"
+                             "}\n"
+                             "return c\n"
+                             "}\n"
+                             "def outer(n) {\n"
+                             "i = 100\n"
+                             "for (i = 0, i + n) {\n"
+                             "t = i\n"
+                             "}\n"
+                             "return i\n"
+                             "}\n";
+  Scanner scanner(source);
+  std::unique_ptr<Program> program = Parser(scanner).parse();
+  checkTypes(*program);
+
+  // the hints end up on the back edges
+  CodegenVisitor visitor;
+  visitor.visitProgramNode(program.get());
+  std::string ir;
+  llvm::raw_string_ostream ir_out(ir);
+  visitor.dump(ir_out);
+  assert(ir_out.str().find("!{!\"llvm.loop.unroll.count\", i32 4}") !=
+         std::string::npos);
+  assert(ir_out.str().find("!{!\"llvm.loop.vectorize.enable\", i1 true}") !=
+         std::string::npos);
+  assert(ir_out.str().find("!{!\"llvm.loop.unroll.disable\"}") !=
+         std::string::npos);
+
+  // the float sum is only vectorized when asked to, since that changes the
+  // order it's added up in
+  visitor.optimize();
+  ir.clear();
+  visitor.dump(ir_out);
+  size_t hinted = ir_out.str().find("define double @hinted(");
+  size_t plain = ir_out.str().find("define double @plain(");
+  size_t plain_end = ir_out.str().find("\n}\n", plain);
+  assert(ir_out.str().find("vector.body", hinted) < plain);
+  assert(ir_out.str().find("vector.body", plain) > plain_end);
+
+  JIT jit;
+  jit.addModule(visitor.takeModule());
+  BytecodeProgram bytecode = BytecodeCompiler::compile(*program);
+  VM vm(bytecode);
+  Interpreter interpreter(
+      [](std::string_view, const std::vector<double> &) { return 0.0; });
+  const std::pair<std::string, std::vector<double>> calls[] = {
+      {"count", {100}}, {"count", {0}}, {"halvings", {1000}},
+      {"hinted", {10}}, {"plain", {10}}, {"early", {100}},
+      {"early", {8}},   {"outer", {5}},
+  };
+  const double expected[] = {295, 0, 10, 22.5, 22.5, 22, 12, 5};
+  for (size_t i = 0; i < std::size(calls); i++) {
+    const auto &[name, args] = calls[i];
+    assert(jit.call(name, args) == expected[i]);
+    assert(vm.call(name, args) == expected[i]);
+    const FunctionNode *function = nullptr;
+    for (const auto *candidate : program->getFunctions()) {
+      if (candidate->getFunctionDeclaration()->getName() == name) {
+        function = candidate;
+      }
+    }
+    assert(interpreter.run(function, args) == expected[i]);
+  }
+
+  // loop iterations are reported in batches, for the function running them
+  uint32_t back_edges = 0;
+  Interpreter counting(
+      [](std::string_view, const std::vector<double> &) { return 0.0; },
+      [&](const FunctionNode *function, uint32_t count) {
+        assert(function == program->getFunctions()[0]);
+        back_edges += count;
+      });
+  assert(counting.run(program->getFunctions()[0], {1000}) == 2997);
+  assert(back_edges == 3 * Interpreter::kBackEdgeBatch);
+  assert(counting.run(program->getFunctions()[1], {1000}) == 10);
+  assert(back_edges == 3 * Interpreter::kBackEdgeBatch);
+
+  // loops and their hints survive the flat and serialized forms
+  auto firstLoop = [](const Program &loaded) {
+    return static_cast<const ForNode *>(
+        loaded.getFunctions()[0]->getBody()->getBlocks()[1]);
+  };
+  auto flat = FlatAst::fromProgram(*program).toProgram();
+  std::string serialized = serializeProgram(*program);
+  auto loaded = loadProgram(serialized);
+  for (const Program *copy : {flat.get(), loaded.get()}) {
+    const auto *loop = firstLoop(*copy);
+    assert(loop->getBodyNodeType() == BodySubNode::ForNode);
+    assert(loop->getVariable() == "i");
+    assert(loop->getHints().unroll_count == 4 && !loop->getHints().vectorize);
+  }
+}
+
+void runSliceTest() {
+  const std::string source = "def sum(xs: f64[]) {\n"
+                             "s = 0\n"
+                             "for (i = 0, len(xs)) vectorize {\n"
+                             "s = s + xs[i]\n"
+                             "}\n"
+                             "return s\n"
+                             "}\n"
+                             "def scale(xs: f64[], k) {\n"
+                             "for (i = 0, len(xs)) {\n"
+                             "xs[i] = xs[i] * k\n"
+                             "}\n"
+                             "return 0\n"
+                             "}\n"
+                             "def window(xs: i64[], from: i64, "
+                             "to: i64): i64 {\n"
+                             "s = 0\n"
+                             "for (i = from, to) {\n"
+                             "s = s + xs[i]\n"
+                             "}\n"
+                             "return s\n"
+                             "}\n"
+                             "def at(xs: f32[], i: i64): f32 {\n"
+                             "return xs[i]\n"
+                             "}\n"
+                             "def guarded(xs: f64[], n: i64) {\n"
+                             "s = 0\n"
+                             "for (i = 0, n) {\n"
+                             "if (i < len(xs)) {\n"
+                             "s = s + xs[i]\n"
+                             "}\n"
+                             "}\n"
+                             "return s\n"
+                             "}\n"
+                             "def search(xs: f64[], n: i64): i64 {\n"
+                             "for (i = 0, n) {\n"
+                             "if (xs[i] > 5) {\n"
+                             "return i\n"
+                             "}\n"
+                             "}\n"
+                             "return n\n"
+                             "}\n";
+  Scanner scanner(source);
+  std::unique_ptr<Program> program = Parser(scanner).parse();
+  checkTypes(*program);
+  const auto *at = program->getFunctions()[3];
+  assert(at->getFunctionDeclaration()->getArgType(0) == type_f32_slice);
+  assert(at->getFunctionDeclaration()->takesSlices());
+
+  CodegenVisitor visitor;
+  visitor.visitProgramNode(program.get());
+  std::string header;
+  llvm::raw_string_ostream header_out(header);
+  visitor.writeHeader(header_out);
+  assert(header_out.str().find("double sum(const double *xs, size_t "
+                               "xs_len);") != std::string::npos);
+  assert(header_out.str().find("double scale(double *xs, size_t xs_len, "
+                               "double k);") != std::string::npos);
+
+  // loops over the whole slice need no checks. a loop over part of it checks
+  // its range once up front, and runs a copy that checks every access if
+  // that fails. a lone index checks itself.
+  std::string ir;
+  llvm::raw_string_ostream ir_out(ir);
+  visitor.dump(ir_out);
+  auto body = [&](const std::string &name) {
+    size_t begin = ir_out.str().find("@" + name + "(");
+    return ir_out.str().substr(begin, ir_out.str().find("\n}\n", begin) -
+                                          begin);
+  };
+  assert(body("sum").find("outofbounds") == std::string::npos);
+  assert(body("scale").find("outofbounds") == std::string::npos);
+  assert(body("window").find("emptytmp") != std::string::npos);
+  assert(body("window").find("inbounds") <
+         body("window").find("loopbody"));
+  assert(body("window").find("checked") != std::string::npos);
+  assert(body("at").find("outofbounds") != std::string::npos);
+  assert(body("sum").find("noalias nocapture readonly align 8 %xs") !=
+         std::string::npos);
+  assert(body("at").find("align 4 %xs") != std::string::npos);
+  assert(ir_out.str().find("sum.boxed") == std::string::npos);
+
+  visitor.optimize();
+  ir.clear();
+  visitor.dump(ir_out);
+  assert(body("sum").find("vector.body") != std::string::npos);
+  assert(body("scale").find("vector.body") != std::string::npos);
+
+  JIT jit;
+  jit.addModule(visitor.takeModule());
+  std::vector<double> xs(100);
+  for (size_t i = 0; i < xs.size(); i++) {
+    xs[i] = i;
+  }
+  auto sum = reinterpret_cast<double (*)(const double *, size_t)>(
+      jit.lookup("sum"));
+  auto scale = reinterpret_cast<double (*)(double *, size_t, double)>(
+      jit.lookup("scale"));
+  auto window =
+      reinterpret_cast<int64_t (*)(const int64_t *, size_t, int64_t,
+                                   int64_t)>(jit.lookup("window"));
+  auto at_fn =
+      reinterpret_cast<float (*)(const float *, size_t, int64_t)>(
+          jit.lookup("at"));
+  assert(sum(xs.data(), xs.size()) == 4950);
+  assert(sum(nullptr, 0) == 0);
+  scale(xs.data(), xs.size(), 0.5);
+  assert(xs[3] == 1.5 && sum(xs.data(), xs.size()) == 2475);
+  const int64_t ints[] = {1, 2, 3, 4, 5};
+  assert(window(ints, 5, 1, 4) == 9);
+  // an empty range doesn't touch the slice, so it can't be out of bounds
+  assert(window(ints, 5, 7, 2) == 0);
+  const float floats[] = {0.5f, 1.5f};
+  assert(at_fn(floats, 2, 1) == 1.5f);
+  // the range is longer than the slice, but every access is in bounds
+  auto guarded = reinterpret_cast<double (*)(const double *, size_t,
+                                             int64_t)>(jit.lookup("guarded"));
+  auto search = reinterpret_cast<int64_t (*)(const double *, size_t,
+                                             int64_t)>(jit.lookup("search"));
+  const double doubles[] = {1, 4, 9, 16};
+  assert(guarded(doubles, 4, 10) == 30);
+  assert(guarded(doubles, 4, 3) == 14);
+  assert(search(doubles, 4, 100) == 2);
+  assert(search(doubles, 2, 2) == 2);
+
+  // indexing survives the flat and serialized forms
+  auto flat = FlatAst::fromProgram(*program).toProgram();
+  std::string serialized = serializeProgram(*program);
+  auto loaded = loadProgram(serialized);
+  for (const Program *copy : {flat.get(), loaded.get()}) {
+    const auto *loop = static_cast<const ForNode *>(
+        copy->getFunctions()[1]->getBody()->getBlocks()[0]);
+    const auto *store =
+        static_cast<const StoreNode *>(loop->getBody()->getBlocks()[0]);
+    assert(store->getBodyNodeType() == BodySubNode::StoreNode);
+    assert(store->getSlice() == "xs");
+    assert(store->getValue()->getExprNodeType() == ExprNode::BinaryExprNode);
+    const auto *declaration = copy->getFunctions()[2]->getFunctionDeclaration();
+    assert(declaration->getArgType(0) == type_i64_slice);
+  }
+}
+
+void runBatchTest() {
+  const std::string source = "def clamp(x, lo, hi) {\n"
+                             "if (x < lo) { return lo }\n"
+                             "if (x > hi) { return hi }\n"
+                             "return x\n"
+                             "}\n"
+                             "def half(out: i32): i32 {\n"
+                             "return out / 2\n"
+                             "}\n"
+                             "def sum(xs: f64[]) {\n"
+                             "return 0\n"
+                             "}\n";
+  Scanner scanner(source);
+  std::unique_ptr<Program> program = Parser(scanner).parse();
+  checkTypes(*program);
+  CodegenOptions options;
+  options.batch_entries = true;
+  CodegenVisitor visitor(options);
+  visitor.visitProgramNode(program.get());
+  std::string header;
+  llvm::raw_string_ostream header_out(header);
+  visitor.writeHeader(header_out);
+  assert(header_out.str().find("void clamp_batch(const double *x, const "
+                               "double *lo, const double *hi, double *out, "
+                               "size_t count);") != std::string::npos);
+  // the output is renamed rather than shadow an argument
+  assert(header_out.str().find("void half_batch(const int32_t *out, "
+                               "int32_t *out_, size_t count);") !=
+         std::string::npos);
+  assert(header_out.str().find("sum_batch") == std::string::npos);
+
+  // the scalar body is inlined into the loop, which is then vectorized
+  visitor.optimize();
+  std::string ir;
+  llvm::raw_string_ostream ir_out(ir);
+  visitor.dump(ir_out);
+  size_t begin = ir_out.str().find("@clamp_batch(");
+  std::string batch_ir =
+      ir_out.str().substr(begin, ir_out.str().find("\n}\n", begin) - begin);
+  assert(batch_ir.find("vector.body") != std::string::npos);
+  assert(batch_ir.find("call") == std::string::npos);
+
+  // only requested
+  CodegenVisitor plain;
+  plain.visitProgramNode(program.get());
+  std::string plain_ir;
+  llvm::raw_string_ostream plain_out(plain_ir);
+  plain.dump(plain_out);
+  assert(plain_out.str().find("_batch") == std::string::npos);
+
+  JIT jit;
+  jit.addModule(visitor.takeModule());
+  auto clamp = reinterpret_cast<double (*)(double, double, double)>(
+      jit.lookup("clamp"));
+  auto clamp_batch = reinterpret_cast<void (*)(
+      const double *, const double *, const double *, double *, size_t)>(
+      jit.lookup("clamp_batch"));
+  auto half_batch =
+      reinterpret_cast<void (*)(const int32_t *, int32_t *, size_t)>(
+          jit.lookup("half_batch"));
+  std::vector<double> xs(37), los(37, -4), his(37, 4), out(37);
+  for (size_t i = 0; i < xs.size(); i++) {
+    xs[i] = i * 0.5 - 9;
+  }
+  clamp_batch(xs.data(), los.data(), his.data(), out.data(), xs.size());
+  for (size_t i = 0; i < xs.size(); i++) {
+    assert(out[i] == clamp(xs[i], -4, 4));
+  }
+  // the output can be one of the inputs
+  clamp_batch(xs.data(), los.data(), his.data(), xs.data(), xs.size());
+  assert(xs == out);
+  clamp_batch(nullptr, nullptr, nullptr, nullptr, 0);
+  std::vector<int32_t> ints = {7, -7, 100, 1};
+  half_batch(ints.data(), ints.data(), ints.size());
+  assert(ints == std::vector<int32_t>({3, -3, 50, 0}));
+}
+
+void runExternTest() {
+  const std::string source = "extern def sqrt(x)\n"
+                             "extern def exp(x)\n"
+                             "extern def hypot(x, y)\n"
+                             "extern def fmaf(a: f32, b: f32, c: f32): f32\n"
+                             "def norm(x, y) {\n"
+                             "return sqrt(x * x + y * y)\n"
+                             "}\n"
+                             "def twice(x) {\n"
+                             "return hypot(x, 0) * 2\n"
+                             "}\n"
+                             "def fused(a: f32): f32 {\n"
+                             "return fmaf(a, a, a)\n"
+                             "}\n"
+                             "def sum(xs: f64[]) {\n"
+                             "s = 0\n"
+                             "for (i = 0, len(xs)) {\n"
+                             "s = s + xs[i]\n"
+                             "}\n"
+                             "return s\n"
+                             "}\n"
+                             "def mean(xs: f64[]) {\n"
+                             "return sum(xs) / f64(len(xs))\n"
+                             "}\n"
+                             "def exps(xs: f64[]) {\n"
+                             "for (i = 0, len(xs)) {\n"
+                             "xs[i] = exp(xs[i])\n"
+                             "}\n"
+                             "return 0\n"
+                             "}\n";
+  Scanner scanner(source);
+  std::unique_ptr<Program> program = Parser(scanner).parse();
+  checkTypes(*program);
+  const auto &functions = program->getFunctions();
+  assert(functions[0]->isExtern() && !functions[0]->getBody());
+  assert(!functions[4]->isExtern());
+  const auto *call = static_cast<const FunctionCallExprNode *>(
+      static_cast<const ReturnNode *>(functions[4]->getBody()->getBlocks()[0])
+          ->getExpr());
+  assert(call->getCallKind() == call_extern);
+
+  // math functions become intrinsics, anything else is a call
+  CodegenVisitor visitor;
+  visitor.visitProgramNode(program.get());
+  std::string ir;
+  llvm::raw_string_ostream ir_out(ir);
+  visitor.dump(ir_out);
+  assert(ir_out.str().find("call double @llvm.sqrt.f64(") !=
+         std::string::npos);
+  assert(ir_out.str().find("call float @llvm.fma.f32(") != std::string::npos);
+  assert(ir_out.str().find("call double @hypot(") != std::string::npos);
+  assert(ir_out.str().find("call double @sum(double* %xs, i64 %xs_len)") !=
+         std::string::npos);
+  assert(ir_out.str().find("define double @sqrt") == std::string::npos);
+  std::string header;
+  llvm::raw_string_ostream header_out(header);
+  visitor.writeHeader(header_out);
+  assert(header_out.str().find("hypot") == std::string::npos);
+
+  visitor.optimize();
+  JIT jit;
+  jit.addModule(visitor.takeModule());
+  assert(jit.call("norm", {3, 4}) == 5);
+  assert(jit.call("twice", {3}) == 6);
+  assert(jit.call("fused", {2}) == 6);
+  // the extern's all f64 entry calls the C function
+  assert(jit.call("fmaf", {2, 3, 1}) == 7);
+  auto mean = reinterpret_cast<double (*)(const double *, size_t)>(
+      jit.lookup("mean"));
+  const double xs[] = {1, 2, 3, 6};
+  assert(mean(xs, 4) == 3);
+
+  // calls between functions are lowered, recursion included
+  Scanner fib_scanner(basic);
+  JIT lazy_jit;
+  lazy_jit.addLazyProgram(Parser(fib_scanner).parse());
+  assert(lazy_jit.call("fib", {20}) == 6765);
+  assert(lazy_jit.compiledFunctions() == 1);
+
+  // the tiers without a compiler call untyped externs directly
+  BytecodeProgram bytecode = BytecodeCompiler::compile(*program);
+  VM vm(bytecode);
+  assert(vm.call("norm", {3, 4}) == 5);
+  assert(vm.call("sqrt", {9}) == 3);
+  Interpreter interpreter([](std::string_view, const std::vector<double> &) {
+    return 0.0;
+  });
+  assert(interpreter.run(functions[0], {16}) == 4);
+  {
+    Scanner tiered_scanner(source);
+    auto tiered_program = Parser(tiered_scanner).parse();
+    checkTypes(*tiered_program);
+    TieredEngine engine(std::move(tiered_program), 10);
+    for (int i = 0; i < 10; i++) {
+      assert(engine.call("norm", {3, 4}) == 5);
+    }
+    engine.waitForCompiles();
+    assert(engine.isCompiled("norm"));
+    assert(engine.call("norm", {6, 8}) == 10);
+    assert(engine.call("fmaf", {2, 3, 1}) == 7);
+  }
+
+  // extern declarations survive the flat and serialized forms, and the
+  // parallel front end keeps them with their def
+  auto flat = FlatAst::fromProgram(*program).toProgram();
+  auto loaded = loadProgram(serializeProgram(*program));
+  auto parallel = parseParallel(source, 4);
+  for (const Program *copy : {flat.get(), loaded.get(), parallel.get()}) {
+    assert(copy->getFunctions().size() == functions.size());
+    for (size_t i = 0; i < functions.size(); i++) {
+      assert(copy->getFunctions()[i]->isExtern() == functions[i]->isExtern());
+    }
+    const auto *fmaf = copy->getFunctions()[3]->getFunctionDeclaration();
+    assert(fmaf->getName() == "fmaf" && fmaf->getArgType(2) == type_f32);
+  }
+
+  // with a vector library, exp in a loop becomes a call to its SIMD version
+  CodegenOptions options;
+  options.vector_library = llvm::TargetLibraryInfoImpl::LIBMVEC_X86;
+  CodegenVisitor vectorized(options);
+  vectorized.visitProgramNode(program.get());
+  vectorized.optimize();
+  ir.clear();
+  vectorized.dump(ir_out);
+  assert(ir_out.str().find("@_ZGV") != std::string::npos);
+  if (llvm::sys::DynamicLibrary::LoadLibraryPermanently("libmvec.so.1")) {
+    return;
+  }
+  JIT vector_jit;
+  vector_jit.addModule(vectorized.takeModule());
+  auto exps = reinterpret_cast<double (*)(double *, size_t)>(
+      vector_jit.lookup("exps"));
+  std::vector<double> values(37);
+  for (size_t i = 0; i < values.size(); i++) {
+    values[i] = i * 0.25 - 4;
+  }
+  exps(values.data(), values.size());
+  for (size_t i = 0; i < values.size(); i++) {
+    double expected = std::exp(i * 0.25 - 4);
+    assert(std::abs(values[i] - expected) <= expected * 1e-14);
+  }
+}
+
+void runFloatModeTest() {
+  const std::string source = "def sum(xs: f64[]) {\n"
+                             "s = 0\n"
+                             "for (i = 0, len(xs)) {\n"
+                             "s = s + xs[i]\n"
+                             "}\n"
+                             "return s\n"
+                             "}\n"
+                             "def fastsum(xs: f64[]) fastmath {\n"
+                             "s = 0\n"
+                             "for (i = 0, len(xs)) {\n"
+                             "s = s + xs[i]\n"
+                             "}\n"
+                             "return s\n"
+                             "}\n"
+                             "def madd(a, b, c) {\n"
+                             "return a * b + c\n"
+                             "}\n"
+                             "def fused(a, b, c) contract {\n"
+                             "return a * b + c\n"
+                             "}\n"
+                             "def exact(a, b, c) strict {\n"
+                             "return a * b + c\n"
+                             "}\n";
+  Scanner scanner(source);
+  std::unique_ptr<Program> program = Parser(scanner).parse();
+  checkTypes(*program);
+  const auto &functions = program->getFunctions();
+  assert(functions[0]->getFloatMode() == float_default);
+  assert(functions[1]->getFloatMode() == float_fast);
+  assert(functions[3]->getFloatMode() == float_contract);
+  assert(functions[4]->getFloatMode() == float_strict);
+
+  CodegenVisitor visitor;
+  visitor.visitProgramNode(program.get());
+  std::string ir;
+  llvm::raw_string_ostream ir_out(ir);
+  auto body = [&](const std::string &name) {
+    size_t begin = ir_out.str().find("@" + name + "(");
+    return ir_out.str().substr(begin, ir_out.str().find("\n}\n", begin) -
+                                          begin);
+  };
+  visitor.dump(ir_out);
+  assert(body("sum").find("fadd double") != std::string::npos);
+  assert(body("madd").find("fmul double") != std::string::npos);
+  assert(body("fastsum").find("fadd fast double") != std::string::npos);
+  assert(body("fused").find("fmul contract double") != std::string::npos);
+  assert(body("fused").find("fadd contract double") != std::string::npos);
+  assert(ir_out.str().find("\"unsafe-fp-math\"=\"true\"") !=
+         std::string::npos);
+
+  // only a reduction that may be reassociated is vectorized without a hint
+  visitor.optimize();
+  ir.clear();
+  visitor.dump(ir_out);
+  assert(body("fastsum").find("vector.body") != std::string::npos);
+  assert(body("sum").find("vector.body") == std::string::npos);
+
+  // strict code rounds every operation as written, exactly like C++ does
+  JIT jit;
+  jit.addModule(visitor.takeModule());
+  auto sum = reinterpret_cast<double (*)(const double *, size_t)>(
+      jit.lookup("sum"));
+  auto fastsum = reinterpret_cast<double (*)(const double *, size_t)>(
+      jit.lookup("fastsum"));
+  std::vector<double> xs;
+  for (int i = 0; i < 101; i++) {
+    xs.push_back(i % 3 == 0 ? 1e16 : i % 3 == 1 ? 1.5 : -1e16);
+  }
+  double expected = 0;
+  for (double x : xs) {
+    expected = expected + x;
+  }
+  assert(sum(xs.data(), xs.size()) == expected);
+  assert(std::abs(fastsum(xs.data(), xs.size()) - expected) <= 1e2);
+  double a = 1 + std::ldexp(1.0, -30);
+  double b = 1 - std::ldexp(1.0, -30);
+  volatile double product = a * b;
+  assert(jit.call("madd", {a, b, -1}) == product - 1);
+  assert(jit.call("exact", {a, b, -1}) == product - 1);
+
+  // the module default applies to defs without a mode of their own
+  CodegenOptions options;
+  options.float_mode = float_fast;
+  assert(options.describe() != CodegenOptions().describe());
+  CodegenVisitor fast(options);
+  fast.visitProgramNode(program.get());
+  ir.clear();
+  fast.dump(ir_out);
+  assert(body("madd").find("fmul fast double") != std::string::npos);
+  assert(body("fused").find("fmul contract double") != std::string::npos);
+  assert(body("exact").find("fmul double") != std::string::npos);
+
+  // lazily compiled functions and those of the tiered engine get the
+  // options too
+  const std::string cancel = "def cancel(x) {\n"
+                             "return (x + 1e16) - 1e16\n"
+                             "}\n";
+  auto parseCancel = [&] {
+    Scanner cancel_scanner(cancel);
+    std::unique_ptr<Program> cancel_program = Parser(cancel_scanner).parse();
+    checkTypes(*cancel_program);
+    return cancel_program;
+  };
+  JIT strict_jit;
+  strict_jit.addLazyProgram(parseCancel());
+  assert(strict_jit.call("cancel", {1}) == 0);
+  JIT fast_jit(nullptr, options);
+  fast_jit.addLazyProgram(parseCancel());
+  assert(fast_jit.call("cancel", {1}) == 1);
+  TieredEngine engine(parseCancel(), 1, options);
+  engine.call("cancel", {1});
+  engine.waitForCompiles();
+  assert(engine.isCompiled("cancel"));
+  assert(engine.call("cancel", {1}) == 1);
+
+  // modes survive the flat and serialized forms
+  auto flat = FlatAst::fromProgram(*program).toProgram();
+  auto loaded = loadProgram(serializeProgram(*program));
+  for (const Program *copy : {flat.get(), loaded.get()}) {
+    for (size_t i = 0; i < functions.size(); i++) {
+      assert(copy->getFunctions()[i]->getFloatMode() ==
+             functions[i]->getFloatMode());
+    }
+  }
+}
+
 int main(int argc, char **argv) {
   runBasicTest();
+  runStreamingParseTest();
+  runParallelParseTest();
+  runNumberLiteralTest();
+  runFlatAstTest();
+  runSsaTest();
+  runSymbolTableTest();
+  runJitTest();
+  runConditionalTest();
+  runParallelCodegenTest();
+  runLazyJitTest();
+  runTieredTest();
+  runVmTest();
+  runCacheTest();
+  runAstFileTest();
+  runTypesTest();
+  runLoopTest();
+  runSliceTest();
+  runBatchTest();
+  runExternTest();
+  runFloatModeTest();
   std::cout << "Tests succeeded!" << std::endl;
   return 0;
 }
\ No newline at end of file